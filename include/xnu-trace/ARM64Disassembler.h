@@ -1,3 +1,38 @@
 #pragma once
 
 #include "common.h"
+
+#include "log_structs.h"
+
+#include <optional>
+
+struct cs_insn;
+
+// Memory operand of a load/store, decoded once when the instruction is translated. accesses()
+// evaluates it against the register state right before the instruction executes. Multi-register
+// transfers (pairs, SIMD structures) are a single access when their total size is a power of 2,
+// otherwise one access per register.
+struct XNUTRACE_EXPORT arm64_mem_insn {
+    enum class extend : uint8_t { none, uxtw, sxtw };
+    static constexpr uint8_t no_reg = gpr_idx_sz; // reads as 0, also xzr
+
+    struct access_t {
+        uint8_t size;
+        bool read;
+        bool write;
+    };
+
+    uint8_t base{no_reg}; // gpr_idx
+    uint8_t index{no_reg};
+    extend index_ext{extend::none};
+    uint8_t index_shift{};
+    bool post_index{}; // address is the unmodified base
+    int64_t disp{};
+    uint8_t num_accesses{};
+    access_t access[mpc_num_changed_max]{}; // consecutive, starting at the effective address
+
+    mem_accesses_t accesses(const log_arm64_cpu_context &ctx) const;
+
+    // nullopt when insn doesn't access memory, insn needs capstone's detail
+    static std::optional<arm64_mem_insn> decode(const cs_insn *insn);
+};
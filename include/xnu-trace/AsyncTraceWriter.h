@@ -0,0 +1,42 @@
+#pragma once
+
+#include "common.h"
+
+#include "CompressedFile.h"
+#include "SPSCRing.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum class backpressure_policy : uint8_t {
+    block, // producer waits for the writer to make room
+    drop,  // producer drops the record, counts it and resyncs with a sync frame
+};
+
+// Background thread that drains per-thread SPSCRings into their CompressedFiles so the tracing
+// hot path never has to wait on zstd or the disk.
+class XNUTRACE_EXPORT AsyncTraceWriter {
+public:
+    AsyncTraceWriter();
+    ~AsyncTraceWriter();
+    void add(SPSCRing *ring, jev::xnutrace::detail::CompressedFile *file);
+    // Drains every ring and joins the writer thread. Producers must be quiesced.
+    void stop();
+
+private:
+    struct sink {
+        SPSCRing *ring;
+        jev::xnutrace::detail::CompressedFile *file;
+    };
+
+    void run();
+    size_t drain(const std::vector<sink> &sinks);
+
+    std::mutex m_sinks_lock;
+    std::vector<sink> m_sinks;
+    std::atomic<uint64_t> m_sinks_gen{};
+    std::atomic<bool> m_stop{};
+    std::thread m_thread;
+};
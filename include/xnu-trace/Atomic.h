@@ -25,6 +25,29 @@ private:
     std::atomic<T> m_cnt;
 };
 
+// Counter that one thread updates while others read it at any time. The owner's updates are a
+// relaxed load and store instead of a read-modify-write, as cheap as a plain integer.
+template <std::integral T> class SingleWriterCounter {
+public:
+    SingleWriterCounter(T val = 0) : m_val{val} {}
+    // only while no other thread can see either counter
+    SingleWriterCounter(const SingleWriterCounter &other) : m_val{(T)other} {}
+    operator T() const {
+        return m_val.load(std::memory_order_relaxed);
+    }
+    // owner only
+    SingleWriterCounter &operator+=(T val) {
+        m_val.store(m_val.load(std::memory_order_relaxed) + val, std::memory_order_relaxed);
+        return *this;
+    }
+    SingleWriterCounter &operator++() {
+        return *this += 1;
+    }
+
+private:
+    std::atomic<T> m_val;
+};
+
 namespace std {
 using atomic_uint128_t = std::atomic<uint128_t>;
 using atomic_int128_t  = std::atomic<int128_t>;
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "common.h"
+
+#undef NDEBUG
+#include <cassert>
+#include <cstring>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Append-only byte arena made of large fixed-size chunks so growing it never reallocates or
+// copies what was already written. Appends are never split across chunks, a record that doesn't
+// fit in the tail of the current chunk starts a new one. Chunks are mmapped, using huge pages
+// where the OS hands them out to userspace.
+class XNUTRACE_EXPORT ChunkedArena {
+public:
+    static constexpr size_t default_chunk_sz = 32 * 1024 * 1024;
+
+    ChunkedArena(size_t chunk_sz = default_chunk_sz);
+    ~ChunkedArena();
+    ChunkedArena(ChunkedArena &&other) noexcept;
+    ChunkedArena &operator=(ChunkedArena &&other) noexcept;
+    ChunkedArena(const ChunkedArena &)            = delete;
+    ChunkedArena &operator=(const ChunkedArena &) = delete;
+
+    XNUTRACE_INLINE void append(const void *buf, size_t sz) {
+        if (XNUTRACE_UNLIKELY((size_t)(m_cur_end - m_cur) < sz)) {
+            new_chunk(sz);
+        }
+        memcpy(m_cur, buf, sz);
+        m_cur += sz;
+    }
+
+    size_t size() const;
+    size_t capacity() const;
+    // used portion of every chunk, oldest first
+    std::vector<std::span<const uint8_t>> chunks() const;
+
+private:
+    struct chunk {
+        uint8_t *buf;
+        size_t capacity;
+        size_t size;
+    };
+
+    void new_chunk(size_t min_sz);
+    void release();
+
+    std::vector<chunk> m_chunks;
+    uint8_t *m_cur{};
+    uint8_t *m_cur_end{};
+    size_t m_chunk_sz;
+};
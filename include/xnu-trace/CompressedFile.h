@@ -2,22 +2,43 @@
 
 #include "common.h"
 
+#include "CompressionScheduler.h"
+#include "FileIO.h"
+#include "log_structs.h"
+
 #undef NDEBUG
 #include <cassert>
+#include <deque>
 #include <filesystem>
+#include <future>
+#include <memory>
 #include <span>
 #include <vector>
 
-struct ZSTD_CCtx_s;
 struct ZSTD_DCtx_s;
+class CompressionDict;
+
+// a key, e.g. an instruction number, and the decompressed offset it starts at
+struct seek_point {
+    uint64_t key;
+    uint64_t decomp_off;
+};
+
+// <name>.<ext> -> <name>.idx.<ext>
+XNUTRACE_EXPORT std::filesystem::path seek_index_path(const std::filesystem::path &path);
+XNUTRACE_EXPORT bool is_seek_index_path(const std::filesystem::path &path);
 
 namespace jev::xnutrace::detail {
 
 class XNUTRACE_EXPORT CompressedFile {
 public:
+    // dict has to outlive the file, it is needed for reading whenever it was used for writing.
+    // Headers only ever grow by appending fields, their size is their version: a file written
+    // with a shorter one reads the missing fields as 0, one with a longer one is from a newer
+    // version and isn't opened. hdr_sz = UINT64_MAX reads any header as is.
     CompressedFile(const std::filesystem::path &path, bool read, size_t hdr_sz, uint64_t hdr_magic,
                    const void *hdr = nullptr, int level = 3, bool verbose = false,
-                   int num_threads = 0);
+                   const CompressionDict *dict = nullptr);
     ~CompressedFile();
 
     template <typename T> const T &header() const {
@@ -42,6 +63,12 @@ public:
         read((uint8_t *)&buf, sizeof(T));
         return buf;
     }
+    // uncompressed files only: maps the whole body instead of reading it, the mapping outlives
+    // the file and doesn't move the read cursor
+    std::shared_ptr<const MappedFile> map() const;
+    // moves the read cursor to entry's point, only the part of its frame before it is
+    // decompressed
+    void seek(const log_seek_index_entry &entry);
 
     XNUTRACE_INLINE void write(std::span<const uint8_t> buf);
     XNUTRACE_INLINE void write(const void *buf, size_t size);
@@ -53,22 +80,60 @@ public:
         write({(uint8_t *)&buf, sizeof(buf)});
     }
 
+    // compresses the staged partial frame, waits for all frames in flight and flushes to disk
+    void flush();
+    // Ends the current frame and queues a footer with the decompressed size so far and the
+    // current header behind it. A file that is never closed reads as of its last footer, so
+    // call it at record boundaries. Level 0 files have no frames to end, their header and size
+    // are rewritten in place after a flush instead.
+    void checkpoint();
+    // Points have to come in increasing order of key and offset, the offset may be past what was
+    // written so far. A file with any is closed with a seek index sidecar that maps each point
+    // to the frame it is in, opening a file for writing removes a stale one.
+    void add_seek_point(uint64_t key, uint64_t decomp_off);
+
     size_t decompressed_size() const;
+    bool is_compressed() const;
+    uint64_t num_writes() const;
+    // writes: frames handed to the compression scheduler, one zstd call each. reads:
+    // ZSTD_decompressStream calls.
+    uint64_t num_zstd_ops() const;
+    uint64_t num_disk_ops() const;
 
 private:
+    void read_raw(uint8_t *buf, size_t size);
+    void recover_from_footer();
+    void submit_frame();
+    void write_frames(bool wait_all);
+    void write_seek_index() const;
+
     const std::filesystem::path m_path;
-    FILE *m_fh{};
-    ZSTD_CCtx_s *m_comp_ctx{};
+    std::unique_ptr<FileIO> m_io;
+    int m_level{};
+    const CompressionDict *m_dict{};
+    // writes: frame being staged, handed to the compression scheduler once full or, for level 0,
+    // written as is
     std::vector<uint8_t> m_in_buf;
-    std::vector<uint8_t> m_out_buf;
+    size_t m_in_pos{};
+    // reads: unconsumed part of the last block handed out by m_io
+    std::span<const uint8_t> m_in_block;
+    std::deque<std::future<compressed_frame>> m_frames_in_flight;
+    size_t m_max_frames_in_flight{};
+    std::vector<std::vector<uint8_t>> m_free_bufs;
     ZSTD_DCtx_s *m_decomp_ctx{};
     bool m_is_read{};
     bool m_verbose{};
     std::vector<uint8_t> m_hdr_buf;
     size_t m_decomp_size{};
+    uint64_t m_num_writes{};
     uint64_t m_num_disk_ops{};
     uint64_t m_num_zstd_ops{};
     size_t m_hdr_sz{};
+    // writes: compressed and decompressed offset of every data frame written so far
+    std::vector<std::pair<uint64_t, uint64_t>> m_frame_offs;
+    uint64_t m_comp_off{};
+    uint64_t m_frames_decomp_off{};
+    std::vector<seek_point> m_seek_points;
 };
 
 } // namespace jev::xnutrace::detail
@@ -77,9 +142,9 @@ template <typename HeaderT>
 class XNUTRACE_EXPORT CompressedFile : public jev::xnutrace::detail::CompressedFile {
 public:
     CompressedFile(const std::filesystem::path &path, bool read, const HeaderT *hdr = nullptr,
-                   int level = 3, bool verbose = false)
+                   int level = 3, bool verbose = false, const CompressionDict *dict = nullptr)
         : jev::xnutrace::detail::CompressedFile::CompressedFile{
-              path, read, sizeof(HeaderT), HeaderT::magic, hdr, level, verbose} {};
+              path, read, sizeof(HeaderT), HeaderT::magic, hdr, level, verbose, dict} {};
 
     const HeaderT &header() const {
         return jev::xnutrace::detail::CompressedFile::header<HeaderT>();
@@ -89,9 +154,24 @@ public:
     }
 };
 
+// Reads the seek index sidecar of a file, empty if it has none.
+class XNUTRACE_EXPORT SeekIndex {
+public:
+    SeekIndex() = default;
+    explicit SeekIndex(const std::filesystem::path &file_path);
+
+    bool empty() const;
+    std::span<const log_seek_index_entry> entries() const;
+    // the last entry with a key <= key, nullptr if there is none
+    const log_seek_index_entry *find(uint64_t key) const;
+
+private:
+    std::vector<log_seek_index_entry> m_entries;
+};
+
 class XNUTRACE_EXPORT CompressedFileRawRead : public jev::xnutrace::detail::CompressedFile {
 public:
-    CompressedFileRawRead(const std::filesystem::path &path)
-        : jev::xnutrace::detail::CompressedFile::CompressedFile{path, true, UINT64_MAX,
-                                                                UINT64_MAX} {};
+    CompressedFileRawRead(const std::filesystem::path &path, const CompressionDict *dict = nullptr)
+        : jev::xnutrace::detail::CompressedFile::CompressedFile{
+              path, true, UINT64_MAX, UINT64_MAX, nullptr, 3, false, dict} {};
 };
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "common.h"
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+// Trained zstd dictionary for thread files. Records repeat across threads and runs but every
+// frame starts from an empty context, priming both sides with a dictionary trained on earlier
+// bundles wins back most of the ratio small files and frames lose. A bundle written with one
+// keeps a copy in its sidecar_name file, a plain zstd dictionary usable with `zstd -D`.
+class XNUTRACE_EXPORT CompressionDict {
+public:
+    static constexpr size_t default_dict_sz   = 112 * 1024; // zstd CLI default
+    static constexpr size_t default_sample_sz = 16 * 1024;
+    static constexpr const char *sidecar_name = "dict.zstd";
+
+    CompressionDict(std::vector<uint8_t> &&dict);
+    ~CompressionDict();
+    CompressionDict(const CompressionDict &)            = delete;
+    CompressionDict &operator=(const CompressionDict &) = delete;
+
+    static std::unique_ptr<CompressionDict>
+    train(const std::vector<std::span<const uint8_t>> &samples, size_t dict_sz = default_dict_sz);
+    // samples the thread files of the bundles in evenly spaced sample_sz pieces, about 100x the
+    // dictionary size in total as zstd recommends
+    static std::unique_ptr<CompressionDict>
+    train_from_bundles(const std::vector<std::filesystem::path> &bundle_dirs,
+                       size_t dict_sz = default_dict_sz, size_t sample_sz = default_sample_sz);
+    static std::unique_ptr<CompressionDict> read(const std::filesystem::path &path);
+    // nullptr when the bundle was written without a dictionary
+    static std::unique_ptr<CompressionDict> read_sidecar(const std::filesystem::path &bundle_dir);
+    void write(const std::filesystem::path &path) const;
+
+    uint32_t id() const;
+    std::span<const uint8_t> data() const;
+    // digested once per level and shared by all compression workers
+    const ZSTD_CDict_s *cdict(int level) const;
+    const ZSTD_DDict_s *ddict() const;
+
+private:
+    const std::vector<uint8_t> m_dict;
+    uint32_t m_id{};
+    ZSTD_DDict_s *m_ddict{};
+    mutable std::mutex m_cdicts_mutex;
+    mutable std::map<int, ZSTD_CDict_s *> m_cdicts;
+};
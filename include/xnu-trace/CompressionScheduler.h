@@ -0,0 +1,51 @@
+#pragma once
+
+#include "common.h"
+
+#undef NDEBUG
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+#include <BS_thread_pool.hpp>
+
+class CompressionDict;
+
+struct compressed_frame {
+    std::vector<uint8_t> decompressed;
+    std::vector<uint8_t> compressed;
+};
+
+// Process-wide pool that compresses the zstd frames of every writing CompressedFile. Files hand
+// complete frames to the scheduler instead of running their own zstd workers so the number of
+// compression threads stays capped no matter how many threads are being traced. Frames are
+// independent so any worker can compress any file's frame; each file writes them back in order.
+class XNUTRACE_EXPORT CompressionScheduler {
+public:
+    static constexpr size_t default_frame_sz             = 1024 * 1024;
+    static constexpr size_t default_max_frames_in_flight = 4;
+
+    CompressionScheduler();
+
+    // 0 resets to the number of cores, waits for queued frames first
+    void set_num_workers(unsigned int num_workers);
+    unsigned int num_workers() const;
+    // only affect files opened afterwards
+    void set_frame_size(size_t frame_sz);
+    size_t frame_size() const;
+    void set_max_frames_in_flight(size_t max_frames);
+    size_t max_frames_in_flight() const;
+
+    // dict, if any, has to outlive the returned future
+    std::future<compressed_frame> submit(std::vector<uint8_t> &&buf, int level,
+                                         const CompressionDict *dict = nullptr);
+
+private:
+    BS::thread_pool m_pool;
+    std::atomic<size_t> m_frame_sz{default_frame_sz};
+    std::atomic<size_t> m_max_frames_in_flight{default_max_frames_in_flight};
+};
+
+extern CompressionScheduler xnutrace_compression_scheduler;
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+
+enum class file_io_backend : uint8_t {
+    stdio,    // blocking stdio calls on the calling thread
+    threaded, // positional reads/writes on a shared I/O pool, several blocks in flight per file
+};
+
+// Byte stream under a CompressedFile. Writes are appended in submission order but may only reach
+// the file after the call returns, reads hand the file out in blocks that may have been read
+// ahead. With the threaded backend a file being decompressed already has its next blocks on the
+// way and a file being written doesn't wait on the disk, so loading or writing many files at
+// once overlaps their I/O with the zstd work.
+//
+// There is no io_uring on Darwin; positional I/O on a small pool gets the same overlap and keeps
+// the interface open for a kernel queue based backend.
+class XNUTRACE_EXPORT FileIO {
+public:
+    static constexpr size_t block_sz                     = 1024 * 1024;
+    static constexpr size_t default_max_blocks_in_flight = 4;
+
+    // opens with the process-wide default backend
+    static std::unique_ptr<FileIO> open(const std::filesystem::path &path, bool read);
+    static std::unique_ptr<FileIO> open(const std::filesystem::path &path, bool read,
+                                        file_io_backend backend);
+    // only affect files opened afterwards
+    static void set_default_backend(file_io_backend backend);
+    static file_io_backend default_backend();
+    static void set_max_blocks_in_flight(size_t max_blocks);
+    static size_t max_blocks_in_flight();
+
+    virtual ~FileIO() = default;
+
+    // appends buf to the file
+    virtual void write(std::vector<uint8_t> &&buf) = 0;
+    // overwrites bytes that were already written, after every queued write has completed
+    virtual void pwrite(std::span<const uint8_t> buf, uint64_t off) = 0;
+    // waits for every queued write
+    virtual void flush() = 0;
+    // next block of the file, valid until the next call, empty at the end of the file
+    virtual std::span<const uint8_t> next_block() = 0;
+    // the next block starts at off, blocks read ahead are dropped
+    virtual void seek(uint64_t off) = 0;
+    // reads exactly buf.size() bytes at off, independent of next_block()
+    virtual void pread(std::span<uint8_t> buf, uint64_t off) = 0;
+    // file size, including queued writes
+    virtual uint64_t size() const = 0;
+};
+
+// Read-only mapping of size bytes at off in path, advised for one sequential pass. Used instead
+// of reading uncompressed files, a trace in the page cache is then usable without any copy.
+class XNUTRACE_EXPORT MappedFile {
+public:
+    MappedFile(const std::filesystem::path &path, uint64_t off, uint64_t size);
+    ~MappedFile();
+    MappedFile(const MappedFile &)            = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    std::span<const uint8_t> data() const;
+
+private:
+    void *m_map{};
+    size_t m_map_sz{};
+    std::span<const uint8_t> m_data;
+};
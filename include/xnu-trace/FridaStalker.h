@@ -15,12 +15,10 @@ typedef _GumStalker GumStalker;
 struct _GumStalkerTransformer;
 typedef _GumStalkerTransformer GumStalkerTransformer;
 
-struct cs_insn;
-
 class XNUTRACE_EXPORT FridaStalker {
 public:
     FridaStalker(const std::string &log_dir_path, bool symbolicate, int compression_level,
-                 bool stream);
+                 bool stream, const trace_log_opts &log_opts = {});
     ~FridaStalker();
     void follow();
     void follow(size_t thread_id);
@@ -31,12 +29,19 @@ public:
 private:
     struct CBCtx {
         TraceLog *logger;
-        cs_insn *insn;
+        bool mem_accesses;
+    };
+    // per load/store callout data, owned by the stalker
+    struct MemCBCtx {
+        TraceLog *logger;
+        arm64_mem_insn mem_insn;
     };
 
     void write_trace();
     static void transform_cb(void *iterator, void *output, void *user_data);
     static void instruction_cb(void *context, void *user_data);
+    static void mem_instruction_cb(void *context, void *user_data);
+    static void destroy_mem_cb_ctx(void *user_data);
 
     GumStalker *m_stalker;
     GumStalkerTransformer *m_transformer;
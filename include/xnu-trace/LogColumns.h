@@ -0,0 +1,75 @@
+#pragma once
+
+#include "common.h"
+
+#include "CompressedFile.h"
+#include "log_structs.h"
+
+#include <array>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+
+class CompressionDict;
+
+// Columnar thread files split every v1 record in place: the thread file keeps the 8 byte record
+// headers and the whole sync frames, the payloads go to one file per column next to it. The
+// headers alone say how many bytes each record takes from every column, so the columns stay in
+// lockstep without any framing of their own and each compresses as a stream of like values. A
+// reader that only needs PCs decompresses the thread file and the pc column.
+//
+// pc:  branch targets, absolute or varint deltas as in the v1 record
+// sp:  new SPs, same encoding
+// gpr: changed GPR values
+// vec: changed vector registers followed by the memory access section, if any
+enum class log_column : uint8_t { pc, sp, gpr, vec };
+
+constexpr size_t log_column_num = (size_t)log_column::vec + 1;
+
+using log_column_bufs_t  = std::array<std::vector<uint8_t>, log_column_num>;
+using log_column_spans_t = std::array<std::span<const uint8_t>, log_column_num>;
+
+// thread-<N>.bin -> thread-<N>.<column>.bin
+XNUTRACE_EXPORT std::filesystem::path log_column_path(const std::filesystem::path &thread_path,
+                                                      log_column column);
+XNUTRACE_EXPORT bool is_log_column_path(const std::filesystem::path &path);
+
+// Appends the whole v1 records in v1 to the header column hdrs and the payload columns.
+XNUTRACE_EXPORT void split_log_msgs(std::span<const uint8_t> v1, std::vector<uint8_t> &hdrs,
+                                    log_column_bufs_t &columns);
+// Inverse of split_log_msgs, appends the reassembled v1 records to out. The columns may extend
+// past what the headers use, returns the bytes taken from each.
+XNUTRACE_EXPORT std::array<size_t, log_column_num>
+join_log_msgs(std::span<const uint8_t> hdrs, const log_column_spans_t &columns,
+              std::vector<uint8_t> &out);
+// Like join_log_msgs but from the header and pc columns only: records are reduced to their PC
+// (and basic block run length), the register state they carry is left out. Returns the bytes
+// taken from pcs.
+XNUTRACE_EXPORT size_t join_pc_log_msgs(std::span<const uint8_t> hdrs,
+                                        std::span<const uint8_t> pcs, std::vector<uint8_t> &out);
+
+// Payload column files of one columnar thread file. The header column goes to the thread file
+// itself, which stays with its owner so it can still patch num_inst into the header. Column files
+// carry a copy of the thread header as it was when they were opened.
+class XNUTRACE_EXPORT LogColumnWriter {
+public:
+    // records are staged and split this many bytes at a time instead of on every write
+    static constexpr size_t stage_sz = 256 * 1024;
+
+    LogColumnWriter(const std::filesystem::path &thread_path, const log_thread_hdr &hdr,
+                    int level = 3, const CompressionDict *dict = nullptr);
+    ~LogColumnWriter();
+    // The first write of a file has to start with a sync frame and the staged records have to be
+    // whole at every flush(). thread_file must be the same on every call and outlive the writer.
+    void write(jev::xnutrace::detail::CompressedFile &thread_file, std::span<const uint8_t> v1);
+    // splits the staged records into the thread and column files
+    void flush();
+
+private:
+    std::array<std::unique_ptr<CompressedFile<log_thread_hdr>>, log_column_num> m_files;
+    jev::xnutrace::detail::CompressedFile *m_thread_file{};
+    std::vector<uint8_t> m_staged;
+    std::vector<uint8_t> m_hdrs;
+    log_column_bufs_t m_bufs;
+};
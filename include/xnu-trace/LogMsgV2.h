@@ -0,0 +1,107 @@
+#pragma once
+
+#include "common.h"
+
+#include "CompressedFile.h"
+#include "LogColumns.h"
+#include "log_structs.h"
+
+#include <array>
+#include <span>
+#include <vector>
+
+// v2 records start with a single prefix byte that describes the common shapes, the payload
+// follows in this order: PC, SP, then either the changed GPRs (index byte + value each) or the
+// basic block run length. Relative PCs are in instructions, relative SPs in bytes, both from the
+// values after the previous record.
+//
+// 7   5 4 3 2   0
+// ┌─┬─┬─┬─┬─┬─┬─┬─┐
+// │  n  │sp │ pc  │
+// └─┴─┴─┴─┴─┴─┴─┴─┘
+//
+// pc: 0 sequential, 1 rel8, 2 rel16, 3 rel32, 4 abs64
+// sp: 0 unchanged, 1 rel8, 2 rel32, 3 abs64
+// n:  0-5 changed GPRs, 6 basic block run (u32 length, sp must be 0)
+//
+// Anything else (vector changes, memory accesses, sync frames) escapes: 0xFF followed by the v1
+// record.
+struct log_msg_v2 {
+    static constexpr uint8_t escape = 0xFF;
+
+    enum pc_kind : uint8_t { pc_seq, pc_rel8, pc_rel16, pc_rel32, pc_abs64, pc_num_kinds };
+    enum sp_kind : uint8_t { sp_same, sp_rel8, sp_rel32, sp_abs64 };
+    static constexpr uint8_t n_bb_run = 6;
+
+    static constexpr uint8_t prefix(uint8_t pc, uint8_t sp, uint8_t n) {
+        return pc | (sp << 3) | (n << 5);
+    }
+    static constexpr uint8_t prefix_pc(uint8_t prefix) {
+        return prefix & 0b111;
+    }
+    static constexpr uint8_t prefix_sp(uint8_t prefix) {
+        return (prefix >> 3) & 0b11;
+    }
+    static constexpr uint8_t prefix_n(uint8_t prefix) {
+        return prefix >> 5;
+    }
+
+    static constexpr uint8_t pc_sz[8] = {0, 1, 2, 4, 8, 0, 0, 0};
+    static constexpr uint8_t sp_sz[4] = {0, 1, 4, 8};
+
+    static constexpr uint8_t size_max = 1 + 8 + 8 + rpc_num_changed_max * (1 + sizeof(uint64_t));
+};
+
+// v2 record size by prefix byte, 0 for the escape and invalid prefixes
+constexpr std::array<uint8_t, 256> log_msg_v2_sizes = [] {
+    std::array<uint8_t, 256> res{};
+    for (unsigned p = 0; p < res.size(); ++p) {
+        const auto pc = log_msg_v2::prefix_pc(p);
+        const auto sp = log_msg_v2::prefix_sp(p);
+        const auto n  = log_msg_v2::prefix_n(p);
+        if (pc >= log_msg_v2::pc_num_kinds || n > log_msg_v2::n_bb_run ||
+            (n == log_msg_v2::n_bb_run && sp != log_msg_v2::sp_same)) {
+            continue;
+        }
+        res[p] = 1 + log_msg_v2::pc_sz[pc] + log_msg_v2::sp_sz[sp] +
+                 (n == log_msg_v2::n_bb_run ? sizeof(uint32_t) : n * (1 + sizeof(uint64_t)));
+    }
+    return res;
+}();
+
+static_assert(log_msg_v2_sizes[log_msg_v2::escape] == 0,
+              "log_msg_v2::escape must not be a valid prefix");
+
+// Re-encodes v1 records as v2. Relative values are taken from the previous record so a stream
+// has to be fed in order and start with a sync frame, calls may split it at any record boundary.
+class XNUTRACE_EXPORT LogMsgV2Encoder {
+public:
+    // appends the encoding of the whole v1 records in v1 to out
+    void encode(std::span<const uint8_t> v1, std::vector<uint8_t> &out);
+
+private:
+    uint64_t m_pc{};
+    uint64_t m_sp{};
+};
+
+// Expands v2 records back into v1 records with absolute PC/SP values, escaped records are copied
+// verbatim.
+class XNUTRACE_EXPORT LogMsgV2Decoder {
+public:
+    void decode(std::span<const uint8_t> v2, std::vector<uint8_t> &out);
+    // bytes decode() appends for v2, found from the prefixes alone
+    static size_t decoded_size(std::span<const uint8_t> v2);
+
+private:
+    uint64_t m_pc{};
+    uint64_t m_sp{};
+};
+
+// Writes v1 chunks, starting with a sync frame, in the requested record format. Columnar files
+// need the writer of their payload columns. syncs are the sync frames in chunks at their offsets
+// from the start of the first one, they become seek points of file at their offsets in format.
+// Columnar files have none.
+XNUTRACE_EXPORT void write_log_msg_chunks(jev::xnutrace::detail::CompressedFile &file,
+                                          const std::vector<std::span<const uint8_t>> &chunks,
+                                          record_format format, LogColumnWriter *columns = nullptr,
+                                          std::span<const seek_point> syncs = {});
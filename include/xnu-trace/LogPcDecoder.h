@@ -0,0 +1,19 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdint>
+#include <vector>
+
+class log_thread_buf;
+
+// Block decoder for the PCs of an in-memory thread log. Up to pc_decode_block_sz records are
+// sized at a time from a table indexed by the flag bits of their headers, without the branches
+// of log_msg::size(), and their instruction counts are prefix summed with NEON. Every PC of the
+// block is then base + 4 * index where the base only changes at branched records, so the runs
+// between branches are filled with vector stores. Records with delta encoded PCs or memory
+// accesses and sync frames end a block and take the log_msg path.
+constexpr size_t pc_decode_block_sz = 64; // records
+
+// Appends the PCs log.pcs_begin() to log.pcs_end() yields, in the same order.
+XNUTRACE_EXPORT void decode_log_pcs(const log_thread_buf &log, std::vector<uint64_t> &pcs);
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "common.h"
+
+#include "CompressedFile.h"
+#include "CompressionDict.h"
+#include "LogColumns.h"
+#include "LogMsgV2.h"
+#include "TraceLog.h"
+#include "log_structs.h"
+
+#include <array>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+// Reads a thread file of any record format a window at a time instead of decompressing it whole
+// the way TraceLog's reader does, so a thread log can be far larger than memory. The iterators
+// are log_thread_buf's: every window holds whole v1 records, records cut off at the end of a
+// window are carried over to the next one and sync frames are only ever skipped by the
+// iterators, never at a window boundary, so they see the same records as over the whole file.
+//
+// Iteration is single pass. Every begin() rewinds the files and invalidates the iterators of
+// the previous pass. At most two windows are in memory at once.
+class XNUTRACE_EXPORT LogThreadStream final : private log_thread_buf::window_source {
+public:
+    using iterator     = log_thread_buf::iterator;
+    using ctx_iterator = log_thread_buf::ctx_iterator;
+    using pc_iterator  = log_thread_buf::pc_iterator;
+
+    // decompressed bytes read from the thread file per window, records may make v2 and columnar
+    // windows several times larger once expanded
+    static constexpr size_t default_window_sz = 16 * 1024 * 1024;
+
+    // pcs_only: as for TraceLog's reader, columnar files are read from their header and pc
+    // columns alone. Only the header is read until the first begin().
+    LogThreadStream(const std::filesystem::path &thread_path, bool pcs_only = false,
+                    std::shared_ptr<const CompressionDict> dict = nullptr,
+                    size_t window_sz = default_window_sz);
+    LogThreadStream(const LogThreadStream &)            = delete;
+    LogThreadStream &operator=(const LogThreadStream &) = delete;
+
+    const log_thread_hdr &header() const;
+    uint32_t thread_id() const;
+    uint64_t num_inst() const;
+    // v1 bytes handed out by the current pass so far, the whole log once it is done
+    uint64_t num_bytes() const;
+
+    iterator begin();
+    iterator end() const;
+    ctx_iterator ctx_begin();
+    ctx_iterator ctx_end() const;
+    pc_iterator pcs_begin();
+    pc_iterator pcs_end() const;
+
+    // Start a pass at the last sync frame at or before instruction inst, found in the thread
+    // file's seek index so only the compressed frame it is in is decompressed before it. As with
+    // begin() the first element is that sync frame, its sync_num_inst() says where the pass
+    // starts. Files without an index, columnar ones and instructions before the first sync
+    // frame start at the beginning.
+    iterator seek(uint64_t inst);
+    ctx_iterator ctx_seek(uint64_t inst);
+    pc_iterator pcs_seek(uint64_t inst);
+
+private:
+    using file_t = CompressedFile<log_thread_hdr>;
+
+    log_thread_buf::chunk_t next_window() override;
+    void rewind();
+    // rewinds, then moves the files to entry if there is one
+    iterator start_pass(const log_seek_index_entry *entry);
+    ctx_iterator ctx_from(iterator it) const;
+    pc_iterator pcs_from(iterator it) const;
+    // appends up to size of the left bytes still in file to buf
+    static void fill(file_t &file, uint64_t &left, std::vector<uint8_t> &buf, size_t size);
+    // whole records at the front of m_in decoded to v1 in out, returns the input bytes used
+    size_t decode_v2(std::vector<uint8_t> &out);
+    size_t join_columns(std::vector<uint8_t> &out);
+
+    const std::filesystem::path m_path;
+    const std::shared_ptr<const CompressionDict> m_dict;
+    const size_t m_window_sz;
+    const bool m_pcs_only;
+    log_thread_hdr m_hdr;
+    SeekIndex m_index;
+    std::unique_ptr<file_t> m_file;
+    std::array<std::unique_ptr<file_t>, log_column_num> m_column_files;
+    uint64_t m_left{};
+    std::array<uint64_t, log_column_num> m_column_left{};
+    // thread file bytes read but not handed out yet, for v1 and v2 at most one partial record
+    std::vector<uint8_t> m_in;
+    log_column_bufs_t m_column_in;
+    LogMsgV2Decoder m_v2_decoder;
+    // the current and the previous window, an iterator that skipped a sync frame at the end of
+    // the previous one still points at it
+    std::array<std::vector<uint8_t>, 2> m_windows;
+    size_t m_cur_window{};
+    log_thread_buf::chunk_t m_window;
+    uint64_t m_num_bytes{};
+};
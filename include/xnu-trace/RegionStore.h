@@ -0,0 +1,63 @@
+#pragma once
+
+#include "common.h"
+
+#include "utils.h"
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Content-addressed macho-region files shared by many bundles. Every object is a plain
+// macho-region file named after the SHA-256 of the region bytes, so tracing the same binaries
+// over and over compresses and stores each distinct __TEXT once. A bundle using the store names
+// it in its meta.bin and keeps only its JIT regions to itself.
+//
+// <store>/objects/<2 hex>/<64 hex>.bin  region objects
+// <store>/refs/<64 hex>                 one per bundle, keyed by the hash of its canonical path:
+//                                       the bundle path, then the digests it uses, one per line
+//
+// Objects and refs are created with a rename so several tracers can share a store. gc() only
+// drops refs of bundles that are gone or no longer point at the store, and then the objects no
+// ref mentions. It holds <store>/lock exclusively while set_ref() takes it shared, so an object
+// found by contains() after set_ref() stays until the ref goes.
+class XNUTRACE_EXPORT RegionStore {
+public:
+    // refs younger than this are kept even if their bundle doesn't name the store yet, that
+    // bundle is most likely still being written
+    static constexpr std::chrono::seconds default_gc_grace{10 * 60};
+
+    struct gc_stats {
+        size_t num_refs_dropped{};
+        size_t num_objects_removed{};
+        uint64_t bytes_freed{};
+    };
+
+    // nothing is created on disk until the first put() or set_ref()
+    RegionStore(const std::filesystem::path &store_dir);
+
+    // canonical store directory, as recorded in meta.bin
+    const std::filesystem::path &path() const;
+    std::filesystem::path object_path(const sha256_t &digest) const;
+    bool contains(const sha256_t &digest) const;
+    // writes the object for bytes unless it is already there
+    void put(const sha256_t &digest, std::span<const uint8_t> bytes, int level = 1) const;
+    // replaces the digests bundle_dir references, call it before checking which of them the
+    // store already contains
+    void set_ref(const std::filesystem::path &bundle_dir,
+                 std::span<const sha256_t> digests) const;
+    gc_stats gc(std::chrono::seconds grace = default_gc_grace) const;
+
+    // store named in the bundle's meta.bin, nullopt if the bundle keeps its regions to itself
+    // or has no meta.bin (yet)
+    static std::optional<std::filesystem::path>
+    bundle_store(const std::filesystem::path &bundle_dir);
+
+private:
+    std::filesystem::path ref_path(const std::filesystem::path &bundle_dir) const;
+
+    std::filesystem::path m_path;
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "common.h"
+
+#include "utils.h"
+
+#undef NDEBUG
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <utility>
+
+// Lock-free single-producer single-consumer byte ring. The producer pushes whole records (all or
+// nothing), the consumer peeks at the readable bytes as at most two spans (the second one is
+// non-empty when the readable region wraps) and releases them once they have been consumed.
+class SPSCRing {
+public:
+    SPSCRing(size_t capacity)
+        : m_buf{std::make_unique<uint8_t[]>(capacity)}, m_capacity{capacity},
+          m_mask{capacity - 1} {
+        assert(is_pow2(capacity));
+    }
+
+    size_t capacity() const {
+        return m_capacity;
+    }
+
+    XNUTRACE_INLINE bool try_push(const void *buf, size_t size) {
+        assert(XNUTRACE_LIKELY(size <= m_capacity));
+        const auto head = m_head.load(std::memory_order_relaxed);
+        if (XNUTRACE_UNLIKELY(m_capacity - (head - m_tail_cache) < size)) {
+            m_tail_cache = m_tail.load(std::memory_order_acquire);
+            if (m_capacity - (head - m_tail_cache) < size) {
+                return false;
+            }
+        }
+        const auto off   = head & m_mask;
+        const auto first = std::min(size, m_capacity - off);
+        memcpy(&m_buf[off], buf, first);
+        if (XNUTRACE_UNLIKELY(first != size)) {
+            memcpy(&m_buf[0], (const uint8_t *)buf + first, size - first);
+        }
+        m_head.store(head + size, std::memory_order_release);
+        return true;
+    }
+
+    // Spins, then sleeps on the consumer's tail until there is room.
+    void push(const void *buf, size_t size) {
+        for (int i = 0; !try_push(buf, size); ++i) {
+            if (i < 64) {
+                continue;
+            }
+            const auto tail = m_tail.load(std::memory_order_acquire);
+            m_producer_waiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const bool pushed = try_push(buf, size);
+            if (!pushed) {
+                m_tail.wait(tail, std::memory_order_acquire);
+            }
+            m_producer_waiting.store(false, std::memory_order_relaxed);
+            if (pushed) {
+                return;
+            }
+            i = 0;
+        }
+    }
+
+    std::pair<std::span<const uint8_t>, std::span<const uint8_t>> peek() const {
+        const auto tail  = m_tail.load(std::memory_order_relaxed);
+        const auto head  = m_head.load(std::memory_order_acquire);
+        const auto size  = head - tail;
+        const auto off   = tail & m_mask;
+        const auto first = std::min(size, m_capacity - off);
+        return {{&m_buf[off], first}, {&m_buf[0], size - first}};
+    }
+
+    void release(size_t size) {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + size, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_producer_waiting.load(std::memory_order_relaxed)) {
+            m_tail.notify_one();
+        }
+    }
+
+    bool empty() const {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+private:
+    const std::unique_ptr<uint8_t[]> m_buf;
+    const size_t m_capacity;
+    const size_t m_mask;
+    XNUTRACE_ALIGNED(128) std::atomic<size_t> m_head{};
+    size_t m_tail_cache{};
+    XNUTRACE_ALIGNED(128) std::atomic<size_t> m_tail{};
+    std::atomic<bool> m_producer_waiting{};
+};
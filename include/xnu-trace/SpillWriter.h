@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common.h"
+
+#include "ChunkedArena.h"
+#include "CompressedFile.h"
+#include "LogColumns.h"
+#include "log_structs.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct pc_range;
+
+// Background thread that moves sealed in-memory trace segments to their thread files when a
+// bundle goes over its memory budget. Segments must start with a sync frame so the file stays a
+// plain concatenation of records; the PC ranges of every spilled segment are collected on the way
+// out since the records are no longer around when the bundle is finalized.
+class XNUTRACE_EXPORT SpillWriter {
+public:
+    // mem_bytes is decremented by the size of each segment once it is on disk, segments are
+    // written in format
+    SpillWriter(std::atomic<size_t> &mem_bytes, record_format format);
+    ~SpillWriter();
+    // file, columns and ranges must outlive the writer or the next stop(), segments of one file
+    // are written in submission order, columns is only needed for columnar files. sync_points
+    // are the segment's sync frames, see write_log_msg_chunks().
+    void submit(jev::xnutrace::detail::CompressedFile *file, LogColumnWriter *columns,
+                std::vector<pc_range> *ranges, ChunkedArena &&segment,
+                std::vector<seek_point> &&sync_points = {});
+    // Writes every submitted segment and joins the spill thread.
+    void stop();
+
+private:
+    struct job {
+        jev::xnutrace::detail::CompressedFile *file;
+        LogColumnWriter *columns;
+        std::vector<pc_range> *ranges;
+        ChunkedArena segment;
+        std::vector<seek_point> sync_points;
+    };
+
+    void run();
+
+    std::atomic<size_t> &m_mem_bytes;
+    const record_format m_format;
+    std::mutex m_jobs_lock;
+    std::condition_variable m_jobs_cv;
+    std::deque<job> m_jobs;
+    bool m_stop{};
+    std::thread m_thread;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "common.h"
+
+#include "log_structs.h"
+
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+class log_thread_buf;
+
+// <name>.<ext> -> <name>.gprs.<ext>
+XNUTRACE_EXPORT std::filesystem::path gpr_checkpoints_path(const std::filesystem::path &path);
+XNUTRACE_EXPORT bool is_gpr_checkpoints_path(const std::filesystem::path &path);
+
+// Random access to the contexts of an in-memory thread log. The sync frames are found once, a
+// context is then replayed from the closest one before it, so the replay distance is bounded by
+// the trace's sync_policy. GPR checkpoints are denser and lighter: PC, SP, NZCV and the GPRs
+// every interval instructions, they bound the replay of gpr_context_at() to interval records.
+// The log must outlive the index.
+class XNUTRACE_EXPORT ThreadContextIndex {
+public:
+    static constexpr uint64_t default_gpr_interval = 4096;
+
+    explicit ThreadContextIndex(const log_thread_buf &thread_buf);
+
+    // The context the thread logged for instruction inst_idx, i.e. the state after it executed.
+    // nullopt past the end of the log and for instructions that were dropped.
+    std::optional<log_arm64_cpu_context> context_at(uint64_t inst_idx) const;
+    // same without the vector registers, they are zeroed. Starts from GPR checkpoints as well.
+    std::optional<log_arm64_cpu_context> gpr_context_at(uint64_t inst_idx) const;
+
+    // one replay of the whole log, replaces the current checkpoints
+    void build_gpr_checkpoints(uint64_t interval = default_gpr_interval);
+    bool has_gpr_checkpoints() const;
+    void write_gpr_checkpoints(const std::filesystem::path &path) const;
+    // false and nothing loaded if the file is missing or was built from a different log
+    bool read_gpr_checkpoints(const std::filesystem::path &path);
+
+private:
+    // replay starts at the record of instruction next_inst with ctx as the state before it
+    struct start_point {
+        uint64_t next_inst;
+        uint64_t log_off; // v1 bytes from the start of the log
+    };
+    struct sync_point : start_point {
+        const log_arm64_cpu_context *ctx; // unaligned
+    };
+
+    std::optional<log_arm64_cpu_context> replay(const start_point &start,
+                                                log_arm64_cpu_context ctx,
+                                                uint64_t inst_idx) const;
+    // the record at log_off and the one after msg, nullptr at the end of the log. chunk is
+    // that of the record.
+    const log_msg *record_at(uint64_t log_off, size_t &chunk) const;
+    const log_msg *next_record(const log_msg *msg, size_t &chunk) const;
+
+    const log_thread_buf &m_log;
+    // start of every chunk in v1 bytes from the start of the log
+    std::vector<uint64_t> m_chunk_offs;
+    std::vector<sync_point> m_syncs;
+    uint64_t m_gpr_interval{};
+    std::vector<log_gpr_checkpoint> m_gpr_checkpoints;
+};
@@ -4,6 +4,8 @@
 
 #include "Atomic.h"
 
+#include <algorithm>
+#include <atomic>
 #include <type_traits>
 
 #include <BS_thread_pool.hpp>
@@ -21,6 +23,19 @@ public:
         waiter.wait();
     }
 
+    // like wait_on_n_tasks but at most max_concurrent blocks run at once (0 = thread count), each
+    // task takes the next index when it finishes one so uneven blocks still balance out
+    void wait_on_n_tasks_limited(size_t n, size_t max_concurrent, const auto &block) {
+        const auto num_tasks =
+            std::min(n, max_concurrent ? max_concurrent : (size_t)get_thread_count());
+        std::atomic<size_t> next_idx{0};
+        wait_on_n_tasks(num_tasks, [&](auto) {
+            for (size_t i = next_idx++; i < n; i = next_idx++) {
+                block(i);
+            }
+        });
+    }
+
     template <typename F, typename Idx1, typename Idx2,
               typename Idx = std::common_type_t<Idx1, Idx2>>
     std::enable_if_t<std::is_invocable_v<F, size_t, Idx, Idx>>
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "common.h"
+
+#undef NDEBUG
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Maps thread ids to per-thread values with stable addresses. Lookups are lock-free and each
+// calling thread caches its last hit in a thread_local so the steady state does no hashing at
+// all. Inserts take a mutex and are amortized O(1): the open-addressed table doubles once it is
+// half full and superseded tables are retired instead of freed so concurrent readers never
+// touch freed memory.
+template <typename T> class ThreadRegistry {
+public:
+    using key_type                           = uint32_t;
+    static constexpr key_type empty_key      = 0;
+    static constexpr size_t initial_capacity = 64;
+
+    ThreadRegistry() : m_id{s_next_id.fetch_add(1, std::memory_order_relaxed)} {
+        grow(initial_capacity);
+    }
+    ThreadRegistry(const ThreadRegistry &)            = delete;
+    ThreadRegistry &operator=(const ThreadRegistry &) = delete;
+
+    XNUTRACE_INLINE T *find(key_type key) const {
+        thread_local tls_cache cache;
+        if (XNUTRACE_LIKELY(cache.registry_id == m_id && cache.key == key)) {
+            return cache.val;
+        }
+        const auto val = lookup(key);
+        if (XNUTRACE_LIKELY(val != nullptr)) {
+            cache = {.registry_id = m_id, .key = key, .val = val};
+        }
+        return val;
+    }
+
+    // make is only called, under the lock, when key isn't registered yet and returns a
+    // std::unique_ptr<T>
+    template <typename F> XNUTRACE_INLINE T &get_or_create(key_type key, F &&make) {
+        if (const auto val = find(key); XNUTRACE_LIKELY(val != nullptr)) {
+            return *val;
+        }
+        return insert(key, std::forward<F>(make));
+    }
+
+    size_t size() const {
+        std::lock_guard lock{m_mutex};
+        return m_entries.size();
+    }
+
+    // visits values in insertion order
+    template <typename F> void for_each(F &&f) {
+        std::lock_guard lock{m_mutex};
+        for (auto &[key, val] : m_entries) {
+            f(key, *val);
+        }
+    }
+    template <typename F> void for_each(F &&f) const {
+        std::lock_guard lock{m_mutex};
+        for (const auto &[key, val] : m_entries) {
+            f(key, std::as_const(*val));
+        }
+    }
+
+private:
+    struct slot {
+        std::atomic<key_type> key{empty_key};
+        std::atomic<T *> val{};
+    };
+
+    struct table {
+        table(size_t capacity)
+            : slots{std::make_unique<slot[]>(capacity)}, mask{capacity - 1} {}
+        const std::unique_ptr<slot[]> slots;
+        const size_t mask;
+    };
+
+    struct tls_cache {
+        uint64_t registry_id;
+        key_type key;
+        T *val;
+    };
+
+    static size_t hash(key_type key) {
+        return (key * 0x9E37'79B9'7F4A'7C15ull) >> 32;
+    }
+
+    T *lookup(key_type key) const {
+        const auto tbl = m_table.load(std::memory_order_acquire);
+        // never more than half full so probing always hits an empty slot
+        for (auto i = hash(key) & tbl->mask;; i = (i + 1) & tbl->mask) {
+            const auto k = tbl->slots[i].key.load(std::memory_order_acquire);
+            if (k == key) {
+                return tbl->slots[i].val.load(std::memory_order_relaxed);
+            }
+            if (k == empty_key) {
+                return nullptr;
+            }
+        }
+    }
+
+    static void place(table &tbl, key_type key, T *val) {
+        auto i = hash(key) & tbl.mask;
+        while (tbl.slots[i].key.load(std::memory_order_relaxed) != empty_key) {
+            i = (i + 1) & tbl.mask;
+        }
+        // value first so readers that observe the key also observe the value
+        tbl.slots[i].val.store(val, std::memory_order_relaxed);
+        tbl.slots[i].key.store(key, std::memory_order_release);
+    }
+
+    void grow(size_t capacity) {
+        auto tbl = std::make_unique<table>(capacity);
+        for (const auto &[key, val] : m_entries) {
+            place(*tbl, key, val.get());
+        }
+        m_table.store(tbl.get(), std::memory_order_release);
+        m_tables.emplace_back(std::move(tbl));
+    }
+
+    template <typename F> XNUTRACE_NOINLINE T &insert(key_type key, F &&make) {
+        assert(key != empty_key);
+        std::lock_guard lock{m_mutex};
+        if (const auto val = lookup(key)) {
+            return *val;
+        }
+        std::unique_ptr<T> val = make();
+        assert(val);
+        const auto tbl = m_table.load(std::memory_order_relaxed);
+        if ((m_entries.size() + 1) * 2 > tbl->mask + 1) {
+            grow((tbl->mask + 1) * 2);
+        }
+        place(*m_table.load(std::memory_order_relaxed), key, val.get());
+        return *m_entries.emplace_back(key, std::move(val)).second;
+    }
+
+    static inline std::atomic<uint64_t> s_next_id{1};
+    const uint64_t m_id;
+    std::atomic<table *> m_table{};
+    // every table ever published, readers may still be probing an old one
+    std::vector<std::unique_ptr<table>> m_tables;
+    std::vector<std::pair<key_type, std::unique_ptr<T>>> m_entries;
+    mutable std::mutex m_mutex;
+};
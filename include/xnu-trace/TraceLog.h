@@ -2,24 +2,40 @@
 
 #include "common.h"
 
+#include "ARM64Disassembler.h"
+#include "AsyncTraceWriter.h"
+#include "Atomic.h"
+#include "ChunkedArena.h"
+#include "LogColumns.h"
+#include "LogMsgV2.h"
 #include "CompressedFile.h"
+#include "CompressionDict.h"
 #include "MachORegions.h"
-#include "MinimalPerfectHash.h"
+#include "RegionStore.h"
+#include "SPSCRing.h"
 #include "Signpost.h"
+#include "SpillWriter.h"
 #include "Symbols.h"
+#include "ThreadContextIndex.h"
+#include "ThreadPool.h"
+#include "ThreadRegistry.h"
 #include "log_structs.h"
 #include "mach.h"
 #include "utils.h"
 
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <span>
+#include <type_traits>
 #include <vector>
 
 #include <mach/mach_types.h>
 
 #include <absl/container/flat_hash_map.h>
 
-struct cs_insn;
+class LogThreadStream;
 
 struct bb_t {
     uint64_t pc;
@@ -28,7 +44,19 @@ struct bb_t {
 
 class log_thread_buf {
 public:
+    // records never straddle chunks
+    using chunk_t = std::span<const uint8_t>;
+
+    // Hands iterators the next chunk once they run past their last one, see LogThreadStream.
+    class window_source {
+    public:
+        virtual ~window_source() = default;
+        // empty once the log is exhausted, the previous window stays valid until the next call
+        virtual chunk_t next_window() = 0;
+    };
+
     class ctx_iterator;
+    // with a window_source the iterator is single pass, copies share the source's windows
     class iterator {
     public:
         using iterator_category = std::forward_iterator_tag;
@@ -37,7 +65,10 @@ public:
         using pointer           = const log_msg *;
         using reference         = const log_msg &;
 
-        iterator(pointer ptr, pointer end) : m_ptr(ptr), m_end(end) {}
+        iterator(const chunk_t *chunk, const chunk_t *chunks_end, pointer ptr,
+                 window_source *source = nullptr)
+            : m_ptr(ptr), m_end(chunk ? (pointer)(chunk->data() + chunk->size()) : nullptr),
+              m_chunk(chunk), m_chunks_end(chunks_end), m_source(source) {}
 
         reference operator*() const {
             return *m_ptr;
@@ -46,10 +77,11 @@ public:
             return m_ptr;
         }
         iterator &operator++() {
-            m_ptr = (pointer)((uintptr_t)m_ptr + m_ptr->size());
+            step(m_ptr->size());
             if (XNUTRACE_LIKELY(m_ptr != m_end) && XNUTRACE_UNLIKELY(m_ptr->is_sync_frame())) {
                 // sync frame guaranteed to be followed by non-sync
-                m_ptr = (pointer)((uintptr_t)m_ptr + m_ptr->size());
+                m_skipped_sync = m_ptr;
+                step(m_ptr->size());
             }
             return *this;
         }
@@ -65,48 +97,121 @@ public:
             return a.m_ptr != b.m_ptr;
         };
 
+    protected:
+        bool at_end() const {
+            return m_ptr == m_end;
+        }
+
+        // set when the last increment stepped over a sync frame, consumers that track state
+        // reload it from there since records may have been dropped before it
+        pointer m_skipped_sync{};
+
     private:
+        XNUTRACE_INLINE void step(size_t sz) {
+            m_ptr = (pointer)((uintptr_t)m_ptr + sz);
+            if (XNUTRACE_UNLIKELY(m_ptr == m_end)) {
+                if (m_chunk + 1 != m_chunks_end) {
+                    ++m_chunk;
+                    m_ptr = (pointer)m_chunk->data();
+                    m_end = (pointer)(m_chunk->data() + m_chunk->size());
+                } else if (m_source) {
+                    next_window();
+                }
+            }
+        }
+        // an exhausted source leaves the iterator equal to the stream's end()
+        void next_window() {
+            const auto window = m_source->next_window();
+            if (window.empty()) {
+                m_ptr    = nullptr;
+                m_end    = nullptr;
+                m_source = nullptr;
+                return;
+            }
+            m_ptr = (pointer)window.data();
+            m_end = (pointer)(window.data() + window.size());
+        }
+
         pointer m_ptr{};
         pointer m_end{};
+        const chunk_t *m_chunk{};
+        const chunk_t *m_chunks_end{};
+        window_source *m_source{};
     };
 
     class ctx_iterator : public iterator {
     public:
-        ctx_iterator(pointer ptr, pointer end, const log_arm64_cpu_context *ctx)
-            : iterator(ptr, end) {
+        ctx_iterator(const chunk_t *chunk, const chunk_t *chunks_end, pointer ptr,
+                     const log_arm64_cpu_context *ctx)
+            : iterator(chunk, chunks_end, ptr) {
             if (ctx) {
-                memcpy(&m_ctx, &ctx, sizeof(m_ctx));
+                memcpy(&m_ctx, ctx, sizeof(m_ctx));
             }
         }
         ctx_iterator(iterator it, const log_arm64_cpu_context *ctx) : iterator(it) {
             if (ctx) {
-                memcpy(&m_ctx, &ctx, sizeof(m_ctx));
+                memcpy(&m_ctx, ctx, sizeof(m_ctx));
             }
         }
         iterator &operator++() {
             auto &res = iterator::operator++();
-            m_ctx.update(*res);
+            if (XNUTRACE_UNLIKELY(m_skipped_sync != nullptr)) {
+                m_ctx.update(*m_skipped_sync);
+                m_skipped_sync  = nullptr;
+                m_last_mem_addr = 0;
+            }
+            m_mem.clear();
+            if (XNUTRACE_LIKELY(!at_end())) {
+                m_ctx.update(*res);
+                if (XNUTRACE_UNLIKELY(res->has_mem())) {
+                    m_mem = res->mem_accesses(m_last_mem_addr);
+                }
+            }
             return res;
         }
         const log_arm64_cpu_context &ctx() const {
             return m_ctx;
         }
+        // accesses made by the current instruction, ctx() is the state after it
+        const mem_accesses_t &mem_accesses() const {
+            return m_mem;
+        }
 
     private:
         log_arm64_cpu_context m_ctx;
+        uint64_t m_last_mem_addr{};
+        mem_accesses_t m_mem;
     };
 
     class pc_iterator : public iterator {
     public:
-        pc_iterator(pointer ptr, pointer end, uint64_t pc) : iterator(ptr, end), m_pc{pc} {}
+        pc_iterator(const chunk_t *chunk, const chunk_t *chunks_end, pointer ptr, uint64_t pc)
+            : iterator(chunk, chunks_end, ptr), m_pc{pc} {}
         pc_iterator(iterator it, uint64_t pc) : iterator(it), m_pc{pc} {}
+        // basic block runs are expanded, each instruction in the run is its own step
         iterator &operator++() {
+            if (XNUTRACE_UNLIKELY(m_run_left)) {
+                --m_run_left;
+                m_pc += 4;
+                return *this;
+            }
             auto &res = iterator::operator++();
+            if (XNUTRACE_UNLIKELY(m_skipped_sync != nullptr)) {
+                // may be unaligned, pc is the first member
+                memcpy(&m_pc, m_skipped_sync->sync_ctx(), sizeof(m_pc));
+                m_skipped_sync = nullptr;
+            }
+            if (XNUTRACE_UNLIKELY(at_end())) {
+                return res;
+            }
             if (res->pc_branched()) {
-                m_pc = res->pc();
+                m_pc = res->pc(m_pc);
             } else {
                 m_pc += 4;
             }
+            if (XNUTRACE_UNLIKELY(res->is_bb_run())) {
+                m_run_left = res->bb_run_len() - 1;
+            }
             return res;
         }
         uint64_t pc() const {
@@ -115,107 +220,370 @@ public:
 
     private:
         uint64_t m_pc;
+        uint32_t m_run_left{};
     };
 
     log_thread_buf() = default;
-    log_thread_buf(const std::vector<uint8_t> &&buf, uint64_t num_inst)
-        : m_buf{buf}, m_num_inst{num_inst} {};
+    log_thread_buf(std::vector<uint8_t> &&buf, uint64_t num_inst);
+    log_thread_buf(ChunkedArena &&arena, uint64_t num_inst);
+    // borrows chunks kept alive by owner
+    log_thread_buf(std::vector<chunk_t> chunks, std::shared_ptr<const void> owner,
+                   uint64_t num_inst);
 
     uint64_t num_inst() const {
         return m_num_inst;
     }
     uint64_t num_bytes() const {
-        return m_buf.size();
+        return m_num_bytes;
+    }
+    const std::vector<chunk_t> &chunks() const {
+        return m_chunks;
+    }
+    // a bin from chunk_into_bins() whose iterators step over its first sync frame
+    bool mid_stream() const {
+        return m_mid_stream;
     }
 
     const log_msg &front() const {
-        const auto &res = *(log_msg *)m_buf.data();
+        const auto &res = *(log_msg *)m_chunks.front().data();
         assert(res.is_sync_frame());
         return res;
     }
 
-    log_msg *pointer_begin() const {
-        return (log_msg *)m_buf.data();
-    }
-    log_msg *pointer_end() const {
-        return (log_msg *)(m_buf.data() + m_buf.size());
-    }
-
+    // a bin from chunk_into_bins() starts past its sync frame, see there
     iterator begin() const {
-        return iterator(pointer_begin(), pointer_end());
+        iterator res(chunk_begin(), chunk_end(), pointer_begin());
+        if (m_mid_stream) {
+            ++res;
+        }
+        return res;
     }
     iterator end() const {
-        return iterator(pointer_end(), pointer_end());
+        return iterator(chunk_last(), chunk_end(), pointer_end());
     }
 
+    // an empty log's begin iterators equal its end ones
     ctx_iterator ctx_begin() const {
-        return ctx_iterator(pointer_begin(), pointer_end(), front().sync_ctx());
+        if (m_chunks.empty()) {
+            return ctx_end();
+        }
+        ctx_iterator res(chunk_begin(), chunk_end(), pointer_begin(), front().sync_ctx());
+        if (m_mid_stream) {
+            ++res;
+        }
+        return res;
     }
     ctx_iterator ctx_end() const {
-        return ctx_iterator(pointer_end(), pointer_end(), nullptr);
+        return ctx_iterator(chunk_last(), chunk_end(), pointer_end(), nullptr);
     }
 
     pc_iterator pcs_begin() const {
-        return pc_iterator(pointer_begin(), pointer_end(), front().sync_ctx()->pc);
+        if (m_chunks.empty()) {
+            return pcs_end();
+        }
+        // a bin's sync frame may be unaligned, pc is the first member
+        uint64_t pc;
+        memcpy(&pc, front().sync_ctx(), sizeof(pc));
+        pc_iterator res(chunk_begin(), chunk_end(), pointer_begin(), pc);
+        if (m_mid_stream) {
+            ++res;
+        }
+        return res;
     }
     pc_iterator pcs_end() const {
-        return pc_iterator(pointer_end(), pointer_end(), 0);
+        return pc_iterator(chunk_last(), chunk_end(), pointer_end(), 0);
     }
 
-    std::vector<iterator> chunk_into_bins(uint32_t n) {
-        Signpost chunk_sp("log_thread_buf", "chunk_into_bins");
-        chunk_sp.start();
-        const auto raw_bins =
-            chunk_into_bins_by_needle(n, m_buf.data(), m_buf.size(), log_msg::sync_frame_buf_hdr,
-                                      sizeof(log_msg::sync_frame_buf_hdr));
-        chunk_sp.end();
-        return {};
-    }
+    // smaller bins don't make up for handing them to another core, about 4 default sync intervals
+    static constexpr uint64_t min_bin_bytes = 4 * 1024 * 1024;
+
+    // bins worth decoding in parallel: one per xnutrace_pool thread, at least min_bin_bytes each
+    uint32_t num_decode_bins() const;
+
+    // Splits the log at sync frames into at most n logs of about the same size that decode
+    // independently. All but the first start at a sync frame the whole log's iterators step
+    // over, their iterators only load their state from it, so iterating the bins one after the
+    // other yields the same elements as iterating the whole log. A bin's num_inst() is the
+    // difference of its and the next bin's sync_num_inst(). Searches for the sync frames on
+    // xnutrace_pool when n > 1, don't call it from its tasks.
+    std::vector<log_thread_buf> chunk_into_bins(uint32_t n) const;
 
 private:
-    std::vector<uint8_t> m_buf;
+    const chunk_t *chunk_begin() const {
+        return m_chunks.empty() ? nullptr : m_chunks.data();
+    }
+    const chunk_t *chunk_last() const {
+        return m_chunks.empty() ? nullptr : &m_chunks.back();
+    }
+    const chunk_t *chunk_end() const {
+        return m_chunks.empty() ? nullptr : m_chunks.data() + m_chunks.size();
+    }
+    const log_msg *pointer_begin() const {
+        return m_chunks.empty() ? nullptr : (const log_msg *)m_chunks.front().data();
+    }
+    const log_msg *pointer_end() const {
+        return m_chunks.empty()
+                   ? nullptr
+                   : (const log_msg *)(m_chunks.back().data() + m_chunks.back().size());
+    }
+
+    std::shared_ptr<const void> m_owner;
+    std::vector<chunk_t> m_chunks;
+    uint64_t m_num_bytes{};
     uint64_t m_num_inst{};
+    // starts at a sync frame the whole log skips
+    bool m_mid_stream{};
 };
 
 static_assert(std::is_move_constructible_v<log_thread_buf>,
               "log_thread_buf not move constructable");
 static_assert(std::is_move_assignable_v<log_thread_buf>, "log_thread_buf not move assignable");
 
+// Runs f(bin) for every bin of thread_buf.chunk_into_bins(num_bins) on xnutrace_pool and returns
+// the results in log order, for analyses of PCs or contexts that combine per bin. 0 bins =
+// num_decode_bins(), an empty log has no bins. Not from xnutrace_pool tasks.
+template <typename F>
+auto map_log_bins(const log_thread_buf &thread_buf, const F &f, uint32_t num_bins = 0) {
+    std::vector<std::invoke_result_t<const F &, const log_thread_buf &>> res;
+    // everything may have been spilled to disk already
+    if (!thread_buf.num_bytes()) {
+        return res;
+    }
+    const auto bins =
+        thread_buf.chunk_into_bins(num_bins ? num_bins : thread_buf.num_decode_bins());
+    res.resize(bins.size());
+    if (bins.size() == 1) {
+        res[0] = f(bins[0]);
+        return res;
+    }
+    xnutrace_pool.wait_on_n_tasks(bins.size(), [&](const auto i) {
+        res[i] = f(bins[i]);
+    });
+    return res;
+}
+
+// every executed instruction is in exactly one BB, consecutive PCs 4 bytes apart share one
 XNUTRACE_EXPORT std::vector<bb_t> extract_bbs_from_pc_trace(const std::span<const uint64_t> &pcs);
-XNUTRACE_EXPORT std::vector<bb_t> extract_bbs_from_trace(const log_thread_buf &thread_buf);
-XNUTRACE_EXPORT std::vector<uint64_t> extract_pcs_from_trace(const log_thread_buf &thread_buf);
+// both decode the thread's bins in parallel, see map_log_bins
+XNUTRACE_EXPORT std::vector<bb_t> extract_bbs_from_trace(const log_thread_buf &thread_buf,
+                                                         uint32_t num_bins = 0);
+XNUTRACE_EXPORT std::vector<uint64_t> extract_pcs_from_trace(const log_thread_buf &thread_buf,
+                                                             uint32_t num_bins = 0);
+
+struct pc_range {
+    uint64_t start;
+    uint64_t end; // exclusive
+    bool operator==(const pc_range &) const = default;
+};
+
+// sorted, non-overlapping and non-adjacent ranges covering every executed instruction
+XNUTRACE_EXPORT std::vector<pc_range>
+extract_pc_ranges_from_traces(const std::vector<const log_thread_buf *> &thread_bufs);
+// sorts and coalesces in place
+XNUTRACE_EXPORT void coalesce_pc_ranges(std::vector<pc_range> &ranges);
+
+struct sync_policy {
+    static constexpr uint64_t default_bytes = 1024 * 1024; // 1 MB, overhead 0.09% per MB
+    static constexpr uint64_t default_insts = 64 * 1024;
+    // Automatic mode is a fixed heuristic, not a measurement: it targets interval instructions
+    // per frame, the unit the decoders split a thread at, and bounds the bytes in between since
+    // decoding a bin costs both. Frames never come closer than auto_min_bytes, so they cost at
+    // most 1/64 of the records however small the target, and a frame always follows
+    // auto_max_bytes of records, so full contexts with heavy churn still split into bins of
+    // bounded size.
+    static constexpr uint64_t auto_min_bytes = 64 * log_msg::size_full_ctx;
+    static constexpr uint64_t auto_max_bytes = 4 * 1024 * 1024;
+
+    sync_mode mode{sync_mode::bytes};
+    uint64_t interval{default_bytes};
+
+    static constexpr sync_policy fixed_bytes(uint64_t bytes = default_bytes) {
+        return {.mode = sync_mode::bytes, .interval = bytes};
+    }
+    static constexpr sync_policy fixed_instructions(uint64_t insts = default_insts) {
+        return {.mode = sync_mode::instructions, .interval = insts};
+    }
+    static constexpr sync_policy automatic(uint64_t target_insts = default_insts) {
+        return {.mode = sync_mode::automatic, .interval = target_insts};
+    }
+
+    XNUTRACE_INLINE bool due(uint64_t bytes_since_sync, uint64_t insts_since_sync) const {
+        switch (mode) {
+        case sync_mode::bytes:
+            return bytes_since_sync >= interval;
+        case sync_mode::instructions:
+            return insts_since_sync >= interval;
+        case sync_mode::automatic:
+            return bytes_since_sync >= auto_max_bytes ||
+                   (insts_since_sync >= interval && bytes_since_sync >= auto_min_bytes);
+        }
+        return false;
+    }
+};
+
+struct trace_log_opts {
+    sync_policy sync{};
+    // PC-only recording: one record per basic block (start PC + instruction count)
+    bool bb_runs{};
+    // branch targets and SP changes as zig-zag varint deltas instead of absolute values
+    bool delta_pc_sp{};
+    // full context recording: the address, size and direction of each memory access, needs the
+    // decoded instruction passed to log()
+    bool mem_accesses{};
+    // with mem_accesses: also the memory contents before the instruction executes, records with
+    // an access that can't be read (the instruction is about to fault) go without
+    bool mem_values{};
+    // encoding of the records in the thread files, in-memory records are always v1, columnar
+    // files can't be written by the async stream writer
+    record_format format{record_format::v1};
+    // thread files are compressed with this dictionary, the bundle keeps a copy in its
+    // CompressionDict::sidecar_name file for reading
+    std::shared_ptr<const CompressionDict> dict;
+    // non-stream mode: bytes kept in memory for the whole bundle before threads spill their
+    // records to their thread files in the background, 0 = unlimited
+    size_t mem_budget{};
+    // non-stream mode: thread and macho-region files write() compresses at once on
+    // xnutrace_pool, 0 = one per pool thread
+    size_t write_concurrency{};
+    // non-JIT macho-region files go to this shared RegionStore instead of the bundle, empty =
+    // the bundle keeps all of them
+    std::filesystem::path region_store;
+    // stream mode: end the thread file's zstd frame and append a footer every this many record
+    // bytes, at the next sync frame, so the trace is readable up to there if the tracer dies.
+    // Not with async or columnar streams, 0 = off
+    uint64_t checkpoint_bytes{16 * 1024 * 1024};
+    // stream mode only: hand encoded records to an AsyncTraceWriter through per-thread rings
+    bool async{};
+    backpressure_policy backpressure{backpressure_policy::block};
+    size_t async_ring_sz{16 * 1024 * 1024}; // per thread, power of 2
+};
 
 class XNUTRACE_EXPORT TraceLog {
 public:
-    TraceLog(const std::string &log_dir_path, int compression_level, bool stream);
-    TraceLog(const std::string &log_dir_path);
+    TraceLog(const std::string &log_dir_path, int compression_level, bool stream,
+             const trace_log_opts &opts = {});
+    // pcs_only: columnar thread files are read from their header and pc columns alone and the
+    // parsed records only carry PCs, other formats are always read in full. read_threads: false
+    // leaves parsed_logs() empty, the threads are then read a window at a time through
+    // thread_streams()
+    TraceLog(const std::string &log_dir_path, bool pcs_only = false, bool read_threads = true);
     XNUTRACE_INLINE void log(thread_t thread, uint64_t pc);
-    XNUTRACE_INLINE void log(thread_t thread, const log_arm64_cpu_context *context, cs_insn *insn);
+    // mem_insn may be nullptr, it is only used when recording memory accesses
+    XNUTRACE_INLINE void log(thread_t thread, const log_arm64_cpu_context *context,
+                             const arm64_mem_insn *mem_insn);
+    // same records as calling log() once per element, with a single thread lookup
+    void log_batch(thread_t thread, std::span<const uint64_t> pcs);
+    void log_batch(thread_t thread, std::span<const log_arm64_cpu_context> contexts);
     void write(const MachORegions &macho_regions, const Symbols *symbols = nullptr);
+    // stream mode: writes meta.bin and the macho-region files ahead of write() so a trace that
+    // is never finished can still be read, a no-op otherwise
+    void write_stream_meta(const MachORegions &macho_regions, const Symbols *symbols = nullptr);
     uint64_t num_inst() const;
+    uint64_t num_dropped() const;
     size_t num_bytes() const;
     const MachORegions &macho_regions() const;
     const Symbols &symbols() const;
     const std::map<uint32_t, log_thread_buf> &parsed_logs() const;
-    static constexpr uint32_t sync_every = 1024 * 1024; // 1 MB, overhead 0.09% per MB
+    // read mode: one stream per thread file, sorted by thread ID, window_sz 0 = default
+    std::vector<std::unique_ptr<LogThreadStream>> thread_streams(size_t window_sz = 0) const;
+    // read mode, parsed logs only: the context thread tid logged for instruction inst_idx, see
+    // ThreadContextIndex, nullopt for unknown threads and traces read pcs_only. A thread's
+    // index is built on first use and picks up the GPR checkpoints of its thread file.
+    // gprs_only: the vector registers are zeroed and the replay may start at a GPR checkpoint.
+    std::optional<log_arm64_cpu_context> context_at(uint32_t tid, uint64_t inst_idx,
+                                                    bool gprs_only = false) const;
+    // read mode, not pcs_only: GPR checkpoints every interval instructions of every parsed log,
+    // written next to its thread file and used by context_at() from then on
+    void write_gpr_checkpoints(uint64_t interval = ThreadContextIndex::default_gpr_interval);
 
 private:
+    static constexpr size_t spill_check_every = 1024 * 1024;
+
     struct thread_ctx {
-        std::vector<uint8_t> log_buf;
+        ChunkedArena log_buf;
         std::unique_ptr<CompressedFile<log_thread_hdr>> log_stream;
+        // non-stream mode thread file once records have been spilled
+        std::unique_ptr<CompressedFile<log_thread_hdr>> spill_file;
+        // payload columns of log_stream or spill_file in columnar mode
+        std::unique_ptr<LogColumnWriter> log_columns;
+        std::vector<pc_range> spilled_ranges;
+        // every sync frame emitted, offsets are into the thread file in stream mode and into the
+        // in-memory segment otherwise. Columnar files have no seek index.
+        std::vector<seek_point> sync_points;
+        uint64_t segment_start{}; // file_bytes at the last spill
+        TraceLog *owner{};
+        uint32_t thread_id{};
+        std::unique_ptr<SPSCRing> log_ring;
+        // stream mode v2 files, records are re-encoded before they leave emit()
+        std::unique_ptr<LogMsgV2Encoder> v2_encoder;
+        std::vector<uint8_t> v2_buf;
         XNUTRACE_ALIGNED(16) log_arm64_cpu_context last_cpu_ctx;
-        uint64_t num_inst{};
-        uint32_t sz_since_last_sync{sync_every + 1};
-        XNUTRACE_INLINE void write_log_msg(const log_arm64_cpu_context *ctx, cs_insn *insn);
+        // read by TraceLog::num_inst() and num_dropped() while the thread is traced
+        SingleWriterCounter<uint64_t> num_inst;
+        SingleWriterCounter<uint64_t> num_dropped;
+        // v1 record bytes whatever the file format, the unit of byte sync intervals, spill and
+        // checkpoint checks so every format places its sync frames at the same instructions
+        uint64_t num_bytes{};
+        // bytes as emitted, sync frame offsets are in these
+        uint64_t file_bytes{};
+        uint64_t mem_accounted{};   // num_bytes already added to the bundle's memory count
+        uint64_t spill_check_at{UINT64_MAX};
+        uint64_t checkpoint_at{UINT64_MAX};
+        uint64_t sz_since_last_sync{};
+        uint64_t inst_since_last_sync{};
+        sync_policy sync;
+        uint32_t run_len{}; // pending basic block run
+        uint64_t run_prev_pc{};
+        uint64_t last_mem_addr{}; // reset by sync frames
+        bool run_branched{};
+        bool bb_runs{};
+        bool delta_pc_sp{};
+        bool mem_accesses{};
+        bool mem_values{};
+        bool drop_on_full{};
+        // the next record is preceded by a sync frame: at the start, for a spill or after a drop
+        bool need_sync{true};
+        // a full ring dropped a record, the ones after it are dropped too until a sync frame
+        // goes through
+        bool ring_dropped{};
+        bool spill_pending{};
+        XNUTRACE_INLINE void write_log_msg(const log_arm64_cpu_context *ctx,
+                                           const arm64_mem_insn *mem_insn);
         XNUTRACE_INLINE void write_log_msg(uint64_t pc);
+        void write_log_msgs(std::span<const uint64_t> pcs);
+        XNUTRACE_INLINE void write_bb_run_pc(uint64_t pc);
+        void flush_bb_run();
+        XNUTRACE_INLINE bool emit(const void *buf, size_t sz);
         void write_sync();
     };
+    std::unique_ptr<thread_ctx> new_thread_ctx(thread_t thread,
+                                               const log_arm64_cpu_context &context);
+    void account_mem(thread_ctx &ctx);
+    void spill(thread_ctx &ctx);
+    // columns is set for columnar thread files
+    std::unique_ptr<CompressedFile<log_thread_hdr>>
+    open_thread_file(uint32_t thread, std::unique_ptr<LogColumnWriter> &columns) const;
+    // writes meta.bin, drops stale macho-region files and queues writing the missing ones
+    void write_meta(const MachORegions &macho_regions, const std::vector<sym_info> &syms,
+                    std::vector<std::function<void()>> &file_jobs);
+    // parsed logs only, recorded instructions are counted per thread
     uint64_t m_num_inst{};
     std::unique_ptr<MachORegions> m_macho_regions;
     std::unique_ptr<Symbols> m_symbols;
     std::map<uint32_t, log_thread_buf> m_parsed_logs;
+    // built by context_at() on demand
+    mutable std::mutex m_ctx_indexes_lock;
+    mutable std::map<uint32_t, std::unique_ptr<ThreadContextIndex>> m_ctx_indexes;
+    std::vector<std::filesystem::path> m_thread_paths;
     std::filesystem::path m_log_dir_path;
+    bool m_pcs_only{};
     int m_compression_level{};
     bool m_stream{};
-    mph_map<uint32_t, thread_ctx> m_thread_ctxs;
+    trace_log_opts m_opts;
+    std::unique_ptr<RegionStore> m_region_store;
+    ThreadRegistry<thread_ctx> m_thread_ctxs;
+    std::atomic<size_t> m_mem_bytes{};
+    // destroyed before m_thread_ctxs so the rings are drained while their files are still open
+    std::unique_ptr<AsyncTraceWriter> m_async_writer;
+    std::unique_ptr<SpillWriter> m_spill_writer;
 };
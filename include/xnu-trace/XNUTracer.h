@@ -18,6 +18,7 @@ public:
         bool symbolicate;
         int compression_level;
         bool stream;
+        trace_log_opts log_opts;
     };
 
     XNUTracer(task_t target_task, const opts &options);
@@ -2,6 +2,10 @@
 
 #include "common.h"
 
+#undef NDEBUG
+#include <cassert>
+
+#include <array>
 #include <experimental/fixed_capacity_vector>
 
 struct log_msg;
@@ -37,17 +41,26 @@ constexpr uint8_t gpr_idx_sz = (uint8_t)gpr_idx::sp + 1; // sz = 32
 
 // 31  292827262524      2019      1514      10 9       5 4       0
 // ┌─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┐
-// │ ngc │ |c|s│b│   gc4   │   gc3   │   gc2   │   gc1   │   gc0   │
+// │ ngc │r|c|s│b│   gc4   │   gc3   │   gc2   │   gc1   │   gc0   │
+// └─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┘
+
+// vec_changed: d = pc/sp stored as varint deltas, m = memory accesses follow the vectors,
+// bb runs keep their length in bits 0-24
+// 31  292827262524      2019      1514      10 9       5 4       0
+// ┌─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┐
+// │ nvc │   │m│d│   vc4   │   vc3   │   vc2   │   vc1   │   vc0   │
 // └─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┘
 
-// 31  2928    252423222120191817161514  1211   9 8   6 5   3 2   0
+// mem_changed: d = addresses stored as varint deltas, v = values follow the addresses
+// 31  2928  26252423222120191817161514  1211   9 8   6 5   3 2   0
 // ┌─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┬─┐
-// │ nma │       │w│w│w│w│w│r│r│r│r│r│ sz4 │ sz3 │ sz2 │ sz1 │ sz0 │
-// │     │       │4│3│2│1│0│4│3│2│1│0│     │     │     │     │     │
+// │ nma │   │v│d│w│w│w│w│w│r│r│r│r│r│ sz4 │ sz3 │ sz2 │ sz1 │ sz0 │
+// │     │   │ │ │4│3│2│1│0│4│3│2│1│0│     │     │     │     │     │
 // └─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┴─┘
 
 constexpr int8_t rpc_num_changed_max = 5;
 constexpr int8_t mpc_num_changed_max = 5;
+constexpr uint32_t rpc_bb_run_len_max = (1 << 25) - 1;
 
 constexpr uint32_t rpc_num_changed(uint32_t reg_packed_changes) {
     return reg_packed_changes >> 29;
@@ -73,6 +86,32 @@ constexpr bool rpc_sync(uint32_t reg_packed_changes) {
     return reg_packed_changes & (1 << 27);
 }
 
+// basic block run: vec_changed holds the instruction count instead of vector changes
+constexpr bool rpc_bb_run(uint32_t reg_packed_changes) {
+    return reg_packed_changes & (1 << 28);
+}
+
+// vec_changed flag: branch target and new SP are zig-zag varint deltas from the previous values
+constexpr bool rpc_pc_sp_delta(uint32_t vec_packed_changes) {
+    return vec_packed_changes & (1 << 25);
+}
+
+// vec_changed flag: the record ends with a memory access section, see log_msg::mem_accesses
+constexpr bool rpc_mem(uint32_t vec_packed_changes) {
+    return vec_packed_changes & (1 << 26);
+}
+
+// access addresses are zig-zag varint deltas from the previous access, the base resets to 0 at
+// sync frames
+constexpr bool mpc_addr_delta(uint32_t mem_packed_changes) {
+    return mem_packed_changes & (1 << 25);
+}
+
+// the memory contents before the instruction executed follow the addresses, sz bytes per access
+constexpr bool mpc_values(uint32_t mem_packed_changes) {
+    return mem_packed_changes & (1 << 26);
+}
+
 constexpr bool mpc_read(uint32_t mem_packed_changes, uint32_t changed_idx) {
     return mem_packed_changes & (1 << (changed_idx + 15));
 }
@@ -129,6 +168,67 @@ constexpr uint32_t rpc_set_sync(uint32_t reg_packed_changes) {
     return reg_packed_changes | (1 << 27);
 }
 
+constexpr uint32_t rpc_set_bb_run(uint32_t reg_packed_changes) {
+    return reg_packed_changes | (1 << 28);
+}
+
+constexpr uint32_t rpc_set_pc_sp_delta(uint32_t vec_packed_changes) {
+    return vec_packed_changes | (1 << 25);
+}
+
+constexpr uint32_t rpc_set_mem(uint32_t vec_packed_changes) {
+    return vec_packed_changes | (1 << 26);
+}
+
+constexpr uint32_t mpc_set_addr_delta(uint32_t mem_packed_changes) {
+    return mem_packed_changes | (1 << 25);
+}
+
+constexpr uint32_t mpc_set_values(uint32_t mem_packed_changes) {
+    return mem_packed_changes | (1 << 26);
+}
+
+constexpr uint64_t zigzag_encode(int64_t val) {
+    return ((uint64_t)val << 1) ^ (uint64_t)(val >> 63);
+}
+
+constexpr int64_t zigzag_decode(uint64_t val) {
+    return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+}
+
+// LEB128, 7 bits per byte, low bits first
+constexpr size_t varint_size(uint64_t val) {
+    return val ? (64 - __builtin_clzll(val) + 6) / 7 : 1;
+}
+
+constexpr size_t varint_encode(uint8_t *buf, uint64_t val) {
+    size_t i = 0;
+    for (; val >= 0x80; val >>= 7) {
+        buf[i++] = (uint8_t)val | 0x80;
+    }
+    buf[i++] = (uint8_t)val;
+    return i;
+}
+
+constexpr uint64_t varint_decode(const uint8_t *buf, size_t *sz = nullptr) {
+    uint64_t res = 0;
+    size_t i     = 0;
+    for (; buf[i] & 0x80; ++i) {
+        res |= (uint64_t)(buf[i] & 0x7F) << (7 * i);
+    }
+    res |= (uint64_t)buf[i] << (7 * i);
+    if (sz) {
+        *sz = i + 1;
+    }
+    return res;
+}
+
+// delta encoded records are only written when every delta fits in the 8 bytes an absolute value
+// takes so log_msg::size_max and log_msg::mem_size_max still hold
+constexpr bool pc_sp_delta_fits(uint64_t val, uint64_t last_val) {
+    return zigzag_encode((int64_t)(val - last_val)) < (1ull << 56);
+}
+
 // clang-format off
 enum class vec_idx : uint8_t {
     v0 = 0, v1, v2, v3, v4, v5, v6, v7,
@@ -140,6 +240,29 @@ enum class vec_idx : uint8_t {
 
 constexpr uint8_t vec_idx_sz = (uint8_t)vec_idx::v31 + 1; // sz = 32
 
+struct mem_access {
+    uint64_t addr;
+    uint32_t size;
+    bool read;
+    bool write;
+    const uint8_t *value; // nullptr unless values were recorded, points into the record
+};
+
+using mem_accesses_t = std::experimental::fixed_capacity_vector<mem_access, mpc_num_changed_max>;
+
+// Bytes a record without delta encoding or memory accesses takes up to its vectors, indexed by
+// the flag bits of gpr_changed (gpr_changed >> 25): header, branch target, SP and changed GPRs.
+constexpr std::array<uint8_t, 1 << (32 - 25)> log_msg_fixed_sizes = [] {
+    std::array<uint8_t, 1 << (32 - 25)> res{};
+    for (uint32_t i = 0; i < res.size(); ++i) {
+        const auto gpr_changed = i << 25;
+        res[i] = 2 * sizeof(uint32_t) /* hdr */ +
+                 (rpc_num_fixed_changed(gpr_changed) + rpc_num_changed(gpr_changed)) *
+                     sizeof(uint64_t);
+    }
+    return res;
+}();
+
 struct log_msg {
     using changed_gpr_t = std::experimental::fixed_capacity_vector<std::pair<uint32_t, uint64_t>,
                                                                    rpc_num_changed_max>;
@@ -148,28 +271,75 @@ struct log_msg {
     uint32_t gpr_changed;
     uint32_t vec_changed;
     size_t size() const {
-        if (is_sync_frame()) {
+        if (XNUTRACE_UNLIKELY(rpc_sync(gpr_changed)) && is_sync_frame()) {
             return size_full_ctx;
         }
-        return sizeof(*this) + num_fixed() * sizeof(uint64_t) + num_gpr() * sizeof(uint64_t) +
-               num_vec() * sizeof(uint128_t);
+        if (XNUTRACE_LIKELY(!pc_sp_delta() && !has_mem())) {
+            return log_msg_fixed_sizes[gpr_changed >> 25] + num_vec() * sizeof(uint128_t);
+        }
+        return sizeof(*this) + fixed_size() + num_gpr() * sizeof(uint64_t) +
+               num_vec() * sizeof(uint128_t) + mem_size();
     }
     uint32_t num_fixed() const {
         return rpc_num_fixed_changed(gpr_changed);
     }
+    // bytes taken by the branch target and SP following the header
+    size_t fixed_size() const {
+        if (XNUTRACE_LIKELY(!pc_sp_delta())) {
+            return num_fixed() * sizeof(uint64_t);
+        }
+        size_t sz = 0;
+        for (uint32_t i = 0; i < num_fixed(); ++i) {
+            while (fixed_buf()[sz++] & 0x80) {}
+        }
+        return sz;
+    }
+    // bytes taken by the branch target alone, the SP follows it
+    size_t pc_size() const {
+        if (!pc_branched()) {
+            return 0;
+        }
+        if (XNUTRACE_LIKELY(!pc_sp_delta())) {
+            return sizeof(uint64_t);
+        }
+        size_t sz = 0;
+        while (fixed_buf()[sz++] & 0x80) {}
+        return sz;
+    }
+    bool pc_sp_delta() const {
+        return rpc_pc_sp_delta(vec_changed);
+    }
     bool pc_branched() const {
         return rpc_pc_branched(gpr_changed);
     }
     bool sp_changed() const {
         return rpc_sp_changed(gpr_changed);
     }
+    // absolute encoding only, use pc(last_pc) when the record may be delta encoded
     uint64_t pc() const {
-        const auto off = sizeof(*this);
-        return *(uint64_t *)((uintptr_t)this + off);
+        assert(!pc_sp_delta());
+        return load<uint64_t>(0);
     }
     uint64_t sp() const {
-        const auto off = sizeof(*this) + pc_branched() * sizeof(uint64_t);
-        return *(uint64_t *)((uintptr_t)this + off);
+        assert(!pc_sp_delta());
+        return load<uint64_t>(pc_branched() * sizeof(uint64_t));
+    }
+    // last_pc/last_sp are the values before this record
+    uint64_t pc(uint64_t last_pc) const {
+        if (XNUTRACE_LIKELY(!pc_sp_delta())) {
+            return pc();
+        }
+        return last_pc + zigzag_decode(varint_decode(fixed_buf()));
+    }
+    uint64_t sp(uint64_t last_sp) const {
+        if (XNUTRACE_LIKELY(!pc_sp_delta())) {
+            return sp();
+        }
+        size_t pc_sz = 0;
+        if (pc_branched()) {
+            varint_decode(fixed_buf(), &pc_sz);
+        }
+        return last_sp + zigzag_decode(varint_decode(fixed_buf() + pc_sz));
     }
     uint32_t num_gpr() const {
         return rpc_num_changed(gpr_changed);
@@ -178,8 +348,7 @@ struct log_msg {
         return rpc_reg_idx(gpr_changed, change_idx);
     }
     uint64_t gpr(uint32_t change_idx) const {
-        const auto off = sizeof(*this) + num_fixed() * sizeof(uint64_t);
-        return ((uint64_t *)((uintptr_t)this + off))[change_idx];
+        return load<uint64_t>(fixed_size() + change_idx * sizeof(uint64_t));
     }
     changed_gpr_t changed_gpr() const {
         changed_gpr_t res;
@@ -189,15 +358,14 @@ struct log_msg {
         return res;
     }
     uint32_t num_vec() const {
-        return rpc_num_changed(vec_changed);
+        return is_bb_run() ? 0 : rpc_num_changed(vec_changed);
     }
     uint32_t vec_idx(uint32_t change_idx) const {
         return rpc_reg_idx(vec_changed, change_idx);
     }
     uint128_t vec(uint32_t change_idx) const {
-        const auto off =
-            sizeof(*this) + num_fixed() * sizeof(uint64_t) + num_gpr() * sizeof(uint64_t);
-        return ((uint128_t *)((uintptr_t)this + off))[change_idx];
+        return load<uint128_t>(fixed_size() + num_gpr() * sizeof(uint64_t) +
+                               change_idx * sizeof(uint128_t));
     }
     changed_vec_t changed_vec() const {
         changed_vec_t res;
@@ -206,6 +374,87 @@ struct log_msg {
         }
         return res;
     }
+    // memory accesses of the instruction, bb runs never carry any
+    bool has_mem() const {
+        return !is_bb_run() && rpc_mem(vec_changed);
+    }
+    uint32_t mem_changed() const {
+        assert(has_mem());
+        return load<uint32_t>(mem_off());
+    }
+    uint32_t num_mem() const {
+        return has_mem() ? mpc_num_changed(mem_changed()) : 0;
+    }
+    // bytes taken by the memory access section following the vectors
+    size_t mem_size() const {
+        if (XNUTRACE_LIKELY(!has_mem())) {
+            return 0;
+        }
+        return mem_section_size(fixed_buf() + mem_off());
+    }
+    // bytes taken by a memory access section starting at its mpc word
+    static size_t mem_section_size(const uint8_t *section) {
+        uint32_t mpc;
+        memcpy(&mpc, section, sizeof(mpc));
+        const auto num = mpc_num_changed(mpc);
+        size_t sz      = sizeof(mpc);
+        if (mpc_addr_delta(mpc)) {
+            for (uint32_t i = 0; i < num; ++i) {
+                while (section[sz++] & 0x80) {}
+            }
+        } else {
+            sz += num * sizeof(uint64_t);
+        }
+        if (mpc_values(mpc)) {
+            for (uint32_t i = 0; i < num; ++i) {
+                sz += mpc_mem_access_sz(mpc, i);
+            }
+        }
+        return sz;
+    }
+    // last_addr is the address of the previous access since the last sync frame (0 after it) and
+    // is advanced past this record's accesses
+    mem_accesses_t mem_accesses(uint64_t &last_addr) const {
+        mem_accesses_t res;
+        if (!has_mem()) {
+            return res;
+        }
+        const auto off      = mem_off();
+        const auto mpc      = load<uint32_t>(off);
+        const uint8_t *ptr  = fixed_buf() + off + sizeof(mpc);
+        const bool is_delta = mpc_addr_delta(mpc);
+        for (uint32_t i = 0; i < mpc_num_changed(mpc); ++i) {
+            uint64_t addr;
+            if (is_delta) {
+                size_t sz;
+                addr = last_addr + zigzag_decode(varint_decode(ptr, &sz));
+                ptr += sz;
+            } else {
+                memcpy(&addr, ptr, sizeof(addr));
+                ptr += sizeof(addr);
+            }
+            last_addr = addr;
+            res.emplace_back(mem_access{.addr  = addr,
+                                        .size  = mpc_mem_access_sz(mpc, i),
+                                        .read  = mpc_read(mpc, i),
+                                        .write = mpc_write(mpc, i)});
+        }
+        if (mpc_values(mpc)) {
+            for (auto &access : res) {
+                access.value = ptr;
+                ptr += access.size;
+            }
+        }
+        return res;
+    }
+    // PC-only run of bb_run_len() sequential instructions, the first one at pc() if
+    // pc_branched() otherwise 4 past the previous instruction
+    bool is_bb_run() const {
+        return rpc_bb_run(gpr_changed);
+    }
+    uint32_t bb_run_len() const {
+        return is_bb_run() ? vec_changed & rpc_bb_run_len_max : 1;
+    }
     bool is_sync_frame() const {
         return rpc_sync(gpr_changed) &&
                !memcmp(sync_frame_buf_hdr, this, sizeof(sync_frame_buf_hdr));
@@ -215,6 +464,11 @@ struct log_msg {
                                        2 * sizeof(uint64_t) /* pc/sp */ +
                                        rpc_num_changed_max * sizeof(uint64_t) /* gpr */ +
                                        rpc_num_changed_max * sizeof(uint128_t) /* vec */; // sz 18
+    // largest single access is a 64 byte ld4/st4
+    static constexpr size_t mem_access_sz_max = 64;
+    static constexpr size_t mem_size_max      = sizeof(uint32_t) /* mpc */ +
+                                           mpc_num_changed_max * sizeof(uint64_t) /* addr */ +
+                                           mpc_num_changed_max * mem_access_sz_max /* value */;
     static constexpr uint64_t sync_frame_buf_hdr[] = {((uint64_t)0 << 32) |
                                                           rpc_set_sync(0),       // 0 / hdr
                                                       0x1b30'aabd'434e'5953ULL,  // 1 / SYNC
@@ -242,15 +496,31 @@ struct log_msg {
                                : nullptr;
     }
     uint64_t sync_num_inst() const {
-        return is_sync_frame() ? *(uint64_t *)((uintptr_t)this + sizeof(sync_frame_buf_hdr))
+        return is_sync_frame() ? load<uint64_t>(sizeof(sync_frame_buf_hdr) - sizeof(*this))
                                : UINT64_MAX;
     }
-} __attribute__((packed, aligned(8)));
+
+private:
+    const uint8_t *fixed_buf() const {
+        return (const uint8_t *)this + sizeof(*this);
+    }
+    // offset of the memory access section from fixed_buf()
+    size_t mem_off() const {
+        return fixed_size() + num_gpr() * sizeof(uint64_t) + num_vec() * sizeof(uint128_t);
+    }
+    template <typename T> T load(size_t off) const {
+        T res;
+        memcpy(&res, fixed_buf() + off, sizeof(res));
+        return res;
+    }
+} __attribute__((packed)); // delta encoded records leave the following ones unaligned
 
 static_assert(sizeof(log_msg) == 2 * sizeof(uint32_t), "log_msg header is not 8 bytes");
 static_assert(sizeof(log_msg) % sizeof(uint64_t) == 0, "log_msg not 8 byte aligned");
 static_assert(log_msg::sync_frame_sz == log_msg::size_max,
               "log_msg::sync_frame_buf_hdr and num_inst not max_size");
+static_assert(log_msg::size_max + log_msg::mem_size_max <= log_msg::size_full_ctx,
+              "log_msg with memory accesses doesn't fit a full context buffer");
 
 struct log_region {
     uint64_t base;
@@ -274,17 +544,93 @@ struct log_comp_hdr {
     uint64_t is_compressed;
     uint64_t header_size;
     uint64_t decompressed_size;
+    // compressed files keep this until they are closed, readers fall back to the last footer
+    static constexpr uint64_t unfinished_size = UINT64_MAX;
+} __attribute__((packed));
+
+// zstd skippable frame written by CompressedFile::checkpoint() after the data frames it covers,
+// followed by the file header as of the checkpoint and a FNV-1a hash of everything after
+// frame_size. Plain zstd decoders step over it.
+struct log_comp_footer {
+    uint32_t frame_magic; // zstd skippable frame magic
+    uint32_t frame_size;  // bytes after this field
+    uint64_t magic;
+    uint64_t decompressed_size; // of the data frames before the footer
+    uint64_t header_size;
+    static constexpr uint32_t skippable_magic = 0x184d'2a50; // ZSTD_MAGIC_SKIPPABLE_START
+    static constexpr uint64_t footer_magic    = 0x8d3a'dfb8'5450'4b43ull; // 'CKPT'
+} __attribute__((packed));
+
+// <file>.idx.<ext> sidecar written when a CompressedFile with seek points is closed, one entry
+// per point in increasing order of key and offset
+struct log_seek_index_hdr {
+    uint64_t num_entries;
+    static constexpr uint64_t magic = 0x8d3a'dfb8'5844'4953ull; // 'SIDX'
 } __attribute__((packed));
 
+struct log_seek_index_entry {
+    uint64_t key;              // thread files: sync_num_inst() of the sync frame
+    uint64_t decomp_off;       // of the point in the decompressed data
+    uint64_t frame_comp_off;   // of the frame the point is in, from the start of the file
+    uint64_t frame_decomp_off; // decompressed offset of the first byte of that frame
+} __attribute__((packed));
+
+// <file>.gprs.<ext> sidecar of a thread file with the checkpoints of a ThreadContextIndex, the
+// offsets are into the log as parsed into memory
+struct log_gpr_checkpoints_hdr {
+    uint64_t interval;
+    uint64_t num_checkpoints;
+    // of the log they were built from, checkpoints of any other are stale
+    uint64_t log_num_inst;
+    uint64_t log_num_bytes;
+    static constexpr uint64_t magic = 0x8d3a'dfb8'4352'5047ull; // 'GPRC'
+} __attribute__((packed));
+
+struct log_gpr_checkpoint {
+    uint64_t next_inst; // the state is the one before this instruction
+    uint64_t log_off;   // of its record
+    // pc, sp, nzcv, x[], fp and lr as laid out in log_arm64_cpu_context
+    uint64_t regs[offsetof(log_arm64_cpu_context, v) / sizeof(uint64_t)];
+} __attribute__((packed));
+
+enum class sync_mode : uint8_t {
+    bytes,        // sync frame every sync_interval record bytes
+    instructions, // sync frame every sync_interval instructions
+    automatic,    // sync_interval instructions, bounded by size overhead, see sync_policy
+};
+
+enum class record_format : uint8_t {
+    v1, // log_msg records
+    v2, // one byte prefix for the common shapes, see log_msg_v2
+    // v1 record headers and sync frames, the payloads go to separate column files, see
+    // LogColumns.h
+    columnar,
+};
+
+// Fields are only ever appended, files written before one was added read it as 0, see
+// CompressedFile: no drops, no recorded sync policy and v1 records.
 struct log_thread_hdr {
     uint64_t thread_id;
     uint64_t num_inst;
+    uint64_t num_dropped; // instructions lost to a full async ring, each gap ends in a sync frame
+    uint64_t sync_interval;
+    uint8_t sync_mode;     // enum sync_mode
+    uint8_t record_format; // enum record_format
+    // keeps the records of uncompressed files 16 byte aligned when they are mapped, new fields
+    // take their place
+    uint8_t reserved[14];
     static constexpr uint64_t magic = 0x8d3a'dfb8'4452'4854ull; // 'THRD'
 } __attribute__((packed));
 
+static_assert((sizeof(log_comp_hdr) + sizeof(log_thread_hdr)) % 16 == 0,
+              "uncompressed thread file records not 16 byte aligned");
+
+// meta.bin: the RegionStore path (region_store_path_len bytes), then the regions and symbols.
+// Older bundles have no region_store_path_len and read it as 0.
 struct log_meta_hdr {
     uint64_t num_regions;
     uint64_t num_syms;
+    uint64_t region_store_path_len; // 0 = every macho-region file is in the bundle
     static constexpr uint64_t magic = 0x8d3a'dfb8'4154'454dull; // 'META'
 } __attribute__((packed));
 
@@ -25,6 +25,11 @@ XNUTRACE_EXPORT std::vector<uint8_t> read_target(task_t target_task, const T *ta
     return read_target(target_task, (uint64_t)target_addr, sz);
 }
 
+// false instead of failing when [target_addr, target_addr + sz) isn't readable, also for
+// target_task == mach_task_self() where a plain memcpy would fault
+XNUTRACE_EXPORT bool try_read_target(task_t target_task, uint64_t target_addr, void *buf,
+                                     uint64_t sz);
+
 XNUTRACE_EXPORT std::string read_cstr_target(task_t target_task, uint64_t target_addr);
 XNUTRACE_EXPORT std::string read_cstr_target(task_t target_task, const char *target_addr);
 
@@ -4,17 +4,31 @@
 
 #include "ARM64Disassembler.h"
 #include "ARM64InstrHistogram.h"
+#include "AsyncTraceWriter.h"
 #include "Atomic.h"
 #include "BitVector.h"
+#include "ChunkedArena.h"
 #include "CompressedFile.h"
+#include "CompressionDict.h"
+#include "CompressionScheduler.h"
 #include "EliasFano.h"
+#include "FileIO.h"
 #include "FridaStalker.h"
+#include "LogColumns.h"
+#include "LogMsgV2.h"
+#include "LogPcDecoder.h"
+#include "LogThreadStream.h"
 #include "MachORegions.h"
 #include "MinimalPerfectHash.h"
 #include "RankSelect.h"
+#include "RegionStore.h"
+#include "SPSCRing.h"
 #include "Signpost.h"
+#include "SpillWriter.h"
 #include "Symbols.h"
+#include "ThreadContextIndex.h"
 #include "ThreadPool.h"
+#include "ThreadRegistry.h"
 #include "TraceLog.h"
 #include "VMRegions.h"
 #include "XNUCommpageTime.h"
@@ -1,2 +1,243 @@
 #include "xnu-trace/ARM64Disassembler.h"
 #include "common-internal.h"
+
+#include "xnu-trace/utils.h"
+
+#include <cstring>
+#include <string_view>
+
+#include <frida-gum.h>
+
+namespace {
+
+uint64_t reg_val(const log_arm64_cpu_context &ctx, uint8_t idx) {
+    switch (idx) {
+    case (uint8_t)gpr_idx::fp:
+        return ctx.fp;
+    case (uint8_t)gpr_idx::lr:
+        return ctx.lr;
+    case (uint8_t)gpr_idx::sp:
+        return ctx.sp;
+    case arm64_mem_insn::no_reg:
+        return 0;
+    default:
+        return ctx.x[idx];
+    }
+}
+
+// X and W registers map to the same gpr_idx, the W view is handled by the index extend
+uint8_t gpr_index(unsigned int reg) {
+    if (reg >= ARM64_REG_X0 && reg <= ARM64_REG_X28) {
+        return reg - ARM64_REG_X0;
+    }
+    if (reg >= ARM64_REG_W0 && reg <= ARM64_REG_W30) {
+        return reg - ARM64_REG_W0;
+    }
+    switch (reg) {
+    case ARM64_REG_X29:
+        return (uint8_t)gpr_idx::fp;
+    case ARM64_REG_X30:
+        return (uint8_t)gpr_idx::lr;
+    case ARM64_REG_SP:
+    case ARM64_REG_WSP:
+        return (uint8_t)gpr_idx::sp;
+    default:
+        return arm64_mem_insn::no_reg;
+    }
+}
+
+uint32_t vas_elem_size(arm64_vas vas) {
+    switch (vas) {
+    case ARM64_VAS_8B:
+    case ARM64_VAS_16B:
+        return 1;
+    case ARM64_VAS_4H:
+    case ARM64_VAS_8H:
+        return 2;
+    case ARM64_VAS_2S:
+    case ARM64_VAS_4S:
+        return 4;
+    case ARM64_VAS_1D:
+    case ARM64_VAS_2D:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+// bytes transferred for one data register, 0 if it isn't one
+uint32_t reg_size(const cs_arm64_op &op, std::string_view mnem) {
+    const auto reg = op.reg;
+    if ((reg >= ARM64_REG_W0 && reg <= ARM64_REG_W30) || reg == ARM64_REG_WZR ||
+        (reg >= ARM64_REG_X0 && reg <= ARM64_REG_X28) || reg == ARM64_REG_X29 ||
+        reg == ARM64_REG_X30 || reg == ARM64_REG_XZR) {
+        // ldrb, ldrsh, ldaddlb, casb, ldrsw, ldpsw, ...
+        if (mnem.ends_with('b')) {
+            return 1;
+        }
+        if (mnem.ends_with('h')) {
+            return 2;
+        }
+        if (mnem.ends_with("sw")) {
+            return 4;
+        }
+        return (reg >= ARM64_REG_W0 && reg <= ARM64_REG_W30) || reg == ARM64_REG_WZR ? 4 : 8;
+    }
+    if (reg >= ARM64_REG_B0 && reg <= ARM64_REG_B31) {
+        return 1;
+    }
+    if (reg >= ARM64_REG_H0 && reg <= ARM64_REG_H31) {
+        return 2;
+    }
+    if (reg >= ARM64_REG_S0 && reg <= ARM64_REG_S31) {
+        return 4;
+    }
+    if (reg >= ARM64_REG_D0 && reg <= ARM64_REG_D31) {
+        return 8;
+    }
+    if (reg >= ARM64_REG_Q0 && reg <= ARM64_REG_Q31) {
+        return 16;
+    }
+    if (reg >= ARM64_REG_V0 && reg <= ARM64_REG_V31) {
+        // lanes and ld<n>r replicate a single element per register
+        const auto elem_sz = vas_elem_size(op.vas);
+        if (elem_sz && (op.vector_index != -1 || mnem.ends_with('r'))) {
+            return elem_sz;
+        }
+        return op.vas == ARM64_VAS_8B || op.vas == ARM64_VAS_4H || op.vas == ARM64_VAS_2S ||
+                       op.vas == ARM64_VAS_1D
+                   ? 8
+                   : 16;
+    }
+    return 0;
+}
+
+bool is_atomic_rmw(std::string_view mnem) {
+    if (mnem.starts_with("cas") || mnem.starts_with("swp")) {
+        return true;
+    }
+    if (!mnem.starts_with("ld") && !mnem.starts_with("st")) {
+        return false;
+    }
+    mnem.remove_prefix(2);
+    for (const auto op : {"add", "clr", "eor", "set", "smax", "smin", "umax", "umin"}) {
+        if (mnem.starts_with(op)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+mem_accesses_t arm64_mem_insn::accesses(const log_arm64_cpu_context &ctx) const {
+    uint64_t addr = reg_val(ctx, base);
+    if (!post_index) {
+        uint64_t idx = reg_val(ctx, index);
+        switch (index_ext) {
+        case extend::uxtw:
+            idx = (uint32_t)idx;
+            break;
+        case extend::sxtw:
+            idx = (uint64_t)(int64_t)(int32_t)idx;
+            break;
+        case extend::none:
+            break;
+        }
+        addr += disp + (idx << index_shift);
+    }
+    mem_accesses_t res;
+    for (uint8_t i = 0; i < num_accesses; ++i) {
+        res.emplace_back(mem_access{.addr  = addr,
+                                    .size  = access[i].size,
+                                    .read  = access[i].read,
+                                    .write = access[i].write});
+        addr += access[i].size;
+    }
+    return res;
+}
+
+std::optional<arm64_mem_insn> arm64_mem_insn::decode(const cs_insn *insn) {
+    assert(insn->detail);
+    const auto &arm64 = insn->detail->arm64;
+    const std::string_view mnem{insn->mnemonic};
+    if (mnem.starts_with("prf")) {
+        return std::nullopt;
+    }
+
+    arm64_mem_insn res;
+    int mem_op = -1;
+    for (int i = 0; i < arm64.op_count; ++i) {
+        if (arm64.operands[i].type == ARM64_OP_MEM) {
+            mem_op = i;
+            break;
+        }
+    }
+    if (mem_op >= 0) {
+        const auto &op = arm64.operands[mem_op];
+        res.base       = gpr_index(op.mem.base);
+        res.index      = gpr_index(op.mem.index);
+        res.disp       = op.mem.disp;
+        if (op.ext == ARM64_EXT_UXTW) {
+            res.index_ext = extend::uxtw;
+        } else if (op.ext == ARM64_EXT_SXTW) {
+            res.index_ext = extend::sxtw;
+        }
+        res.index_shift = op.shift.type == ARM64_SFT_LSL ? op.shift.value : 0;
+        // post-index writeback shows up as an immediate or register operand after the memory one
+        res.post_index = arm64.writeback && mem_op + 1 < arm64.op_count;
+    } else if (mnem.starts_with("ldr") && arm64.op_count == 2 &&
+               arm64.operands[1].type == ARM64_OP_IMM) {
+        // PC-relative literal, capstone resolves it to an absolute address
+        mem_op   = 1;
+        res.disp = arm64.operands[1].imm;
+    } else {
+        return std::nullopt;
+    }
+
+    bool read  = false;
+    bool write = false;
+    if (is_atomic_rmw(mnem)) {
+        read  = true;
+        write = true;
+    } else if (mnem.starts_with("ld")) {
+        read = true;
+    } else if (mnem.starts_with("st")) {
+        write = true;
+    } else {
+        return std::nullopt;
+    }
+
+    int first_data = 0;
+    int num_data   = 0;
+    for (int i = 0; i < mem_op && arm64.operands[i].type == ARM64_OP_REG; ++i) {
+        ++num_data;
+    }
+    // exclusive stores report their status register first
+    if (mnem.starts_with("stxr") || mnem.starts_with("stlxr") || mnem.starts_with("stxp") ||
+        mnem.starts_with("stlxp")) {
+        first_data = 1;
+        --num_data;
+    }
+    // the compare/source register(s) determine the size, the rest receive the old value
+    if (read && write) {
+        num_data = mnem.starts_with("casp") ? 2 : 1;
+    }
+    if (num_data <= 0 || num_data > mpc_num_changed_max) {
+        return std::nullopt;
+    }
+
+    const auto sz = reg_size(arm64.operands[first_data], mnem);
+    if (!sz) {
+        return std::nullopt;
+    }
+    const auto total_sz = sz * num_data;
+    if (is_pow2(total_sz) && total_sz <= log_msg::mem_access_sz_max) {
+        res.access[res.num_accesses++] = {.size = (uint8_t)total_sz, .read = read, .write = write};
+    } else {
+        for (int i = 0; i < num_data; ++i) {
+            res.access[res.num_accesses++] = {.size = (uint8_t)sz, .read = read, .write = write};
+        }
+    }
+    return res;
+}
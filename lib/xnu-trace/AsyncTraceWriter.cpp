@@ -0,0 +1,65 @@
+#include "xnu-trace/AsyncTraceWriter.h"
+#include "common-internal.h"
+
+#include <chrono>
+#include <pthread.h>
+
+using namespace std::chrono_literals;
+
+AsyncTraceWriter::AsyncTraceWriter() : m_thread{&AsyncTraceWriter::run, this} {}
+
+AsyncTraceWriter::~AsyncTraceWriter() {
+    stop();
+}
+
+void AsyncTraceWriter::add(SPSCRing *ring, jev::xnutrace::detail::CompressedFile *file) {
+    std::lock_guard lock{m_sinks_lock};
+    m_sinks.emplace_back(sink{.ring = ring, .file = file});
+    m_sinks_gen.fetch_add(1, std::memory_order_release);
+}
+
+void AsyncTraceWriter::stop() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+    m_stop.store(true, std::memory_order_release);
+    m_thread.join();
+}
+
+size_t AsyncTraceWriter::drain(const std::vector<sink> &sinks) {
+    size_t num_drained = 0;
+    for (const auto &[ring, file] : sinks) {
+        const auto [first, second] = ring->peek();
+        if (first.empty()) {
+            continue;
+        }
+        file->write(first);
+        if (!second.empty()) {
+            file->write(second);
+        }
+        ring->release(first.size() + second.size());
+        num_drained += first.size() + second.size();
+    }
+    return num_drained;
+}
+
+void AsyncTraceWriter::run() {
+    pthread_setname_np("xnu-trace async writer");
+    std::vector<sink> sinks;
+    uint64_t sinks_gen = 0;
+    while (true) {
+        const auto stopping = m_stop.load(std::memory_order_acquire);
+        if (const auto gen = m_sinks_gen.load(std::memory_order_acquire); gen != sinks_gen) {
+            std::lock_guard lock{m_sinks_lock};
+            sinks     = m_sinks;
+            sinks_gen = m_sinks_gen.load(std::memory_order_relaxed);
+        }
+        if (!drain(sinks)) {
+            if (stopping) {
+                // m_stop was set before this pass so everything pushed beforehand is written
+                break;
+            }
+            std::this_thread::sleep_for(100us);
+        }
+    }
+}
@@ -0,0 +1,101 @@
+#include "xnu-trace/ChunkedArena.h"
+#include "common-internal.h"
+
+#include "xnu-trace/utils.h"
+
+#include <sys/mman.h>
+
+#include <mach/vm_statistics.h>
+
+static constexpr size_t huge_page_sz = 2 * 1024 * 1024;
+
+static uint8_t *alloc_chunk(size_t sz) {
+#ifdef VM_FLAGS_SUPERPAGE_SIZE_2MB
+    // superpages are only available on some hosts (not arm64), fall back to regular pages
+    if (sz % huge_page_sz == 0) {
+        const auto buf = mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,
+                              VM_FLAGS_SUPERPAGE_SIZE_2MB, 0);
+        if (buf != MAP_FAILED) {
+            return (uint8_t *)buf;
+        }
+    }
+#endif
+    const auto buf = mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    posix_check(buf == MAP_FAILED, fmt::format("ChunkedArena mmap {:d} bytes", sz));
+#ifdef MADV_HUGEPAGE
+    madvise(buf, sz, MADV_HUGEPAGE);
+#endif
+    return (uint8_t *)buf;
+}
+
+ChunkedArena::ChunkedArena(size_t chunk_sz) : m_chunk_sz{roundup_pow2_mul(chunk_sz, PAGE_SZ)} {}
+
+ChunkedArena::~ChunkedArena() {
+    release();
+}
+
+ChunkedArena::ChunkedArena(ChunkedArena &&other) noexcept
+    : m_chunks{std::move(other.m_chunks)}, m_cur{std::exchange(other.m_cur, nullptr)},
+      m_cur_end{std::exchange(other.m_cur_end, nullptr)}, m_chunk_sz{other.m_chunk_sz} {
+    other.m_chunks.clear();
+}
+
+ChunkedArena &ChunkedArena::operator=(ChunkedArena &&other) noexcept {
+    if (this != &other) {
+        release();
+        m_chunks   = std::move(other.m_chunks);
+        m_cur      = std::exchange(other.m_cur, nullptr);
+        m_cur_end  = std::exchange(other.m_cur_end, nullptr);
+        m_chunk_sz = other.m_chunk_sz;
+        other.m_chunks.clear();
+    }
+    return *this;
+}
+
+void ChunkedArena::release() {
+    for (const auto &c : m_chunks) {
+        posix_check(munmap(c.buf, c.capacity), "ChunkedArena munmap");
+    }
+    m_chunks.clear();
+    m_cur     = nullptr;
+    m_cur_end = nullptr;
+}
+
+void ChunkedArena::new_chunk(size_t min_sz) {
+    if (!m_chunks.empty()) {
+        m_chunks.back().size = m_cur - m_chunks.back().buf;
+    }
+    const auto sz = std::max(m_chunk_sz, roundup_pow2_mul(min_sz, huge_page_sz));
+    m_chunks.emplace_back(chunk{.buf = alloc_chunk(sz), .capacity = sz, .size = 0});
+    m_cur     = m_chunks.back().buf;
+    m_cur_end = m_cur + sz;
+}
+
+size_t ChunkedArena::size() const {
+    size_t sz = 0;
+    for (const auto &c : chunks()) {
+        sz += c.size();
+    }
+    return sz;
+}
+
+size_t ChunkedArena::capacity() const {
+    size_t sz = 0;
+    for (const auto &c : m_chunks) {
+        sz += c.capacity;
+    }
+    return sz;
+}
+
+std::vector<std::span<const uint8_t>> ChunkedArena::chunks() const {
+    std::vector<std::span<const uint8_t>> res;
+    res.reserve(m_chunks.size());
+    for (size_t i = 0; i < m_chunks.size(); ++i) {
+        const auto &c = m_chunks[i];
+        const auto sz = i == m_chunks.size() - 1 ? (size_t)(m_cur - c.buf) : c.size;
+        if (sz) {
+            res.emplace_back(c.buf, sz);
+        }
+    }
+    return res;
+}
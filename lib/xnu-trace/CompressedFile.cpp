@@ -1,11 +1,13 @@
 #include "xnu-trace/CompressedFile.h"
 #include "common-internal.h"
 
+#include "xnu-trace/CompressionDict.h"
 #include "xnu-trace/log_structs.h"
 #include "xnu-trace/mach.h"
 #include "xnu-trace/utils.h"
 
 #include <algorithm>
+#include <chrono>
 #include <locale>
 
 #include <mach/mach_init.h>
@@ -24,84 +26,108 @@ XNUTRACE_INLINE static void zstd_check(size_t retval, const std::string &msg) {
     }
 }
 
+namespace {
+
+uint64_t fnv1a(std::span<const uint8_t> buf) {
+    uint64_t hash = 0xcbf2'9ce4'8422'2325ull;
+    for (const auto b : buf) {
+        hash = (hash ^ b) * 0x100'0000'01b3ull;
+    }
+    return hash;
+}
+
+} // namespace
+
+fs::path seek_index_path(const fs::path &path) {
+    auto res = path;
+    res.replace_extension(fmt::format(".idx{:s}", path.extension().string()));
+    return res;
+}
+
+bool is_seek_index_path(const fs::path &path) {
+    return path.stem().extension() == ".idx";
+}
+
 namespace jev::xnutrace::detail {
 
 CompressedFile::CompressedFile(const fs::path &path, bool read, size_t hdr_sz, uint64_t hdr_magic,
-                               const void *hdr, int level, bool verbose, int num_threads)
-    : m_path{path}, m_is_read{read}, m_verbose{verbose} {
+                               const void *hdr, int level, bool verbose,
+                               const CompressionDict *dict)
+    : m_path{path}, m_level{read ? 0 : level}, m_dict{dict}, m_is_read{read}, m_verbose{verbose} {
+    m_io = FileIO::open(path, read);
     if (read) {
-        m_fh = fopen(path.c_str(), "rb");
-        posix_check(!m_fh, fmt::format("can't open '{:s}", path.string()));
         log_comp_hdr comp_hdr;
-        assert(fread(&comp_hdr, sizeof(comp_hdr), 1, m_fh) == 1);
+        read_raw((uint8_t *)&comp_hdr, sizeof(comp_hdr));
         assert(comp_hdr.magic == hdr_magic || hdr_magic == UINT64_MAX);
-        assert(comp_hdr.header_size == hdr_sz || hdr_sz == UINT64_MAX);
+        if (hdr_sz != UINT64_MAX && comp_hdr.header_size > hdr_sz) {
+            fmt::print(stderr,
+                       "'{:s}' was written by a newer version: {:d} byte header, this version "
+                       "reads up to {:d}\n",
+                       path.string(), (uint64_t)comp_hdr.header_size, hdr_sz);
+            exit(-1);
+        }
         m_hdr_sz      = comp_hdr.header_size;
         m_decomp_size = comp_hdr.decompressed_size;
         m_hdr_buf.resize(comp_hdr.header_size);
-        assert(fread(m_hdr_buf.data(), comp_hdr.header_size, 1, m_fh) == 1);
+        read_raw(m_hdr_buf.data(), comp_hdr.header_size);
+        if (comp_hdr.is_compressed && m_decomp_size == log_comp_hdr::unfinished_size) {
+            recover_from_footer();
+        }
+        // fields the older layout lacks read as 0, m_hdr_sz stays that of the file
+        if (hdr_sz != UINT64_MAX) {
+            m_hdr_buf.resize(hdr_sz);
+        }
         if (comp_hdr.is_compressed) {
             m_decomp_ctx = ZSTD_createDCtx();
             assert(m_decomp_ctx);
-            m_in_buf.resize(ZSTD_DStreamInSize());
-            m_out_buf.resize(ZSTD_DStreamOutSize());
+            if (m_dict) {
+                zstd_check(ZSTD_DCtx_refDDict(m_decomp_ctx, m_dict->ddict()), "ref ddict");
+            }
         }
     } else {
         assert(hdr);
         m_hdr_sz = hdr_sz;
         m_hdr_buf.resize(hdr_sz);
-        m_fh = fopen(path.c_str(), "wb");
-        posix_check(!m_fh, fmt::format("can't open '{:s}", path.string()));
-        log_comp_hdr comp_hdr{
-            .magic = hdr_magic, .is_compressed = level != 0, .header_size = hdr_sz};
-        assert(fwrite(&comp_hdr, sizeof(comp_hdr), 1, m_fh) == 1);
+        log_comp_hdr comp_hdr{.magic             = hdr_magic,
+                              .is_compressed     = level != 0,
+                              .header_size       = hdr_sz,
+                              .decompressed_size = level ? log_comp_hdr::unfinished_size : 0};
         memcpy(m_hdr_buf.data(), hdr, m_hdr_buf.size());
-        assert(fwrite(hdr, hdr_sz, 1, m_fh) == 1);
+        std::vector<uint8_t> hdrs(sizeof(comp_hdr) + hdr_sz);
+        memcpy(hdrs.data(), &comp_hdr, sizeof(comp_hdr));
+        memcpy(hdrs.data() + sizeof(comp_hdr), hdr, hdr_sz);
+        m_io->write(std::move(hdrs));
+        m_comp_off = sizeof(comp_hdr) + hdr_sz;
+        // the sidecar of a previous file at this path no longer matches
+        if (!is_seek_index_path(path)) {
+            fs::remove(seek_index_path(path));
+        }
+        // level 0 stages frames too so the backend isn't handed every small write
+        m_in_buf.resize(xnutrace_compression_scheduler.frame_size());
         if (level) {
-            m_comp_ctx = ZSTD_createCCtx();
-            assert(m_comp_ctx);
-            zstd_check(ZSTD_CCtx_setParameter(m_comp_ctx, ZSTD_c_compressionLevel, level),
-                       "zstd set compression level");
-            zstd_check(ZSTD_CCtx_setParameter(m_comp_ctx, ZSTD_c_checksumFlag, true),
-                       "zstd enable checksums");
-            if (num_threads < 1) {
-                num_threads = get_num_cores();
-            }
-            zstd_check(ZSTD_CCtx_setParameter(m_comp_ctx, ZSTD_c_nbWorkers, num_threads),
-                       "zstd set num threads");
-            m_in_buf.resize(ZSTD_CStreamInSize());
-            m_out_buf.resize(ZSTD_CStreamOutSize());
+            m_max_frames_in_flight = xnutrace_compression_scheduler.max_frames_in_flight();
         }
     }
 }
 
 CompressedFile::~CompressedFile() {
-    if (m_comp_ctx) {
-        bool done = false;
-        do {
-            ZSTD_inBuffer input{.src = nullptr, .size = 0};
-            ZSTD_outBuffer output{.dst = m_out_buf.data(), .size = m_out_buf.size()};
-            const auto remaining = ZSTD_compressStream2(m_comp_ctx, &output, &input, ZSTD_e_end);
-            zstd_check(remaining, "final write ZSTD_compressStream2");
-            ++m_num_zstd_ops;
-            if (output.pos) {
-                assert(fwrite(m_out_buf.data(), output.pos, 1, m_fh) == 1);
-                ++m_num_disk_ops;
-            }
-            done = remaining == 0;
-        } while (!done);
-        zstd_check(ZSTD_freeCCtx(m_comp_ctx), "zstd free comp ctx");
+    if (!m_is_read) {
+        if (m_in_pos) {
+            submit_frame();
+        }
+        write_frames(true);
     } else if (m_decomp_ctx) {
         zstd_check(ZSTD_freeDCtx(m_decomp_ctx), "zstd free decomp ctx");
     }
     if (!m_is_read) {
-        assert(!fseek(m_fh, offsetof(log_comp_hdr, decompressed_size), SEEK_SET));
-        assert(fwrite(&m_decomp_size, sizeof(m_decomp_size), 1, m_fh) == 1);
-        assert(!fseek(m_fh, sizeof(log_comp_hdr), SEEK_SET));
+        m_io->pwrite({(const uint8_t *)&m_decomp_size, sizeof(m_decomp_size)},
+                     offsetof(log_comp_hdr, decompressed_size));
         assert(m_hdr_sz == m_hdr_buf.size());
-        assert(fwrite(m_hdr_buf.data(), m_hdr_buf.size(), 1, m_fh) == 1);
-        assert(!fseek(m_fh, 0, SEEK_END));
-        const auto total_comp_sz = ftell(m_fh);
+        m_io->pwrite(m_hdr_buf, sizeof(log_comp_hdr));
+        if (!m_seek_points.empty()) {
+            write_seek_index();
+        }
+        const auto total_comp_sz = m_io->size();
         assert(total_comp_sz > 0);
         const auto comp_sz = total_comp_sz - (sizeof(log_comp_hdr) + m_hdr_buf.size());
         if (m_verbose) {
@@ -117,19 +143,24 @@ CompressedFile::~CompressedFile() {
                                    m_num_disk_ops ? (double)m_decomp_size / m_num_disk_ops : 0.0));
             fmt::print("{:s}\n",
                        fmt::format(std::locale("en_us.UTF-8"),
-                                   "Decompressed bytes / zstd op: {:0.3Lf}",
+                                   "Decompressed bytes / zstd frame: {:0.3Lf}",
                                    m_num_zstd_ops ? (double)m_decomp_size / m_num_zstd_ops : 0.0));
+            fmt::print("{:s}\n",
+                       fmt::format(
+                           std::locale("en_us.UTF-8"),
+                           "Writes / zstd frame: {:0.3Lf} ({:Ld} writes, {:Ld} zstd frames)",
+                           m_num_zstd_ops ? (double)m_num_writes / m_num_zstd_ops : 0.0,
+                           m_num_writes, m_num_zstd_ops));
             fmt::print("{:s}\n",
                        fmt::format(std::locale("en_us.UTF-8"),
-                                   "Ccompressed bytes / file op: {:0.3Lf}",
+                                   "Compressed bytes / file op: {:0.3Lf}",
                                    m_num_disk_ops ? (double)comp_sz / m_num_disk_ops : 0.0));
             fmt::print("{:s}\n",
                        fmt::format(std::locale("en_us.UTF-8"),
-                                   "Compressed bytes / zstd op: {:0.3Lf}",
+                                   "Compressed bytes / zstd frame: {:0.3Lf}",
                                    m_num_zstd_ops ? (double)comp_sz / m_num_zstd_ops : 0.0));
         }
     }
-    assert(!fclose(m_fh));
 }
 
 std::vector<uint8_t> CompressedFile::read() {
@@ -145,56 +176,256 @@ std::vector<uint8_t> CompressedFile::read(size_t size) {
 void CompressedFile::read(uint8_t *buf, size_t size) {
     assert(XNUTRACE_LIKELY(m_is_read));
     if (!m_decomp_ctx) {
-        assert(fread(buf, size, 1, m_fh) == 1);
-        ++m_num_disk_ops;
+        read_raw(buf, size);
     } else {
-        auto to_read        = size;
-        auto suggested_read = m_in_buf.size();
-        auto *out_ptr       = buf;
-        while (to_read) {
-            const auto comp_read = fread(m_in_buf.data(), 1, suggested_read, m_fh);
+        // the stream is a sequence of independent frames, decompress straight into the caller's
+        // buffer and only take the next block once zstd has consumed everything and made no
+        // progress
+        ZSTD_outBuffer output{.dst = buf, .size = size};
+        while (output.pos < output.size) {
+            ZSTD_inBuffer input{.src = m_in_block.data(), .size = m_in_block.size(), .pos = 0};
+            const auto out_pos = output.pos;
+            zstd_check(ZSTD_decompressStream(m_decomp_ctx, &output, &input),
+                       "read ZSTD_decompressStream");
+            ++m_num_zstd_ops;
+            m_in_block = m_in_block.subspan(input.pos);
+            if (output.pos == out_pos && m_in_block.empty()) {
+                m_in_block = m_io->next_block();
+                ++m_num_disk_ops;
+                assert(!m_in_block.empty());
+            }
+        }
+    }
+}
+
+void CompressedFile::read_raw(uint8_t *buf, size_t size) {
+    while (size) {
+        if (m_in_block.empty()) {
+            m_in_block = m_io->next_block();
             ++m_num_disk_ops;
-            assert(comp_read > 0);
-            ZSTD_inBuffer input{.src = m_in_buf.data(), .size = comp_read};
-            while (input.pos < input.size) {
-                ZSTD_outBuffer output{.dst = m_out_buf.data(), .size = m_out_buf.size()};
-                suggested_read = ZSTD_decompressStream(m_decomp_ctx, &output, &input);
-                zstd_check(suggested_read, "read ZSTD_decompressStream");
-                ++m_num_zstd_ops;
-                if (output.pos) {
-                    memcpy(out_ptr, m_out_buf.data(), output.pos);
-                }
-                out_ptr += output.pos;
-                to_read -= output.pos;
+            assert(!m_in_block.empty());
+        }
+        const auto sz = std::min(size, m_in_block.size());
+        memcpy(buf, m_in_block.data(), sz);
+        m_in_block = m_in_block.subspan(sz);
+        buf += sz;
+        size -= sz;
+    }
+}
+
+void CompressedFile::recover_from_footer() {
+    // scan back from the end in overlapping windows, the last footer is at most one checkpoint
+    // interval of compressed data away
+    const auto footer_sz = sizeof(log_comp_footer) + m_hdr_sz + sizeof(uint64_t);
+    const auto data_off  = sizeof(log_comp_hdr) + m_hdr_sz;
+    std::vector<uint8_t> window;
+    for (auto end = m_io->size(); end >= data_off + footer_sz;) {
+        const auto start = std::max<uint64_t>(data_off, end - std::min<uint64_t>(
+                                                                 end, FileIO::block_sz));
+        window.resize(end - start);
+        m_io->pread(window, start);
+        for (auto pos = window.size() - footer_sz + 1; pos-- > 0;) {
+            const auto ptr = window.data() + pos;
+            log_comp_footer footer;
+            memcpy(&footer, ptr, sizeof(footer));
+            if (footer.frame_magic != log_comp_footer::skippable_magic ||
+                footer.magic != log_comp_footer::footer_magic || footer.header_size != m_hdr_sz ||
+                footer.frame_size != footer_sz - offsetof(log_comp_footer, magic)) {
+                continue;
+            }
+            uint64_t checksum;
+            memcpy(&checksum, ptr + footer_sz - sizeof(checksum), sizeof(checksum));
+            if (checksum != fnv1a({ptr + offsetof(log_comp_footer, magic),
+                                   footer_sz - offsetof(log_comp_footer, magic) -
+                                       sizeof(checksum)})) {
+                continue;
             }
+            m_decomp_size = footer.decompressed_size;
+            memcpy(m_hdr_buf.data(), ptr + sizeof(footer), m_hdr_sz);
+            fmt::print(stderr, "'{:s}' is unfinished, recovered {:d} bytes up to its last footer\n",
+                       m_path.filename().string(), m_decomp_size);
+            return;
         }
+        if (start == data_off) {
+            break;
+        }
+        // a footer straddling the window start is found in the next one
+        end = start + footer_sz - 1;
     }
-    m_decomp_size += size;
+    fmt::print(stderr, "'{:s}' is unfinished and has no footer, nothing recovered\n",
+               m_path.filename().string());
+    m_decomp_size = 0;
 }
 
-void CompressedFile::write(std::span<const uint8_t> buf) {
-    assert(XNUTRACE_LIKELY(!m_is_read));
-    if (XNUTRACE_UNLIKELY(!m_comp_ctx)) {
-        assert(XNUTRACE_LIKELY(fwrite(buf.data(), buf.size(), 1, m_fh) == 1));
+void CompressedFile::submit_frame() {
+    const auto frame_sz = m_in_buf.size();
+    m_in_buf.resize(m_in_pos);
+    if (!m_level) {
+        m_io->write(std::move(m_in_buf));
         ++m_num_disk_ops;
+        m_in_buf = {};
+        m_in_buf.resize(frame_sz);
+        m_in_pos = 0;
+        return;
+    }
+    m_frames_in_flight.emplace_back(
+        xnutrace_compression_scheduler.submit(std::move(m_in_buf), m_level, m_dict));
+    ++m_num_zstd_ops;
+    if (!m_free_bufs.empty()) {
+        m_in_buf = std::move(m_free_bufs.back());
+        m_free_bufs.pop_back();
     } else {
-        ZSTD_inBuffer input{.src = buf.data(), .size = buf.size()};
-        bool done = false;
-        do {
-            ZSTD_outBuffer output{.dst = m_out_buf.data(), .size = m_out_buf.size()};
-            const auto remaining =
-                ZSTD_compressStream2(m_comp_ctx, &output, &input, ZSTD_e_continue);
-            // zstd_check(remaining, "write ZSTD_compressStream2"s);
-            assert(XNUTRACE_LIKELY(!ZSTD_isError(remaining)));
-            ++m_num_zstd_ops;
-            if (output.pos) {
-                assert(XNUTRACE_LIKELY(fwrite(m_out_buf.data(), output.pos, 1, m_fh) == 1));
-                ++m_num_disk_ops;
-            }
-            done = input.pos == input.size;
-        } while (!done);
+        m_in_buf = {};
+    }
+    m_in_buf.resize(frame_sz);
+    m_in_pos = 0;
+    write_frames(false);
+}
+
+void CompressedFile::write_frames(bool wait_all) {
+    // frames are written in submission order, only block when too many are in flight
+    while (!m_frames_in_flight.empty()) {
+        auto &front = m_frames_in_flight.front();
+        if (!wait_all && m_frames_in_flight.size() <= m_max_frames_in_flight &&
+            front.wait_for(std::chrono::seconds{0}) != std::future_status::ready) {
+            break;
+        }
+        auto frame = front.get();
+        m_frames_in_flight.pop_front();
+        // footers are queued as frames without decompressed bytes, whatever they cover has to be
+        // on disk before them or a crash could leave a footer behind a hole
+        const bool is_footer = frame.decompressed.empty();
+        if (is_footer) {
+            m_io->flush();
+        } else {
+            m_frame_offs.emplace_back(m_comp_off, m_frames_decomp_off);
+            m_frames_decomp_off += frame.decompressed.size();
+        }
+        m_comp_off += frame.compressed.size();
+        m_io->write(std::move(frame.compressed));
+        ++m_num_disk_ops;
+        if (!is_footer) {
+            m_free_bufs.emplace_back(std::move(frame.decompressed));
+        }
     }
+}
+
+void CompressedFile::write(std::span<const uint8_t> buf) {
+    assert(XNUTRACE_LIKELY(!m_is_read));
+    ++m_num_writes;
     m_decomp_size += buf.size();
+    if (XNUTRACE_LIKELY(buf.size() < m_in_buf.size() - m_in_pos)) {
+        memcpy(&m_in_buf[m_in_pos], buf.data(), buf.size());
+        m_in_pos += buf.size();
+        return;
+    }
+    while (!buf.empty()) {
+        const auto sz = std::min(buf.size(), m_in_buf.size() - m_in_pos);
+        memcpy(&m_in_buf[m_in_pos], buf.data(), sz);
+        m_in_pos += sz;
+        buf = buf.subspan(sz);
+        if (m_in_pos == m_in_buf.size()) {
+            submit_frame();
+        }
+    }
+}
+
+void CompressedFile::flush() {
+    assert(!m_is_read);
+    if (m_in_pos) {
+        submit_frame();
+    }
+    write_frames(true);
+    m_io->flush();
+}
+
+void CompressedFile::checkpoint() {
+    assert(!m_is_read);
+    if (!m_level) {
+        // no frames to put a footer between, the header is patched in place instead once the
+        // data it covers is on disk
+        flush();
+        m_io->pwrite({(const uint8_t *)&m_decomp_size, sizeof(m_decomp_size)},
+                     offsetof(log_comp_hdr, decompressed_size));
+        m_io->pwrite(m_hdr_buf, sizeof(log_comp_hdr));
+        return;
+    }
+    if (m_in_pos) {
+        submit_frame();
+    }
+    const auto footer_sz = sizeof(log_comp_footer) + m_hdr_buf.size() + sizeof(uint64_t);
+    const log_comp_footer footer{
+        .frame_magic       = log_comp_footer::skippable_magic,
+        .frame_size        = (uint32_t)(footer_sz - offsetof(log_comp_footer, magic)),
+        .magic             = log_comp_footer::footer_magic,
+        .decompressed_size = m_decomp_size,
+        .header_size       = m_hdr_buf.size()};
+    std::vector<uint8_t> buf(footer_sz);
+    memcpy(buf.data(), &footer, sizeof(footer));
+    memcpy(buf.data() + sizeof(footer), m_hdr_buf.data(), m_hdr_buf.size());
+    const auto checksum =
+        fnv1a({buf.data() + offsetof(log_comp_footer, magic),
+               footer_sz - offsetof(log_comp_footer, magic) - sizeof(uint64_t)});
+    memcpy(buf.data() + footer_sz - sizeof(checksum), &checksum, sizeof(checksum));
+    // queued behind the frames in flight so it lands after the data it describes
+    std::promise<compressed_frame> footer_frame;
+    footer_frame.set_value({.compressed = std::move(buf)});
+    m_frames_in_flight.emplace_back(footer_frame.get_future());
+    write_frames(false);
+}
+
+void CompressedFile::add_seek_point(uint64_t key, uint64_t decomp_off) {
+    assert(!m_is_read);
+    assert(m_seek_points.empty() || (m_seek_points.back().key <= key &&
+                                     m_seek_points.back().decomp_off <= decomp_off));
+    m_seek_points.emplace_back(seek_point{.key = key, .decomp_off = decomp_off});
+}
+
+void CompressedFile::write_seek_index() const {
+    const auto data_off = sizeof(log_comp_hdr) + m_hdr_sz;
+    std::vector<log_seek_index_entry> entries;
+    entries.reserve(m_seek_points.size());
+    for (const auto &point : m_seek_points) {
+        assert(point.decomp_off <= m_decomp_size);
+        auto &entry = entries.emplace_back(
+            log_seek_index_entry{.key = point.key, .decomp_off = point.decomp_off});
+        if (!m_level) {
+            entry.frame_comp_off   = data_off + point.decomp_off;
+            entry.frame_decomp_off = point.decomp_off;
+            continue;
+        }
+        // the last frame starting at or before the point
+        auto frame = std::upper_bound(m_frame_offs.begin(), m_frame_offs.end(), point.decomp_off,
+                                      [](uint64_t off, const auto &frame_off) {
+                                          return off < frame_off.second;
+                                      });
+        assert(frame != m_frame_offs.begin());
+        --frame;
+        entry.frame_comp_off   = frame->first;
+        entry.frame_decomp_off = frame->second;
+    }
+    const log_seek_index_hdr hdr{.num_entries = entries.size()};
+    ::CompressedFile<log_seek_index_hdr> fh{seek_index_path(m_path), false, &hdr, 0};
+    fh.write(entries.data(), entries.size() * sizeof(entries[0]));
+}
+
+void CompressedFile::seek(const log_seek_index_entry &entry) {
+    assert(m_is_read);
+    assert(entry.frame_decomp_off <= entry.decomp_off && entry.decomp_off <= m_decomp_size);
+    m_io->seek(entry.frame_comp_off);
+    m_in_block = {};
+    if (m_decomp_ctx) {
+        zstd_check(ZSTD_DCtx_reset(m_decomp_ctx, ZSTD_reset_session_only),
+                   "seek ZSTD_DCtx_reset");
+    }
+    // frames only decompress from their start, what comes before the point is dropped
+    auto left = entry.decomp_off - entry.frame_decomp_off;
+    std::vector<uint8_t> skipped(std::min<uint64_t>(left, FileIO::block_sz));
+    while (left) {
+        const auto sz = std::min<uint64_t>(left, skipped.size());
+        read(skipped.data(), sz);
+        left -= sz;
+    }
 }
 
 void CompressedFile::write(const void *buf, size_t size) {
@@ -213,8 +444,55 @@ size_t CompressedFile::decompressed_size() const {
     return m_decomp_size;
 }
 
+bool CompressedFile::is_compressed() const {
+    return m_is_read ? m_decomp_ctx != nullptr : m_level != 0;
+}
+
+std::shared_ptr<const MappedFile> CompressedFile::map() const {
+    assert(m_is_read && !m_decomp_ctx);
+    return std::make_shared<MappedFile>(m_path, sizeof(log_comp_hdr) + m_hdr_sz, m_decomp_size);
+}
+
+uint64_t CompressedFile::num_writes() const {
+    return m_num_writes;
+}
+
+uint64_t CompressedFile::num_zstd_ops() const {
+    return m_num_zstd_ops;
+}
+
+uint64_t CompressedFile::num_disk_ops() const {
+    return m_num_disk_ops;
+}
+
 const std::vector<uint8_t> &CompressedFile::header_buf() const {
     return m_hdr_buf;
 }
 
 } // namespace jev::xnutrace::detail
+
+SeekIndex::SeekIndex(const fs::path &file_path) {
+    const auto path = seek_index_path(file_path);
+    if (!fs::exists(path)) {
+        return;
+    }
+    CompressedFile<log_seek_index_hdr> fh{path, true};
+    m_entries.resize(fh.header().num_entries);
+    fh.read((uint8_t *)m_entries.data(), m_entries.size() * sizeof(m_entries[0]));
+}
+
+bool SeekIndex::empty() const {
+    return m_entries.empty();
+}
+
+std::span<const log_seek_index_entry> SeekIndex::entries() const {
+    return m_entries;
+}
+
+const log_seek_index_entry *SeekIndex::find(uint64_t key) const {
+    const auto it = std::upper_bound(m_entries.begin(), m_entries.end(), key,
+                                     [](uint64_t k, const log_seek_index_entry &entry) {
+                                         return k < entry.key;
+                                     });
+    return it == m_entries.begin() ? nullptr : &*(it - 1);
+}
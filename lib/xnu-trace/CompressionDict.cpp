@@ -0,0 +1,133 @@
+#include "xnu-trace/CompressionDict.h"
+#include "common-internal.h"
+
+#include "xnu-trace/CompressedFile.h"
+#include "xnu-trace/ThreadContextIndex.h"
+#include "xnu-trace/log_structs.h"
+#include "xnu-trace/utils.h"
+
+#include <zdict.h>
+#include <zstd.h>
+
+CompressionDict::CompressionDict(std::vector<uint8_t> &&dict) : m_dict{std::move(dict)} {
+    m_id = ZDICT_getDictID(m_dict.data(), m_dict.size());
+    assert(m_id);
+    m_ddict = ZSTD_createDDict(m_dict.data(), m_dict.size());
+    assert(m_ddict);
+}
+
+CompressionDict::~CompressionDict() {
+    for (const auto &[level, cdict] : m_cdicts) {
+        ZSTD_freeCDict(cdict);
+    }
+    ZSTD_freeDDict(m_ddict);
+}
+
+std::unique_ptr<CompressionDict>
+CompressionDict::train(const std::vector<std::span<const uint8_t>> &samples, size_t dict_sz) {
+    std::vector<uint8_t> samples_buf;
+    std::vector<size_t> sample_szs;
+    sample_szs.reserve(samples.size());
+    for (const auto &sample : samples) {
+        samples_buf.insert(samples_buf.end(), sample.begin(), sample.end());
+        sample_szs.emplace_back(sample.size());
+    }
+    std::vector<uint8_t> dict(dict_sz);
+    const auto res = ZDICT_trainFromBuffer(dict.data(), dict.size(), samples_buf.data(),
+                                           sample_szs.data(), (unsigned)sample_szs.size());
+    if (ZDICT_isError(res)) {
+        fmt::print(stderr, "Dictionary training failed on {:d} samples: '{:s}'\n",
+                   sample_szs.size(), ZDICT_getErrorName(res));
+        return nullptr;
+    }
+    dict.resize(res);
+    return std::make_unique<CompressionDict>(std::move(dict));
+}
+
+std::unique_ptr<CompressionDict>
+CompressionDict::train_from_bundles(const std::vector<std::filesystem::path> &bundle_dirs,
+                                    size_t dict_sz, size_t sample_sz) {
+    assert(sample_sz);
+    struct thread_file {
+        fs::path path;
+        std::shared_ptr<const CompressionDict> dict;
+    };
+    std::vector<thread_file> files;
+    size_t total_sz = 0;
+    for (const auto &dir : bundle_dirs) {
+        const std::shared_ptr<const CompressionDict> dict = read_sidecar(dir);
+        for (const auto &dirent : fs::directory_iterator{dir}) {
+            const auto fn = dirent.path().filename();
+            if (!fn.string().starts_with("thread-") || is_seek_index_path(fn) ||
+                is_gpr_checkpoints_path(fn)) {
+                continue;
+            }
+            CompressedFile<log_thread_hdr> fh{dirent.path(), true, nullptr, 0, false, dict.get()};
+            files.emplace_back(dirent.path(), dict);
+            total_sz += fh.decompressed_size();
+        }
+    }
+
+    // every stride'th piece of the concatenated thread files, copied out so only one file is
+    // held in memory at a time
+    const auto budget = dict_sz * 100;
+    const auto stride = std::max<size_t>(1, total_sz / budget) * sample_sz;
+    std::vector<uint8_t> samples_buf;
+    size_t next = 0;
+    size_t base = 0;
+    for (const auto &file : files) {
+        CompressedFile<log_thread_hdr> fh{file.path, true, nullptr, 0, false, file.dict.get()};
+        const auto buf = fh.read();
+        for (; next + sample_sz <= base + buf.size(); next += stride) {
+            const auto sample = buf.begin() + (next - base);
+            samples_buf.insert(samples_buf.end(), sample, sample + sample_sz);
+        }
+        // pieces never straddle files
+        base += buf.size();
+        next = std::max(next, base);
+    }
+    std::vector<std::span<const uint8_t>> samples;
+    for (size_t off = 0; off < samples_buf.size(); off += sample_sz) {
+        samples.emplace_back(samples_buf.data() + off, sample_sz);
+    }
+    return train(samples, dict_sz);
+}
+
+std::unique_ptr<CompressionDict> CompressionDict::read(const std::filesystem::path &path) {
+    return std::make_unique<CompressionDict>(read_file(path));
+}
+
+std::unique_ptr<CompressionDict>
+CompressionDict::read_sidecar(const std::filesystem::path &bundle_dir) {
+    const auto path = bundle_dir / sidecar_name;
+    if (!fs::exists(path)) {
+        return nullptr;
+    }
+    return read(path);
+}
+
+void CompressionDict::write(const std::filesystem::path &path) const {
+    write_file(path, m_dict.data(), m_dict.size());
+}
+
+uint32_t CompressionDict::id() const {
+    return m_id;
+}
+
+std::span<const uint8_t> CompressionDict::data() const {
+    return m_dict;
+}
+
+const ZSTD_CDict_s *CompressionDict::cdict(int level) const {
+    std::lock_guard lock{m_cdicts_mutex};
+    auto &cdict = m_cdicts[level];
+    if (!cdict) {
+        cdict = ZSTD_createCDict(m_dict.data(), m_dict.size(), level);
+        assert(cdict);
+    }
+    return cdict;
+}
+
+const ZSTD_DDict_s *CompressionDict::ddict() const {
+    return m_ddict;
+}
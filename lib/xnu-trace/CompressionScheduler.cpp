@@ -0,0 +1,69 @@
+#include "xnu-trace/CompressionScheduler.h"
+#include "common-internal.h"
+
+#include "xnu-trace/CompressionDict.h"
+#include "xnu-trace/utils.h"
+
+#include <memory>
+
+#include <zstd.h>
+
+namespace {
+struct cctx_deleter {
+    void operator()(ZSTD_CCtx *ctx) const {
+        ZSTD_freeCCtx(ctx);
+    }
+};
+} // namespace
+
+CompressionScheduler xnutrace_compression_scheduler;
+
+CompressionScheduler::CompressionScheduler() : m_pool{get_num_cores()} {}
+
+void CompressionScheduler::set_num_workers(unsigned int num_workers) {
+    m_pool.reset(num_workers ? num_workers : get_num_cores());
+}
+
+unsigned int CompressionScheduler::num_workers() const {
+    return m_pool.get_thread_count();
+}
+
+void CompressionScheduler::set_frame_size(size_t frame_sz) {
+    assert(frame_sz);
+    m_frame_sz = frame_sz;
+}
+
+size_t CompressionScheduler::frame_size() const {
+    return m_frame_sz;
+}
+
+void CompressionScheduler::set_max_frames_in_flight(size_t max_frames) {
+    assert(max_frames);
+    m_max_frames_in_flight = max_frames;
+}
+
+size_t CompressionScheduler::max_frames_in_flight() const {
+    return m_max_frames_in_flight;
+}
+
+std::future<compressed_frame> CompressionScheduler::submit(std::vector<uint8_t> &&buf, int level,
+                                                          const CompressionDict *dict) {
+    return m_pool.submit([buf = std::move(buf), level, dict]() mutable {
+        // one context per worker, reused across files and levels
+        thread_local std::unique_ptr<ZSTD_CCtx, cctx_deleter> cctx{ZSTD_createCCtx()};
+        assert(cctx);
+        compressed_frame frame{.decompressed = std::move(buf)};
+        frame.compressed.resize(ZSTD_compressBound(frame.decompressed.size()));
+        assert(!ZSTD_isError(
+            ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_compressionLevel, level)));
+        assert(!ZSTD_isError(ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_checksumFlag, true)));
+        // the level is baked into the digested dictionary, nullptr drops a previous file's one
+        assert(!ZSTD_isError(ZSTD_CCtx_refCDict(cctx.get(), dict ? dict->cdict(level) : nullptr)));
+        const auto comp_sz =
+            ZSTD_compress2(cctx.get(), frame.compressed.data(), frame.compressed.size(),
+                           frame.decompressed.data(), frame.decompressed.size());
+        assert(!ZSTD_isError(comp_sz));
+        frame.compressed.resize(comp_sz);
+        return frame;
+    });
+}
@@ -0,0 +1,275 @@
+#include "xnu-trace/FileIO.h"
+#include "common-internal.h"
+
+#include "xnu-trace/utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <BS_thread_pool.hpp>
+
+namespace {
+
+std::atomic<file_io_backend> default_io_backend{file_io_backend::threaded};
+std::atomic<size_t> io_max_blocks_in_flight{FileIO::default_max_blocks_in_flight};
+
+// shared by every threaded file, the workers mostly sleep in the kernel
+BS::thread_pool &io_pool() {
+    static BS::thread_pool pool{std::max(4u, get_num_cores() / 2)};
+    return pool;
+}
+
+void pwrite_all(int fd, const uint8_t *buf, size_t size, uint64_t off) {
+    while (size) {
+        const auto res = ::pwrite(fd, buf, size, (off_t)off);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        posix_check(res <= 0, "pwrite");
+        buf += res;
+        size -= res;
+        off += res;
+    }
+}
+
+void pread_all(int fd, uint8_t *buf, size_t size, uint64_t off) {
+    while (size) {
+        const auto res = ::pread(fd, buf, size, (off_t)off);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        posix_check(res <= 0, "pread");
+        buf += res;
+        size -= res;
+        off += res;
+    }
+}
+
+class StdioFileIO final : public FileIO {
+public:
+    StdioFileIO(const fs::path &path, bool read) {
+        m_fh = fopen(path.c_str(), read ? "rb" : "wb");
+        posix_check(!m_fh, fmt::format("can't open '{:s}'", path.string()));
+        if (read) {
+            m_size = fs::file_size(path);
+        }
+    }
+    ~StdioFileIO() override {
+        assert(!fclose(m_fh));
+    }
+
+    void write(std::vector<uint8_t> &&buf) override {
+        if (buf.empty()) {
+            return;
+        }
+        assert(fwrite(buf.data(), buf.size(), 1, m_fh) == 1);
+        m_size += buf.size();
+    }
+    void pwrite(std::span<const uint8_t> buf, uint64_t off) override {
+        assert(!fseek(m_fh, (long)off, SEEK_SET));
+        assert(fwrite(buf.data(), buf.size(), 1, m_fh) == 1);
+        assert(!fseek(m_fh, 0, SEEK_END));
+    }
+    void flush() override {
+        assert(!fflush(m_fh));
+    }
+    std::span<const uint8_t> next_block() override {
+        m_block.resize(block_sz);
+        const auto sz = fread(m_block.data(), 1, m_block.size(), m_fh);
+        return {m_block.data(), sz};
+    }
+    void seek(uint64_t off) override {
+        assert(!fseek(m_fh, (long)off, SEEK_SET));
+    }
+    void pread(std::span<uint8_t> buf, uint64_t off) override {
+        const auto pos = ftell(m_fh);
+        assert(pos >= 0);
+        assert(!fseek(m_fh, (long)off, SEEK_SET));
+        assert(fread(buf.data(), buf.size(), 1, m_fh) == 1);
+        assert(!fseek(m_fh, pos, SEEK_SET));
+    }
+    uint64_t size() const override {
+        return m_size;
+    }
+
+private:
+    FILE *m_fh{};
+    uint64_t m_size{};
+    std::vector<uint8_t> m_block;
+};
+
+class ThreadedFileIO final : public FileIO {
+public:
+    ThreadedFileIO(const fs::path &path, bool read)
+        : m_max_in_flight{FileIO::max_blocks_in_flight()} {
+        m_fd = ::open(path.c_str(), read ? O_RDONLY : O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        posix_check(m_fd < 0, fmt::format("can't open '{:s}'", path.string()));
+        if (read) {
+            struct stat st;
+            posix_check(fstat(m_fd, &st), fmt::format("can't stat '{:s}'", path.string()));
+            m_size = st.st_size;
+        }
+    }
+    ~ThreadedFileIO() override {
+        flush();
+        // read-ahead past the point the reader stopped at still uses the fd
+        for (auto &block : m_reads) {
+            block.wait();
+        }
+        posix_check(close(m_fd), "close");
+    }
+
+    void write(std::vector<uint8_t> &&buf) override {
+        if (buf.empty()) {
+            return;
+        }
+        // every write knows its offset up front so they can complete in any order
+        const auto off = m_size;
+        m_size += buf.size();
+        m_writes.emplace_back(io_pool().submit([fd = m_fd, buf = std::move(buf), off] {
+            pwrite_all(fd, buf.data(), buf.size(), off);
+        }));
+        while (!m_writes.empty() &&
+               (m_writes.size() > m_max_in_flight ||
+                m_writes.front().wait_for(std::chrono::seconds{0}) == std::future_status::ready)) {
+            m_writes.front().get();
+            m_writes.pop_front();
+        }
+    }
+    void pwrite(std::span<const uint8_t> buf, uint64_t off) override {
+        flush();
+        pwrite_all(m_fd, buf.data(), buf.size(), off);
+    }
+    void flush() override {
+        for (auto &write : m_writes) {
+            write.get();
+        }
+        m_writes.clear();
+    }
+    std::span<const uint8_t> next_block() override {
+        read_ahead();
+        if (m_reads.empty()) {
+            return {};
+        }
+        if (!m_block.empty()) {
+            m_free_blocks.emplace_back(std::move(m_block));
+        }
+        m_block = m_reads.front().get();
+        m_reads.pop_front();
+        // the following blocks are read while the caller consumes this one
+        read_ahead();
+        return m_block;
+    }
+    void seek(uint64_t off) override {
+        for (auto &block : m_reads) {
+            m_free_blocks.emplace_back(block.get());
+        }
+        m_reads.clear();
+        m_read_off = off;
+    }
+    void pread(std::span<uint8_t> buf, uint64_t off) override {
+        pread_all(m_fd, buf.data(), buf.size(), off);
+    }
+    uint64_t size() const override {
+        return m_size;
+    }
+
+private:
+    void read_ahead() {
+        while (m_reads.size() < m_max_in_flight && m_read_off < m_size) {
+            const auto off = m_read_off;
+            const auto sz  = std::min<uint64_t>(block_sz, m_size - off);
+            m_read_off += sz;
+            std::vector<uint8_t> buf;
+            if (!m_free_blocks.empty()) {
+                buf = std::move(m_free_blocks.back());
+                m_free_blocks.pop_back();
+            }
+            m_reads.emplace_back(
+                io_pool().submit([fd = m_fd, buf = std::move(buf), sz, off]() mutable {
+                    buf.resize(sz);
+                    pread_all(fd, buf.data(), sz, off);
+                    return std::move(buf);
+                }));
+        }
+    }
+
+    int m_fd{-1};
+    const size_t m_max_in_flight;
+    uint64_t m_size{};
+    uint64_t m_read_off{};
+    std::deque<std::future<void>> m_writes;
+    std::deque<std::future<std::vector<uint8_t>>> m_reads;
+    std::vector<uint8_t> m_block;
+    std::vector<std::vector<uint8_t>> m_free_blocks;
+};
+
+} // namespace
+
+std::unique_ptr<FileIO> FileIO::open(const fs::path &path, bool read) {
+    return open(path, read, default_backend());
+}
+
+std::unique_ptr<FileIO> FileIO::open(const fs::path &path, bool read, file_io_backend backend) {
+    switch (backend) {
+    case file_io_backend::stdio:
+        return std::make_unique<StdioFileIO>(path, read);
+    case file_io_backend::threaded:
+        return std::make_unique<ThreadedFileIO>(path, read);
+    }
+    assert(!"unknown file_io_backend");
+    return nullptr;
+}
+
+void FileIO::set_default_backend(file_io_backend backend) {
+    default_io_backend = backend;
+}
+
+file_io_backend FileIO::default_backend() {
+    return default_io_backend;
+}
+
+void FileIO::set_max_blocks_in_flight(size_t max_blocks) {
+    assert(max_blocks);
+    io_max_blocks_in_flight = max_blocks;
+}
+
+size_t FileIO::max_blocks_in_flight() {
+    return io_max_blocks_in_flight;
+}
+
+MappedFile::MappedFile(const fs::path &path, uint64_t off, uint64_t size) {
+    if (!size) {
+        return;
+    }
+    const auto fd = ::open(path.c_str(), O_RDONLY);
+    posix_check(fd < 0, fmt::format("can't open '{:s}'", path.string()));
+    // the mapping has to start on a page boundary, the headers in front of off come along
+    const auto map_off = rounddown_pow2_mul(off, (uint64_t)getpagesize());
+    m_map_sz           = size + (off - map_off);
+    m_map              = mmap(nullptr, m_map_sz, PROT_READ, MAP_PRIVATE, fd, (off_t)map_off);
+    posix_check(m_map == MAP_FAILED, fmt::format("can't map '{:s}'", path.string()));
+    posix_check(close(fd), "close");
+    // hints only, their failure doesn't matter
+    madvise(m_map, m_map_sz, MADV_SEQUENTIAL);
+    madvise(m_map, m_map_sz, MADV_WILLNEED);
+    m_data = {(const uint8_t *)m_map + (off - map_off), size};
+}
+
+MappedFile::~MappedFile() {
+    if (m_map) {
+        posix_check(munmap(m_map, m_map_sz), "munmap");
+    }
+}
+
+std::span<const uint8_t> MappedFile::data() const {
+    return m_data;
+}
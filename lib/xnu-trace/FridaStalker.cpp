@@ -11,21 +11,24 @@
 #include <frida-gum.h>
 
 FridaStalker::FridaStalker(const std::string &log_dir_path, bool symbolicate, int compression_level,
-                           bool stream)
-    : m_log{log_dir_path, compression_level, stream}, m_macho_regions{mach_task_self()},
+                           bool stream, const trace_log_opts &log_opts)
+    : m_log{log_dir_path, compression_level, stream, log_opts}, m_macho_regions{mach_task_self()},
       m_vm_regions{mach_task_self()} {
     gum_init_embedded();
     assert(gum_stalker_is_supported());
     m_stalker = gum_stalker_new();
     assert(m_stalker);
     gum_stalker_set_trust_threshold(m_stalker, 0);
-    cb_ctx.logger = &logger();
+    cb_ctx.logger       = &logger();
+    cb_ctx.mem_accesses = log_opts.mem_accesses;
     m_transformer = gum_stalker_transformer_make_from_callback(
         (GumStalkerTransformerCallback)transform_cb, (void *)&cb_ctx, nullptr);
     assert(m_transformer);
     if (symbolicate) {
         m_symbols = std::make_unique<Symbols>(mach_task_self());
     }
+    // a stream that is never finished is still readable with the images loaded up to here
+    logger().write_stream_meta(m_macho_regions, m_symbols.get());
 }
 
 FridaStalker::~FridaStalker() {
@@ -68,8 +71,19 @@ void FridaStalker::transform_cb(void *iterator, void *output, void *user_data) {
     auto cb_ctx = (CBCtx *)user_data;
     cs_insn *insn;
     while (gum_stalker_iterator_next(it, (const cs_insn **)&insn)) {
-        cb_ctx->insn = insn;
-        gum_stalker_iterator_put_callout(it, (GumStalkerCallout)instruction_cb, user_data, nullptr);
+        std::optional<arm64_mem_insn> mem_insn;
+        if (cb_ctx->mem_accesses) {
+            mem_insn = arm64_mem_insn::decode(insn);
+        }
+        if (mem_insn) {
+            gum_stalker_iterator_put_callout(
+                it, (GumStalkerCallout)mem_instruction_cb,
+                new MemCBCtx{.logger = cb_ctx->logger, .mem_insn = *mem_insn},
+                (GDestroyNotify)destroy_mem_cb_ctx);
+        } else {
+            gum_stalker_iterator_put_callout(it, (GumStalkerCallout)instruction_cb, user_data,
+                                             nullptr);
+        }
         gum_stalker_iterator_keep(it);
     }
 }
@@ -84,10 +98,20 @@ void FridaStalker::instruction_cb(void *context, void *user_data) {
 void FridaStalker::instruction_cb(void *context, void *user_data) {
     const auto ctx = (log_arm64_cpu_context *)context;
     auto cb_ctx    = (CBCtx *)user_data;
-    cb_ctx->logger->log((uint32_t)gum_process_get_current_thread_id(), ctx, cb_ctx->insn);
+    cb_ctx->logger->log((uint32_t)gum_process_get_current_thread_id(), ctx, nullptr);
 }
 #endif
 
+void FridaStalker::mem_instruction_cb(void *context, void *user_data) {
+    const auto ctx = (log_arm64_cpu_context *)context;
+    auto cb_ctx    = (MemCBCtx *)user_data;
+    cb_ctx->logger->log((uint32_t)gum_process_get_current_thread_id(), ctx, &cb_ctx->mem_insn);
+}
+
+void FridaStalker::destroy_mem_cb_ctx(void *user_data) {
+    delete (MemCBCtx *)user_data;
+}
+
 // C API
 
 stalker_t create_stalker(const char *log_dir_path, int symbolicate, int compression_level,
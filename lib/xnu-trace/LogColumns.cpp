@@ -0,0 +1,182 @@
+#include "xnu-trace/LogColumns.h"
+#include "common-internal.h"
+
+#include <string_view>
+
+namespace {
+
+constexpr std::string_view column_names[log_column_num] = {"pc", "sp", "gpr", "vec"};
+
+// bytes taken by an absolute or varint delta PC/SP at ptr
+size_t pc_sp_size(const uint8_t *ptr, bool delta) {
+    if (XNUTRACE_LIKELY(!delta)) {
+        return sizeof(uint64_t);
+    }
+    size_t sz;
+    varint_decode(ptr, &sz);
+    return sz;
+}
+
+} // namespace
+
+fs::path log_column_path(const fs::path &thread_path, log_column column) {
+    auto res = thread_path;
+    res.replace_extension(fmt::format(".{:s}{:s}", column_names[(size_t)column],
+                                      thread_path.extension().string()));
+    return res;
+}
+
+bool is_log_column_path(const fs::path &path) {
+    const auto column = path.stem().extension().string();
+    for (const auto name : column_names) {
+        if (column.size() == name.size() + 1 && column.ends_with(name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void split_log_msgs(std::span<const uint8_t> v1, std::vector<uint8_t> &hdrs,
+                    log_column_bufs_t &columns) {
+    const auto end = v1.data() + v1.size();
+    for (auto ptr = v1.data(); ptr < end;) {
+        const auto &msg   = *(const log_msg *)ptr;
+        const auto msg_sz = msg.size();
+        if (XNUTRACE_UNLIKELY(msg.is_sync_frame())) {
+            hdrs.insert(hdrs.end(), ptr, ptr + msg_sz);
+            ptr += msg_sz;
+            continue;
+        }
+        hdrs.insert(hdrs.end(), ptr, ptr + sizeof(log_msg));
+        auto field        = ptr + sizeof(log_msg);
+        const auto append = [&](log_column column, size_t sz) {
+            auto &buf = columns[(size_t)column];
+            buf.insert(buf.end(), field, field + sz);
+            field += sz;
+        };
+        const auto pc_sz = msg.pc_size();
+        append(log_column::pc, pc_sz);
+        append(log_column::sp, msg.fixed_size() - pc_sz);
+        append(log_column::gpr, msg.num_gpr() * sizeof(uint64_t));
+        append(log_column::vec, ptr + msg_sz - field);
+        ptr += msg_sz;
+    }
+}
+
+std::array<size_t, log_column_num> join_log_msgs(std::span<const uint8_t> hdrs,
+                                                 const log_column_spans_t &columns,
+                                                 std::vector<uint8_t> &out) {
+    std::array<const uint8_t *, log_column_num> col_ptrs;
+    for (size_t i = 0; i < log_column_num; ++i) {
+        col_ptrs[i] = columns[i].data();
+    }
+    const auto take = [&](log_column column, size_t sz) {
+        auto &col = col_ptrs[(size_t)column];
+        out.insert(out.end(), col, col + sz);
+        col += sz;
+    };
+
+    const auto end = hdrs.data() + hdrs.size();
+    for (auto ptr = hdrs.data(); ptr < end;) {
+        // only the header fields are valid, the payload lives in the columns
+        const auto &hdr = *(const log_msg *)ptr;
+        if (XNUTRACE_UNLIKELY(hdr.is_sync_frame())) {
+            out.insert(out.end(), ptr, ptr + log_msg::size_full_ctx);
+            ptr += log_msg::size_full_ctx;
+            continue;
+        }
+        out.insert(out.end(), ptr, ptr + sizeof(log_msg));
+        ptr += sizeof(log_msg);
+        const bool delta = hdr.pc_sp_delta();
+        if (hdr.pc_branched()) {
+            take(log_column::pc, pc_sp_size(col_ptrs[(size_t)log_column::pc], delta));
+        }
+        if (hdr.sp_changed()) {
+            take(log_column::sp, pc_sp_size(col_ptrs[(size_t)log_column::sp], delta));
+        }
+        take(log_column::gpr, hdr.num_gpr() * sizeof(uint64_t));
+        auto vec_sz = hdr.num_vec() * sizeof(uint128_t);
+        if (hdr.has_mem()) {
+            vec_sz += log_msg::mem_section_size(col_ptrs[(size_t)log_column::vec] + vec_sz);
+        }
+        take(log_column::vec, vec_sz);
+    }
+    std::array<size_t, log_column_num> res;
+    for (size_t i = 0; i < log_column_num; ++i) {
+        res[i] = col_ptrs[i] - columns[i].data();
+        assert(res[i] <= columns[i].size());
+    }
+    return res;
+}
+
+size_t join_pc_log_msgs(std::span<const uint8_t> hdrs, std::span<const uint8_t> pcs,
+                        std::vector<uint8_t> &out) {
+    auto pc_ptr    = pcs.data();
+    const auto end = hdrs.data() + hdrs.size();
+    for (auto ptr = hdrs.data(); ptr < end;) {
+        const auto &hdr = *(const log_msg *)ptr;
+        if (XNUTRACE_UNLIKELY(hdr.is_sync_frame())) {
+            out.insert(out.end(), ptr, ptr + log_msg::size_full_ctx);
+            ptr += log_msg::size_full_ctx;
+            continue;
+        }
+        ptr += sizeof(log_msg);
+        log_msg msg{.gpr_changed = 0, .vec_changed = 0};
+        if (hdr.is_bb_run()) {
+            msg.gpr_changed = rpc_set_bb_run(msg.gpr_changed);
+            msg.vec_changed = hdr.bb_run_len();
+        }
+        if (hdr.pc_sp_delta()) {
+            msg.vec_changed = rpc_set_pc_sp_delta(msg.vec_changed);
+        }
+        size_t pc_sz = 0;
+        if (hdr.pc_branched()) {
+            msg.gpr_changed = rpc_set_pc_branched(msg.gpr_changed);
+            pc_sz           = pc_sp_size(pc_ptr, hdr.pc_sp_delta());
+        }
+        out.insert(out.end(), (const uint8_t *)&msg, (const uint8_t *)&msg + sizeof(msg));
+        out.insert(out.end(), pc_ptr, pc_ptr + pc_sz);
+        pc_ptr += pc_sz;
+    }
+    assert(pc_ptr <= pcs.data() + pcs.size());
+    return pc_ptr - pcs.data();
+}
+
+LogColumnWriter::LogColumnWriter(const fs::path &thread_path, const log_thread_hdr &hdr,
+                                 int level, const CompressionDict *dict) {
+    for (size_t i = 0; i < log_column_num; ++i) {
+        m_files[i] = std::make_unique<CompressedFile<log_thread_hdr>>(
+            log_column_path(thread_path, (log_column)i), false, &hdr, level, false, dict);
+    }
+    m_staged.reserve(stage_sz);
+}
+
+LogColumnWriter::~LogColumnWriter() {
+    flush();
+}
+
+void LogColumnWriter::write(jev::xnutrace::detail::CompressedFile &thread_file,
+                            std::span<const uint8_t> v1) {
+    assert(!m_thread_file || m_thread_file == &thread_file);
+    m_thread_file = &thread_file;
+    m_staged.insert(m_staged.end(), v1.begin(), v1.end());
+    if (m_staged.size() >= stage_sz) {
+        flush();
+    }
+}
+
+void LogColumnWriter::flush() {
+    if (m_staged.empty()) {
+        return;
+    }
+    m_hdrs.clear();
+    for (auto &buf : m_bufs) {
+        buf.clear();
+    }
+    split_log_msgs(m_staged, m_hdrs, m_bufs);
+    m_thread_file->write(m_hdrs);
+    for (size_t i = 0; i < log_column_num; ++i) {
+        m_files[i]->write(m_bufs[i]);
+    }
+    m_staged.clear();
+}
@@ -0,0 +1,276 @@
+#include "xnu-trace/LogMsgV2.h"
+#include "common-internal.h"
+
+#include <limits>
+
+namespace {
+
+template <typename T> bool fits(int64_t val) {
+    return val >= std::numeric_limits<T>::min() && val <= std::numeric_limits<T>::max();
+}
+
+template <typename T> T load(const uint8_t *&ptr) {
+    T res;
+    memcpy(&res, ptr, sizeof(res));
+    ptr += sizeof(res);
+    return res;
+}
+
+template <typename T> void store(uint8_t *&ptr, T val) {
+    memcpy(ptr, &val, sizeof(val));
+    ptr += sizeof(val);
+}
+
+// v1 record size by v2 prefix, 0 where log_msg_v2_sizes is
+constexpr auto v1_sizes = [] {
+    std::array<uint8_t, 256> res{};
+    for (unsigned p = 0; p < res.size(); ++p) {
+        if (!log_msg_v2_sizes[p]) {
+            continue;
+        }
+        // header, then the branch target, SP and GPRs as 8 byte values
+        const auto n        = log_msg_v2::prefix_n(p);
+        const auto num_vals = (log_msg_v2::prefix_pc(p) != log_msg_v2::pc_seq) +
+                              (log_msg_v2::prefix_sp(p) != log_msg_v2::sp_same) +
+                              (n == log_msg_v2::n_bb_run ? 0 : n);
+        res[p]              = sizeof(log_msg) + num_vals * sizeof(uint64_t);
+    }
+    return res;
+}();
+
+// PC/SP after msg, both encoders and decoders track them to resolve relative values
+void advance(const log_msg &msg, uint64_t &pc, uint64_t &sp) {
+    if (const auto sync_ctx = msg.sync_ctx()) {
+        log_arm64_cpu_context ctx;
+        memcpy(&ctx, sync_ctx, sizeof(ctx));
+        pc = ctx.pc;
+        sp = ctx.sp;
+        return;
+    }
+    if (msg.pc_branched()) {
+        pc = msg.pc(pc) + (msg.bb_run_len() - 1) * 4;
+    } else {
+        pc += msg.bb_run_len() * 4;
+    }
+    if (msg.sp_changed()) {
+        sp = msg.sp(sp);
+    }
+}
+
+} // namespace
+
+void LogMsgV2Encoder::encode(std::span<const uint8_t> v1, std::vector<uint8_t> &out) {
+    const auto end = v1.data() + v1.size();
+    for (auto ptr = v1.data(); ptr < end;) {
+        const auto &msg   = *(const log_msg *)ptr;
+        const auto msg_sz = msg.size();
+        const bool is_run = msg.is_bb_run();
+        if (msg.is_sync_frame() || msg.num_vec() || msg.has_mem() ||
+            (is_run && msg.sp_changed())) {
+            out.emplace_back(log_msg_v2::escape);
+            out.insert(out.end(), ptr, ptr + msg_sz);
+            advance(msg, m_pc, m_sp);
+            ptr += msg_sz;
+            continue;
+        }
+
+        uint8_t buf[log_msg_v2::size_max];
+        uint8_t *buf_ptr = buf + 1;
+        uint8_t pc_kind  = log_msg_v2::pc_seq;
+        if (msg.pc_branched()) {
+            const auto pc    = msg.pc(m_pc);
+            const auto delta = (int64_t)(pc - m_pc);
+            if (delta % 4) {
+                pc_kind = log_msg_v2::pc_abs64;
+                store<uint64_t>(buf_ptr, pc);
+            } else if (fits<int8_t>(delta / 4)) {
+                pc_kind = log_msg_v2::pc_rel8;
+                store<int8_t>(buf_ptr, delta / 4);
+            } else if (fits<int16_t>(delta / 4)) {
+                pc_kind = log_msg_v2::pc_rel16;
+                store<int16_t>(buf_ptr, delta / 4);
+            } else if (fits<int32_t>(delta / 4)) {
+                pc_kind = log_msg_v2::pc_rel32;
+                store<int32_t>(buf_ptr, delta / 4);
+            } else {
+                pc_kind = log_msg_v2::pc_abs64;
+                store<uint64_t>(buf_ptr, pc);
+            }
+        }
+        uint8_t sp_kind = log_msg_v2::sp_same;
+        if (msg.sp_changed()) {
+            const auto sp    = msg.sp(m_sp);
+            const auto delta = (int64_t)(sp - m_sp);
+            if (fits<int8_t>(delta)) {
+                sp_kind = log_msg_v2::sp_rel8;
+                store<int8_t>(buf_ptr, delta);
+            } else if (fits<int32_t>(delta)) {
+                sp_kind = log_msg_v2::sp_rel32;
+                store<int32_t>(buf_ptr, delta);
+            } else {
+                sp_kind = log_msg_v2::sp_abs64;
+                store<uint64_t>(buf_ptr, sp);
+            }
+        }
+        uint8_t n;
+        if (is_run) {
+            n = log_msg_v2::n_bb_run;
+            store<uint32_t>(buf_ptr, msg.bb_run_len());
+        } else {
+            n = msg.num_gpr();
+            for (uint32_t i = 0; i < n; ++i) {
+                store<uint8_t>(buf_ptr, msg.gpr_idx(i));
+                store<uint64_t>(buf_ptr, msg.gpr(i));
+            }
+        }
+        buf[0] = log_msg_v2::prefix(pc_kind, sp_kind, n);
+        assert(buf_ptr - buf == log_msg_v2_sizes[buf[0]]);
+        out.insert(out.end(), buf, buf_ptr);
+        advance(msg, m_pc, m_sp);
+        ptr += msg_sz;
+    }
+}
+
+size_t LogMsgV2Decoder::decoded_size(std::span<const uint8_t> v2) {
+    const auto end = v2.data() + v2.size();
+    size_t res     = 0;
+    for (auto ptr = v2.data(); ptr < end;) {
+        const auto prefix = *ptr;
+        if (prefix == log_msg_v2::escape) {
+            const auto msg_sz = ((const log_msg *)(ptr + 1))->size();
+            res += msg_sz;
+            ptr += 1 + msg_sz;
+            continue;
+        }
+        assert(log_msg_v2_sizes[prefix]);
+        res += v1_sizes[prefix];
+        ptr += log_msg_v2_sizes[prefix];
+    }
+    return res;
+}
+
+void LogMsgV2Decoder::decode(std::span<const uint8_t> v2, std::vector<uint8_t> &out) {
+    const auto end = v2.data() + v2.size();
+    for (auto ptr = v2.data(); ptr < end;) {
+        const auto prefix = *ptr;
+        if (prefix == log_msg_v2::escape) {
+            const auto &msg   = *(const log_msg *)(ptr + 1);
+            const auto msg_sz = msg.size();
+            out.insert(out.end(), ptr + 1, ptr + 1 + msg_sz);
+            advance(msg, m_pc, m_sp);
+            ptr += 1 + msg_sz;
+            continue;
+        }
+        const auto sz = log_msg_v2_sizes[prefix];
+        assert(sz && ptr + sz <= end);
+        const auto pc_kind = log_msg_v2::prefix_pc(prefix);
+        const auto sp_kind = log_msg_v2::prefix_sp(prefix);
+        const auto n       = log_msg_v2::prefix_n(prefix);
+        const uint8_t *in  = ptr + 1;
+
+        uint8_t __attribute__((aligned(16))) buf[log_msg::size_max];
+        auto &msg            = *(log_msg *)buf;
+        uint8_t *buf_ptr     = buf + sizeof(log_msg);
+        uint32_t gpr_changed = 0;
+        uint32_t vec_changed = 0;
+        if (pc_kind != log_msg_v2::pc_seq) {
+            gpr_changed = rpc_set_pc_branched(gpr_changed);
+            uint64_t pc;
+            switch (pc_kind) {
+            case log_msg_v2::pc_rel8:
+                pc = m_pc + load<int8_t>(in) * 4;
+                break;
+            case log_msg_v2::pc_rel16:
+                pc = m_pc + load<int16_t>(in) * 4;
+                break;
+            case log_msg_v2::pc_rel32:
+                pc = m_pc + (int64_t)load<int32_t>(in) * 4;
+                break;
+            default:
+                pc = load<uint64_t>(in);
+                break;
+            }
+            store<uint64_t>(buf_ptr, pc);
+        }
+        if (sp_kind != log_msg_v2::sp_same) {
+            gpr_changed = rpc_set_sp_changed(gpr_changed);
+            uint64_t sp;
+            switch (sp_kind) {
+            case log_msg_v2::sp_rel8:
+                sp = m_sp + load<int8_t>(in);
+                break;
+            case log_msg_v2::sp_rel32:
+                sp = m_sp + load<int32_t>(in);
+                break;
+            default:
+                sp = load<uint64_t>(in);
+                break;
+            }
+            store<uint64_t>(buf_ptr, sp);
+        }
+        if (n == log_msg_v2::n_bb_run) {
+            gpr_changed = rpc_set_bb_run(gpr_changed);
+            vec_changed = load<uint32_t>(in);
+        } else {
+            gpr_changed = rpc_set_num_changed(gpr_changed, n);
+            for (uint32_t i = 0; i < n; ++i) {
+                gpr_changed = rpc_set_reg_idx(gpr_changed, i, load<uint8_t>(in));
+                store<uint64_t>(buf_ptr, load<uint64_t>(in));
+            }
+        }
+        msg.gpr_changed = gpr_changed;
+        msg.vec_changed = vec_changed;
+        out.insert(out.end(), buf, buf_ptr);
+        advance(msg, m_pc, m_sp);
+        ptr += sz;
+    }
+}
+
+void write_log_msg_chunks(jev::xnutrace::detail::CompressedFile &file,
+                          const std::vector<std::span<const uint8_t>> &chunks,
+                          record_format format, LogColumnWriter *columns,
+                          std::span<const seek_point> syncs) {
+    if (format == record_format::v1) {
+        const auto base = file.decompressed_size();
+        for (const auto &sync : syncs) {
+            file.add_seek_point(sync.key, base + sync.decomp_off);
+        }
+        for (const auto &chunk : chunks) {
+            file.write(chunk);
+        }
+        return;
+    }
+    if (format == record_format::columnar) {
+        assert(columns);
+        for (const auto &chunk : chunks) {
+            columns->write(file, chunk);
+        }
+        return;
+    }
+    // chunks are encoded in pieces that end at sync frames, their v2 offsets are only known
+    // once everything in front of them is encoded
+    LogMsgV2Encoder encoder;
+    std::vector<uint8_t> buf;
+    auto sync       = syncs.begin();
+    uint64_t v1_off = 0;
+    for (const auto &chunk : chunks) {
+        size_t pos = 0;
+        while (pos < chunk.size()) {
+            auto piece_end = chunk.size();
+            if (sync != syncs.end() && sync->decomp_off < v1_off + chunk.size()) {
+                piece_end = sync->decomp_off - v1_off;
+            }
+            if (piece_end == pos) {
+                file.add_seek_point(sync->key, file.decompressed_size());
+                ++sync;
+                continue;
+            }
+            buf.clear();
+            encoder.encode(chunk.subspan(pos, piece_end - pos), buf);
+            file.write(buf);
+            pos = piece_end;
+        }
+        v1_off += chunk.size();
+    }
+    assert(sync == syncs.end());
+}
@@ -0,0 +1,178 @@
+#include "xnu-trace/LogPcDecoder.h"
+#include "common-internal.h"
+
+#include "xnu-trace/TraceLog.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+struct pc_block {
+    uint32_t num_records;
+    uint64_t branched; // bit per record
+    // instruction counts, then the index of every record's first instruction in the block
+    alignas(16) std::array<uint32_t, pc_decode_block_sz> first_inst;
+    // branch targets, garbage where the record didn't branch
+    std::array<uint64_t, pc_decode_block_sz> targets;
+};
+
+XNUTRACE_INLINE bool is_block_record(uint32_t gpr_changed, uint32_t vec_changed) {
+    return !rpc_sync(gpr_changed) && !rpc_pc_sp_delta(vec_changed) &&
+           (rpc_bb_run(gpr_changed) || !rpc_mem(vec_changed));
+}
+
+// Fills blk from the records at p until the block is full, the chunk ends or a record needs
+// log_msg to decode. Returns the first record not in the block.
+XNUTRACE_INLINE const uint8_t *gather_block(const uint8_t *p, const uint8_t *end, pc_block &blk) {
+    blk.num_records = 0;
+    blk.branched    = 0;
+    while (blk.num_records < pc_decode_block_sz && p < end) {
+        uint32_t hdr[2];
+        memcpy(hdr, p, sizeof(hdr));
+        const auto gpr_changed = hdr[0];
+        const auto vec_changed = hdr[1];
+        if (XNUTRACE_UNLIKELY(!is_block_record(gpr_changed, vec_changed))) {
+            break;
+        }
+        const auto i       = blk.num_records++;
+        const bool is_jump = rpc_pc_branched(gpr_changed);
+        // the header stands in for a missing target so nothing past the record is read
+        memcpy(&blk.targets[i], p + is_jump * sizeof(log_msg), sizeof(uint64_t));
+        blk.first_inst[i] = rpc_bb_run(gpr_changed) ? vec_changed & rpc_bb_run_len_max : 1;
+        blk.branched |= (uint64_t)is_jump << i;
+        // a bb run keeps its length in the low bits of vec_changed, its vector count is always 0
+        p += log_msg_fixed_sizes[gpr_changed >> 25] +
+             rpc_num_changed(vec_changed) * sizeof(uint128_t);
+    }
+    return p;
+}
+
+// exclusive prefix sum of the instruction counts in place, returns the block's instructions
+XNUTRACE_INLINE uint32_t scan_block(pc_block &blk) {
+    static_assert(pc_decode_block_sz * (uint64_t)rpc_bb_run_len_max <= UINT32_MAX,
+                  "block instruction count overflows uint32_t");
+#if defined(__ARM_NEON)
+    // whole vectors, the lanes past the last record must not add to the total
+    for (uint32_t i = blk.num_records; i % 4; ++i) {
+        blk.first_inst[i] = 0;
+    }
+    const auto zero = vdupq_n_u32(0);
+    auto carry      = zero;
+    for (uint32_t i = 0; i < blk.num_records; i += 4) {
+        const auto counts = vld1q_u32(&blk.first_inst[i]);
+        auto sums         = vaddq_u32(counts, vextq_u32(zero, counts, 3));
+        sums              = vaddq_u32(sums, vextq_u32(zero, sums, 2));
+        sums              = vaddq_u32(sums, carry);
+        vst1q_u32(&blk.first_inst[i], vsubq_u32(sums, counts));
+        carry = vdupq_laneq_u32(sums, 3);
+    }
+    return vgetq_lane_u32(carry, 0);
+#else
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < blk.num_records; ++i) {
+        const auto count  = blk.first_inst[i];
+        blk.first_inst[i] = sum;
+        sum += count;
+    }
+    return sum;
+#endif
+}
+
+// out[i] = base + 4 * i for i in [lo, hi)
+XNUTRACE_INLINE void fill_pcs(uint64_t *out, uint64_t base, uint64_t lo, uint64_t hi) {
+    uint64_t i = lo;
+#if defined(__ARM_NEON)
+    if (hi - lo >= 4) {
+        uint64x2_t pcs_a  = {base + 4 * i, base + 4 * i + 4};
+        uint64x2_t pcs_b  = {base + 4 * i + 8, base + 4 * i + 12};
+        const auto stride = vdupq_n_u64(16);
+        for (; i + 4 <= hi; i += 4) {
+            vst1q_u64(&out[i], pcs_a);
+            vst1q_u64(&out[i + 2], pcs_b);
+            pcs_a = vaddq_u64(pcs_a, stride);
+            pcs_b = vaddq_u64(pcs_b, stride);
+        }
+    }
+#endif
+    for (; i < hi; ++i) {
+        out[i] = base + 4 * i;
+    }
+}
+
+// The PC of instruction i of the block is base + 4 * i, base only changes at branched records:
+// to target - 4 * first_inst. pc is the last PC before the block and advanced to its last one.
+XNUTRACE_INLINE void decode_block(const pc_block &blk, uint32_t num_inst, uint64_t &pc,
+                                  uint64_t *out) {
+    uint64_t base = pc + 4;
+    uint64_t lo   = 0;
+    for (auto branched = blk.branched; branched; branched &= branched - 1) {
+        const auto i     = std::countr_zero(branched);
+        const auto first = blk.first_inst[i];
+        fill_pcs(out, base, lo, first);
+        base = blk.targets[i] - 4 * (uint64_t)first;
+        lo   = first;
+    }
+    fill_pcs(out, base, lo, num_inst);
+    pc = base + 4 * ((uint64_t)num_inst - 1);
+}
+
+// room for n more PCs at pcs[num_pcs], grows past the num_inst() + 1 reserved up front only for
+// logs whose num_inst() undercounts
+XNUTRACE_INLINE uint64_t *append_pcs(std::vector<uint64_t> &pcs, size_t &num_pcs, size_t n) {
+    if (XNUTRACE_UNLIKELY(num_pcs + n > pcs.size())) {
+        pcs.resize(std::max(num_pcs + n, 2 * pcs.size()));
+    }
+    auto *res = pcs.data() + num_pcs;
+    num_pcs += n;
+    return res;
+}
+
+} // namespace
+
+void decode_log_pcs(const log_thread_buf &log, std::vector<uint64_t> &pcs) {
+    if (log.chunks().empty()) {
+        return;
+    }
+    size_t num_pcs = pcs.size();
+    pcs.resize(num_pcs + log.num_inst() + 1);
+    // a bin's sync frame may be unaligned, pc is the first member
+    uint64_t pc;
+    memcpy(&pc, log.front().sync_ctx(), sizeof(pc));
+    if (!log.mid_stream()) {
+        *append_pcs(pcs, num_pcs, 1) = pc;
+    }
+
+    pc_block blk;
+    for (const auto &chunk : log.chunks()) {
+        const auto *p   = chunk.data();
+        const auto *end = chunk.data() + chunk.size();
+        while (p < end) {
+            p = gather_block(p, end, blk);
+            if (XNUTRACE_LIKELY(blk.num_records)) {
+                const auto num_inst = scan_block(blk);
+                decode_block(blk, num_inst, pc, append_pcs(pcs, num_pcs, num_inst));
+            }
+            if (p == end || blk.num_records == pc_decode_block_sz) {
+                continue;
+            }
+            // records that ended the block, the same steps as pc_iterator
+            const auto &msg = *(const log_msg *)p;
+            p += msg.size();
+            if (msg.is_sync_frame()) {
+                memcpy(&pc, msg.sync_ctx(), sizeof(pc));
+                continue;
+            }
+            pc                 = msg.pc_branched() ? msg.pc(pc) : pc + 4;
+            const auto run_len = msg.bb_run_len();
+            fill_pcs(append_pcs(pcs, num_pcs, run_len), pc, 0, run_len);
+            pc += 4 * ((uint64_t)run_len - 1);
+        }
+    }
+    pcs.resize(num_pcs);
+}
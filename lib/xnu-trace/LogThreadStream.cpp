@@ -0,0 +1,261 @@
+#include "xnu-trace/LogThreadStream.h"
+#include "common-internal.h"
+
+#include <algorithm>
+
+namespace {
+
+// bytes taken by the whole v1 records at the front of buf, no record is larger than a full
+// context sync frame so whatever follows the last one that fits is a partial record
+size_t whole_v1_prefix(std::span<const uint8_t> buf, bool eof) {
+    if (eof) {
+        return buf.size();
+    }
+    size_t off = 0;
+    while (buf.size() - off >= log_msg::size_full_ctx) {
+        off += ((const log_msg *)(buf.data() + off))->size();
+    }
+    return off;
+}
+
+void erase_front(std::vector<uint8_t> &buf, size_t size) {
+    buf.erase(buf.begin(), buf.begin() + size);
+}
+
+} // namespace
+
+LogThreadStream::LogThreadStream(const fs::path &thread_path, bool pcs_only,
+                                 std::shared_ptr<const CompressionDict> dict, size_t window_sz)
+    : m_path{thread_path}, m_dict{std::move(dict)}, m_window_sz{window_sz},
+      m_pcs_only{pcs_only} {
+    // a window always fits a whole record besides the partial one carried over
+    assert(m_window_sz >= 2 * (log_msg::size_full_ctx + 1));
+    const file_t fh{m_path, true, nullptr, 0, false, m_dict.get()};
+    m_hdr = fh.header();
+    // the column files would need entries of their own
+    if (m_hdr.record_format != (uint8_t)record_format::columnar) {
+        m_index = SeekIndex{m_path};
+    }
+}
+
+const log_thread_hdr &LogThreadStream::header() const {
+    return m_hdr;
+}
+
+uint32_t LogThreadStream::thread_id() const {
+    return m_hdr.thread_id;
+}
+
+uint64_t LogThreadStream::num_inst() const {
+    return m_hdr.num_inst;
+}
+
+uint64_t LogThreadStream::num_bytes() const {
+    return m_num_bytes;
+}
+
+LogThreadStream::iterator LogThreadStream::begin() {
+    return start_pass(nullptr);
+}
+
+LogThreadStream::iterator LogThreadStream::end() const {
+    return iterator(nullptr, nullptr, nullptr);
+}
+
+LogThreadStream::ctx_iterator LogThreadStream::ctx_begin() {
+    return ctx_from(begin());
+}
+
+LogThreadStream::ctx_iterator LogThreadStream::ctx_end() const {
+    return ctx_iterator(end(), nullptr);
+}
+
+LogThreadStream::pc_iterator LogThreadStream::pcs_begin() {
+    return pcs_from(begin());
+}
+
+LogThreadStream::pc_iterator LogThreadStream::pcs_end() const {
+    return pc_iterator(end(), 0);
+}
+
+LogThreadStream::iterator LogThreadStream::seek(uint64_t inst) {
+    return start_pass(m_index.find(inst));
+}
+
+LogThreadStream::ctx_iterator LogThreadStream::ctx_seek(uint64_t inst) {
+    return ctx_from(seek(inst));
+}
+
+LogThreadStream::pc_iterator LogThreadStream::pcs_seek(uint64_t inst) {
+    return pcs_from(seek(inst));
+}
+
+LogThreadStream::iterator LogThreadStream::start_pass(const log_seek_index_entry *entry) {
+    rewind();
+    if (entry) {
+        m_file->seek(*entry);
+        m_left = m_file->decompressed_size() - entry->decomp_off;
+    }
+    if (next_window().empty()) {
+        return end();
+    }
+    return iterator(&m_window, &m_window + 1, (const log_msg *)m_window.data(), this);
+}
+
+LogThreadStream::ctx_iterator LogThreadStream::ctx_from(iterator it) const {
+    if (it == end()) {
+        return ctx_end();
+    }
+    assert(it->is_sync_frame());
+    return ctx_iterator(it, it->sync_ctx());
+}
+
+LogThreadStream::pc_iterator LogThreadStream::pcs_from(iterator it) const {
+    if (it == end()) {
+        return pcs_end();
+    }
+    assert(it->is_sync_frame());
+    uint64_t pc;
+    // may be unaligned, pc is the first member
+    memcpy(&pc, it->sync_ctx(), sizeof(pc));
+    return pc_iterator(it, pc);
+}
+
+void LogThreadStream::rewind() {
+    m_file = std::make_unique<file_t>(m_path, true, nullptr, 0, false, m_dict.get());
+    m_left = m_file->decompressed_size();
+    m_in.clear();
+    m_v2_decoder = {};
+    for (size_t i = 0; i < log_column_num; ++i) {
+        m_column_files[i].reset();
+        m_column_in[i].clear();
+        m_column_left[i] = 0;
+    }
+    if (m_hdr.record_format == (uint8_t)record_format::columnar) {
+        for (size_t i = 0; i < log_column_num; ++i) {
+            if (m_pcs_only && (log_column)i != log_column::pc) {
+                continue;
+            }
+            m_column_files[i] = std::make_unique<file_t>(log_column_path(m_path, (log_column)i),
+                                                         true, nullptr, 0, false, m_dict.get());
+            m_column_left[i] = m_column_files[i]->decompressed_size();
+        }
+    }
+    m_window    = {};
+    m_num_bytes = 0;
+}
+
+void LogThreadStream::fill(file_t &file, uint64_t &left, std::vector<uint8_t> &buf,
+                           size_t size) {
+    const auto sz = std::min<uint64_t>(size, left);
+    if (!sz) {
+        return;
+    }
+    const auto off = buf.size();
+    buf.resize(off + sz);
+    file.read(buf.data() + off, sz);
+    left -= sz;
+}
+
+log_thread_buf::chunk_t LogThreadStream::next_window() {
+    // the previous window stays untouched until the next call
+    m_cur_window ^= 1;
+    auto &out = m_windows[m_cur_window];
+    out.clear();
+    while (out.empty()) {
+        const auto to_fill = m_window_sz - std::min(m_in.size(), m_window_sz);
+        switch ((record_format)m_hdr.record_format) {
+        case record_format::v1: {
+            // read straight into the window behind the partial record carried over
+            out.assign(m_in.begin(), m_in.end());
+            fill(*m_file, m_left, out, to_fill);
+            const auto whole = whole_v1_prefix(out, !m_left);
+            m_in.assign(out.begin() + whole, out.end());
+            out.resize(whole);
+            break;
+        }
+        case record_format::v2:
+            fill(*m_file, m_left, m_in, to_fill);
+            erase_front(m_in, decode_v2(out));
+            break;
+        case record_format::columnar:
+            fill(*m_file, m_left, m_in, to_fill);
+            erase_front(m_in, join_columns(out));
+            break;
+        }
+        if (out.empty() && !m_left) {
+            assert(m_in.empty());
+            break;
+        }
+    }
+    m_num_bytes += out.size();
+    m_window = out;
+    return m_window;
+}
+
+size_t LogThreadStream::decode_v2(std::vector<uint8_t> &out) {
+    const bool eof = !m_left;
+    size_t off     = 0;
+    // an escaped record takes its prefix on top of the largest v1 record
+    while (off < m_in.size() && (eof || m_in.size() - off > log_msg::size_full_ctx)) {
+        const auto prefix = m_in[off];
+        off += prefix == log_msg_v2::escape ? 1 + ((const log_msg *)&m_in[off + 1])->size()
+                                            : log_msg_v2_sizes[prefix];
+    }
+    assert(off <= m_in.size());
+    m_v2_decoder.decode({m_in.data(), off}, out);
+    return off;
+}
+
+size_t LogThreadStream::join_columns(std::vector<uint8_t> &out) {
+    const bool eof = !m_left;
+    // the exact payload sizes depend on the column bytes themselves, the headers only give an
+    // upper bound. Headers are taken until a column would need more than a window.
+    std::array<size_t, log_column_num> need{};
+    size_t off = 0;
+    while (off < m_in.size() && (eof || m_in.size() - off >= log_msg::size_full_ctx) &&
+           *std::max_element(need.begin(), need.end()) < m_window_sz) {
+        const auto &hdr = *(const log_msg *)&m_in[off];
+        if (XNUTRACE_UNLIKELY(hdr.is_sync_frame())) {
+            off += log_msg::size_full_ctx;
+            continue;
+        }
+        off += sizeof(log_msg);
+        // delta PCs/SPs are only written when their varint fits 8 bytes
+        if (hdr.pc_branched()) {
+            need[(size_t)log_column::pc] += sizeof(uint64_t);
+        }
+        if (m_pcs_only) {
+            continue;
+        }
+        if (hdr.sp_changed()) {
+            need[(size_t)log_column::sp] += sizeof(uint64_t);
+        }
+        need[(size_t)log_column::gpr] += hdr.num_gpr() * sizeof(uint64_t);
+        need[(size_t)log_column::vec] += hdr.num_vec() * sizeof(uint128_t) +
+                                         (hdr.has_mem() ? log_msg::mem_size_max : 0);
+    }
+    assert(off <= m_in.size());
+
+    for (size_t i = 0; i < log_column_num; ++i) {
+        if (m_column_files[i] && m_column_in[i].size() < need[i]) {
+            fill(*m_column_files[i], m_column_left[i], m_column_in[i],
+                 need[i] - m_column_in[i].size());
+        }
+    }
+    const std::span<const uint8_t> hdrs{m_in.data(), off};
+    if (m_pcs_only) {
+        auto &pcs = m_column_in[(size_t)log_column::pc];
+        erase_front(pcs, join_pc_log_msgs(hdrs, pcs, out));
+    } else {
+        log_column_spans_t column_spans;
+        for (size_t i = 0; i < log_column_num; ++i) {
+            column_spans[i] = m_column_in[i];
+        }
+        const auto taken = join_log_msgs(hdrs, column_spans, out);
+        for (size_t i = 0; i < log_column_num; ++i) {
+            erase_front(m_column_in[i], taken[i]);
+        }
+    }
+    return off;
+}
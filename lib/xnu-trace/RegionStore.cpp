@@ -0,0 +1,176 @@
+#include "xnu-trace/RegionStore.h"
+#include "common-internal.h"
+
+#include "xnu-trace/CompressedFile.h"
+#include "xnu-trace/log_structs.h"
+
+#include <fstream>
+#include <functional>
+#include <set>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+namespace {
+
+std::string hex_digest(const sha256_t &digest) {
+    return fmt::format("{:02x}", fmt::join(digest, ""));
+}
+
+// unique per writing thread, renamed over the final path once complete
+fs::path tmp_path(const fs::path &path) {
+    return fs::path{path}.concat(fmt::format(".tmp-{:d}-{:x}", getpid(),
+                                             std::hash<std::thread::id>{}(
+                                                 std::this_thread::get_id())));
+}
+
+// flock() on <store>/lock for as long as it lives
+class store_lock {
+public:
+    store_lock(const fs::path &store_dir, bool exclusive) {
+        fs::create_directories(store_dir);
+        const auto path = store_dir / "lock";
+        m_fd            = ::open(path.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+        posix_check(m_fd < 0, fmt::format("can't open '{:s}'", path.string()));
+        posix_check(flock(m_fd, exclusive ? LOCK_EX : LOCK_SH), "RegionStore flock");
+    }
+    ~store_lock() {
+        close(m_fd);
+    }
+    store_lock(const store_lock &)            = delete;
+    store_lock &operator=(const store_lock &) = delete;
+
+private:
+    int m_fd{-1};
+};
+
+} // namespace
+
+RegionStore::RegionStore(const fs::path &store_dir)
+    : m_path{fs::weakly_canonical(fs::absolute(store_dir))} {}
+
+const fs::path &RegionStore::path() const {
+    return m_path;
+}
+
+fs::path RegionStore::object_path(const sha256_t &digest) const {
+    const auto hex = hex_digest(digest);
+    return m_path / "objects" / hex.substr(0, 2) / (hex + ".bin");
+}
+
+bool RegionStore::contains(const sha256_t &digest) const {
+    return fs::exists(object_path(digest));
+}
+
+void RegionStore::put(const sha256_t &digest, std::span<const uint8_t> bytes, int level) const {
+    const auto path = object_path(digest);
+    if (fs::exists(path)) {
+        return;
+    }
+    fs::create_directories(path.parent_path());
+    const auto tmp = tmp_path(path);
+    {
+        log_macho_region_hdr hdr{};
+        memcpy(hdr.digest_sha256, digest.data(), digest.size());
+        CompressedFile<log_macho_region_hdr> fh{tmp, false, &hdr, level};
+        fh.write(bytes);
+    }
+    fs::rename(tmp, path);
+}
+
+void RegionStore::set_ref(const fs::path &bundle_dir, std::span<const sha256_t> digests) const {
+    // waits for a running gc(), every later one sees the new ref
+    const store_lock lock{m_path, false};
+    const auto path = ref_path(bundle_dir);
+    fs::create_directories(path.parent_path());
+    const auto tmp = tmp_path(path);
+    {
+        std::ofstream ref{tmp};
+        ref << fs::weakly_canonical(fs::absolute(bundle_dir)).string() << '\n';
+        for (const auto &digest : digests) {
+            ref << hex_digest(digest) << '\n';
+        }
+        assert(ref.good());
+    }
+    fs::rename(tmp, path);
+}
+
+RegionStore::gc_stats RegionStore::gc(std::chrono::seconds grace) const {
+    gc_stats res;
+    if (!fs::exists(m_path)) {
+        return res;
+    }
+    // no set_ref() between reading the refs and removing the objects they don't mention
+    const store_lock lock{m_path, true};
+    std::set<std::string> live;
+    const auto now = fs::file_time_type::clock::now();
+
+    const auto refs_dir = m_path / "refs";
+    if (fs::exists(refs_dir)) {
+        for (const auto &dirent : fs::directory_iterator{refs_dir}) {
+            const auto path = dirent.path();
+            if (path.filename().string().find(".tmp-") != std::string::npos) {
+                continue;
+            }
+            std::ifstream ref{path};
+            std::string bundle_dir;
+            std::getline(ref, bundle_dir);
+            // a young ref may belong to a bundle whose meta.bin is still being written
+            if (now - fs::last_write_time(path) >= grace) {
+                const auto store = bundle_store(bundle_dir);
+                if (!store || *store != m_path) {
+                    fs::remove(path);
+                    ++res.num_refs_dropped;
+                    continue;
+                }
+            }
+            for (std::string digest; std::getline(ref, digest);) {
+                live.emplace(std::move(digest));
+            }
+        }
+    }
+
+    const auto objects_dir = m_path / "objects";
+    if (fs::exists(objects_dir)) {
+        std::vector<fs::path> dead;
+        for (const auto &dirent : fs::recursive_directory_iterator{objects_dir}) {
+            const auto path = dirent.path();
+            // in-flight puts have a .tmp-* extension
+            if (!dirent.is_regular_file() || path.extension() != ".bin") {
+                continue;
+            }
+            if (!live.contains(path.stem().string())) {
+                dead.emplace_back(path);
+            }
+        }
+        for (const auto &path : dead) {
+            res.bytes_freed += fs::file_size(path);
+            fs::remove(path);
+            ++res.num_objects_removed;
+        }
+    }
+    return res;
+}
+
+std::optional<fs::path> RegionStore::bundle_store(const fs::path &bundle_dir) {
+    const auto meta_path = bundle_dir / "meta.bin";
+    if (!fs::exists(meta_path)) {
+        return std::nullopt;
+    }
+    CompressedFile<log_meta_hdr> meta_fh{meta_path, true};
+    const auto path_len = meta_fh.header().region_store_path_len;
+    if (!path_len) {
+        return std::nullopt;
+    }
+    const auto path_buf = meta_fh.read(path_len);
+    return fs::path{std::string{(const char *)path_buf.data(), path_buf.size()}};
+}
+
+fs::path RegionStore::ref_path(const fs::path &bundle_dir) const {
+    const auto bundle_path = fs::weakly_canonical(fs::absolute(bundle_dir)).string();
+    return m_path / "refs" / hex_digest(get_sha256({(const uint8_t *)bundle_path.data(),
+                                                    bundle_path.size()}));
+}
@@ -0,0 +1,64 @@
+#include "xnu-trace/SpillWriter.h"
+#include "common-internal.h"
+
+#include "xnu-trace/TraceLog.h"
+
+#include <pthread.h>
+
+SpillWriter::SpillWriter(std::atomic<size_t> &mem_bytes, record_format format)
+    : m_mem_bytes{mem_bytes}, m_format{format}, m_thread{&SpillWriter::run, this} {}
+
+SpillWriter::~SpillWriter() {
+    stop();
+}
+
+void SpillWriter::submit(jev::xnutrace::detail::CompressedFile *file, LogColumnWriter *columns,
+                         std::vector<pc_range> *ranges, ChunkedArena &&segment,
+                         std::vector<seek_point> &&sync_points) {
+    {
+        std::lock_guard lock{m_jobs_lock};
+        assert(!m_stop);
+        m_jobs.emplace_back(job{.file        = file,
+                                .columns     = columns,
+                                .ranges      = ranges,
+                                .segment     = std::move(segment),
+                                .sync_points = std::move(sync_points)});
+    }
+    m_jobs_cv.notify_one();
+}
+
+void SpillWriter::stop() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard lock{m_jobs_lock};
+        m_stop = true;
+    }
+    m_jobs_cv.notify_one();
+    m_thread.join();
+}
+
+void SpillWriter::run() {
+    pthread_setname_np("xnu-trace spill writer");
+    while (true) {
+        std::unique_lock lock{m_jobs_lock};
+        m_jobs_cv.wait(lock, [this] {
+            return m_stop || !m_jobs.empty();
+        });
+        if (m_jobs.empty()) {
+            break;
+        }
+        auto j = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        lock.unlock();
+
+        const auto seg_sz = j.segment.size();
+        write_log_msg_chunks(*j.file, j.segment.chunks(), m_format, j.columns, j.sync_points);
+        const log_thread_buf seg_buf{std::move(j.segment), 0};
+        auto seg_ranges = extract_pc_ranges_from_traces({&seg_buf});
+        j.ranges->insert(j.ranges->end(), seg_ranges.begin(), seg_ranges.end());
+        coalesce_pc_ranges(*j.ranges);
+        m_mem_bytes.fetch_sub(seg_sz, std::memory_order_relaxed);
+    }
+}
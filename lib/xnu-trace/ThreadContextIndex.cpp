@@ -0,0 +1,209 @@
+#include "xnu-trace/ThreadContextIndex.h"
+#include "common-internal.h"
+
+#include "xnu-trace/CompressedFile.h"
+#include "xnu-trace/Signpost.h"
+#include "xnu-trace/TraceLog.h"
+#include "xnu-trace/utils.h"
+
+#include <algorithm>
+
+fs::path gpr_checkpoints_path(const fs::path &path) {
+    auto res = path;
+    res.replace_extension(fmt::format(".gprs{:s}", path.extension().string()));
+    return res;
+}
+
+bool is_gpr_checkpoints_path(const fs::path &path) {
+    return path.stem().extension() == ".gprs";
+}
+
+ThreadContextIndex::ThreadContextIndex(const log_thread_buf &thread_buf) : m_log{thread_buf} {
+    Signpost index_sp("ThreadContextIndex", "find sync frames");
+    index_sp.start();
+    uint64_t chunk_off = 0;
+    for (const auto &chunk : m_log.chunks()) {
+        m_chunk_offs.emplace_back(chunk_off);
+        auto p          = chunk.data();
+        const auto *end = chunk.data() + chunk.size();
+        while (p < end) {
+            p = (const uint8_t *)horspool_memmem(p, end - p, log_msg::sync_frame_buf_hdr,
+                                                 sizeof(log_msg::sync_frame_buf_hdr));
+            if (!p) {
+                break;
+            }
+            const auto &sync = *(const log_msg *)p;
+            if (sync.is_sync_frame()) {
+                m_syncs.emplace_back(sync_point{
+                    {.next_inst = sync.sync_num_inst(),
+                     .log_off   = chunk_off + (p - chunk.data()) + log_msg::size_full_ctx},
+                    (const log_arm64_cpu_context *)sync.sync_ctx()});
+            }
+            p += sizeof(log_msg::sync_frame_buf_hdr);
+        }
+        chunk_off += chunk.size();
+    }
+    index_sp.end();
+}
+
+std::optional<log_arm64_cpu_context> ThreadContextIndex::context_at(uint64_t inst_idx) const {
+    const auto sync = std::upper_bound(m_syncs.begin(), m_syncs.end(), inst_idx,
+                                       [](uint64_t inst, const sync_point &point) {
+                                           return inst < point.next_inst;
+                                       });
+    if (sync == m_syncs.begin()) {
+        return std::nullopt;
+    }
+    log_arm64_cpu_context ctx;
+    memcpy(&ctx, (sync - 1)->ctx, sizeof(ctx));
+    return replay(*(sync - 1), ctx, inst_idx);
+}
+
+std::optional<log_arm64_cpu_context> ThreadContextIndex::gpr_context_at(uint64_t inst_idx) const {
+    const auto sync = std::upper_bound(m_syncs.begin(), m_syncs.end(), inst_idx,
+                                       [](uint64_t inst, const sync_point &point) {
+                                           return inst < point.next_inst;
+                                       });
+    const auto ckpt = std::upper_bound(m_gpr_checkpoints.begin(), m_gpr_checkpoints.end(),
+                                       inst_idx, [](uint64_t inst, const log_gpr_checkpoint &c) {
+                                           return inst < c.next_inst;
+                                       });
+    const bool has_sync = sync != m_syncs.begin();
+    const bool has_ckpt = ckpt != m_gpr_checkpoints.begin();
+    if (!has_sync && !has_ckpt) {
+        return std::nullopt;
+    }
+    log_arm64_cpu_context ctx{};
+    std::optional<log_arm64_cpu_context> res;
+    // a checkpoint is never taken at a sync frame, whichever is closer has no other in between
+    if (has_ckpt && (!has_sync || (ckpt - 1)->next_inst > (sync - 1)->next_inst)) {
+        const auto &c = *(ckpt - 1);
+        memcpy(&ctx, c.regs, sizeof(c.regs));
+        res = replay({.next_inst = c.next_inst, .log_off = c.log_off}, ctx, inst_idx);
+    } else {
+        memcpy(&ctx, (sync - 1)->ctx, sizeof(ctx));
+        res = replay(*(sync - 1), ctx, inst_idx);
+    }
+    if (res) {
+        memset(&res->v, 0, sizeof(res->v));
+    }
+    return res;
+}
+
+void ThreadContextIndex::build_gpr_checkpoints(uint64_t interval) {
+    assert(interval);
+    Signpost build_sp("ThreadContextIndex", "build GPR checkpoints");
+    build_sp.start();
+    m_gpr_interval = interval;
+    m_gpr_checkpoints.clear();
+    log_arm64_cpu_context ctx;
+    bool have_ctx      = false;
+    uint64_t inst      = 0;
+    uint64_t next_ckpt = 0;
+    size_t chunk       = 0;
+    for (auto msg = record_at(0, chunk); msg; msg = next_record(msg, chunk)) {
+        if (XNUTRACE_UNLIKELY(msg->is_sync_frame())) {
+            ctx.update(*msg);
+            have_ctx  = true;
+            inst      = msg->sync_num_inst();
+            next_ckpt = inst + interval;
+            continue;
+        }
+        if (!have_ctx) {
+            continue;
+        }
+        if (XNUTRACE_UNLIKELY(inst >= next_ckpt)) {
+            auto &c     = m_gpr_checkpoints.emplace_back();
+            c.next_inst = inst;
+            c.log_off   = m_chunk_offs[chunk] +
+                        ((const uint8_t *)msg - m_log.chunks()[chunk].data());
+            memcpy(c.regs, &ctx, sizeof(c.regs));
+            next_ckpt = inst + interval;
+        }
+        ctx.update(*msg);
+        inst += msg->bb_run_len();
+    }
+    build_sp.end();
+}
+
+bool ThreadContextIndex::has_gpr_checkpoints() const {
+    return !m_gpr_checkpoints.empty();
+}
+
+void ThreadContextIndex::write_gpr_checkpoints(const fs::path &path) const {
+    const log_gpr_checkpoints_hdr hdr{.interval        = m_gpr_interval,
+                                      .num_checkpoints = m_gpr_checkpoints.size(),
+                                      .log_num_inst    = m_log.num_inst(),
+                                      .log_num_bytes   = m_log.num_bytes()};
+    CompressedFile<log_gpr_checkpoints_hdr> fh{path, false, &hdr, 0};
+    fh.write(m_gpr_checkpoints.data(), m_gpr_checkpoints.size() * sizeof(m_gpr_checkpoints[0]));
+}
+
+bool ThreadContextIndex::read_gpr_checkpoints(const fs::path &path) {
+    if (!fs::exists(path)) {
+        return false;
+    }
+    CompressedFile<log_gpr_checkpoints_hdr> fh{path, true};
+    const auto hdr = fh.header();
+    if (hdr.log_num_inst != m_log.num_inst() || hdr.log_num_bytes != m_log.num_bytes()) {
+        return false;
+    }
+    m_gpr_interval = hdr.interval;
+    m_gpr_checkpoints.resize(hdr.num_checkpoints);
+    fh.read((uint8_t *)m_gpr_checkpoints.data(),
+            m_gpr_checkpoints.size() * sizeof(m_gpr_checkpoints[0]));
+    return true;
+}
+
+std::optional<log_arm64_cpu_context> ThreadContextIndex::replay(const start_point &start,
+                                                                log_arm64_cpu_context ctx,
+                                                                uint64_t inst_idx) const {
+    assert(start.next_inst <= inst_idx);
+    uint64_t inst = start.next_inst;
+    size_t chunk;
+    for (auto msg = record_at(start.log_off, chunk); msg; msg = next_record(msg, chunk)) {
+        // the records up to the next sync frame ran out before inst_idx
+        if (XNUTRACE_UNLIKELY(msg->is_sync_frame())) {
+            return std::nullopt;
+        }
+        ctx.update(*msg);
+        const auto run_len = msg->bb_run_len();
+        if (inst_idx < inst + run_len) {
+            // update() leaves a basic block run at its last instruction
+            ctx.pc -= (inst + run_len - 1 - inst_idx) * 4;
+            return ctx;
+        }
+        inst += run_len;
+    }
+    return std::nullopt;
+}
+
+const log_msg *ThreadContextIndex::record_at(uint64_t log_off, size_t &chunk) const {
+    const auto &chunks = m_log.chunks();
+    const auto it      = std::upper_bound(m_chunk_offs.begin(), m_chunk_offs.end(), log_off);
+    if (it == m_chunk_offs.begin()) {
+        return nullptr;
+    }
+    chunk         = it - m_chunk_offs.begin() - 1;
+    const auto *p = chunks[chunk].data() + (log_off - m_chunk_offs[chunk]);
+    // records never straddle chunks, an offset at the end of one is the start of the next
+    while (p == chunks[chunk].data() + chunks[chunk].size()) {
+        if (++chunk == chunks.size()) {
+            return nullptr;
+        }
+        p = chunks[chunk].data();
+    }
+    return (const log_msg *)p;
+}
+
+const log_msg *ThreadContextIndex::next_record(const log_msg *msg, size_t &chunk) const {
+    const auto &chunks = m_log.chunks();
+    const auto *p      = (const uint8_t *)msg + msg->size();
+    while (p == chunks[chunk].data() + chunks[chunk].size()) {
+        if (++chunk == chunks.size()) {
+            return nullptr;
+        }
+        p = chunks[chunk].data();
+    }
+    return (const log_msg *)p;
+}
@@ -1,61 +1,307 @@
 #include "xnu-trace/TraceLog.h"
 #include "common-internal.h"
 
+#include "xnu-trace/LogPcDecoder.h"
+#include "xnu-trace/LogThreadStream.h"
 #include "xnu-trace/ThreadPool.h"
+#include "xnu-trace/mach.h"
 
+#include <algorithm>
 #include <bit>
+#include <functional>
+#include <iterator>
 
-#include <absl/container/flat_hash_set.h>
 #include <arm_neon.h>
 #include <interval-tree/interval_tree.hpp>
+#include <mach/mach_init.h>
 
 using namespace lib_interval_tree;
 
+namespace {
+
+std::vector<uint64_t> decode_pcs(const log_thread_buf &bin) {
+    std::vector<uint64_t> pcs;
+    decode_log_pcs(bin, pcs);
+    return pcs;
+}
+
+std::vector<bb_t> decode_bbs(const log_thread_buf &bin) {
+    std::vector<bb_t> bbs;
+    for (auto i = bin.pcs_begin(), e = bin.pcs_end(); i != e; ++i) {
+        const auto pc = i.pc();
+        if (!bbs.empty() && bbs.back().pc + bbs.back().sz == pc) {
+            bbs.back().sz += 4;
+        } else {
+            bbs.emplace_back(bb_t{.pc = pc, .sz = 4});
+        }
+    }
+    return bbs;
+}
+
+// concatenates the bins' results in order, skip[i] elements at the front of bin i left out
+template <typename T>
+std::vector<T> stitch_bins(std::vector<std::vector<T>> &bins,
+                           const std::vector<size_t> &skip = {}) {
+    if (bins.size() == 1 && skip.empty()) {
+        return std::move(bins[0]);
+    }
+    std::vector<size_t> offs(bins.size() + 1);
+    for (size_t i = 0; i < bins.size(); ++i) {
+        offs[i + 1] = offs[i] + bins[i].size() - (skip.empty() ? 0 : skip[i]);
+    }
+    std::vector<T> res(offs.back());
+    xnutrace_pool.wait_on_n_tasks(bins.size(), [&](const auto i) {
+        std::copy(bins[i].begin() + (skip.empty() ? 0 : skip[i]), bins[i].end(), &res[offs[i]]);
+        bins[i] = {};
+    });
+    return res;
+}
+
+} // namespace
+
+log_thread_buf::log_thread_buf(std::vector<uint8_t> &&buf, uint64_t num_inst)
+    : m_num_inst{num_inst} {
+    auto owner = std::make_shared<std::vector<uint8_t>>(std::move(buf));
+    if (!owner->empty()) {
+        m_chunks.emplace_back(owner->data(), owner->size());
+    }
+    m_num_bytes = owner->size();
+    m_owner     = std::move(owner);
+}
+
+log_thread_buf::log_thread_buf(ChunkedArena &&arena, uint64_t num_inst) : m_num_inst{num_inst} {
+    m_chunks = arena.chunks();
+    m_owner  = std::make_shared<ChunkedArena>(std::move(arena));
+    for (const auto &chunk : m_chunks) {
+        m_num_bytes += chunk.size();
+    }
+}
+
+log_thread_buf::log_thread_buf(std::vector<chunk_t> chunks, std::shared_ptr<const void> owner,
+                               uint64_t num_inst)
+    : m_owner{std::move(owner)}, m_num_inst{num_inst} {
+    for (const auto &chunk : chunks) {
+        if (!chunk.empty()) {
+            m_chunks.emplace_back(chunk);
+            m_num_bytes += chunk.size();
+        }
+    }
+}
+
+uint32_t log_thread_buf::num_decode_bins() const {
+    return (uint32_t)std::clamp<uint64_t>(m_num_bytes / min_bin_bytes, 1,
+                                          xnutrace_pool.get_thread_count());
+}
+
+std::vector<log_thread_buf> log_thread_buf::chunk_into_bins(uint32_t n) const {
+    assert(n);
+    if (n == 1 || m_chunks.empty()) {
+        return {*this};
+    }
+    Signpost chunk_sp("log_thread_buf", "chunk_into_bins");
+    chunk_sp.start();
+
+    struct split {
+        size_t chunk;
+        const uint8_t *ptr;
+    };
+    // the first sync frame at or past each n-th of the log's bytes, records never straddle
+    // chunks so neither do sync frames
+    std::vector<split> splits;
+    uint64_t chunk_off = 0;
+    uint32_t next_bin  = 1;
+    for (size_t ci = 0; ci < m_chunks.size(); ++ci) {
+        const auto &chunk = m_chunks[ci];
+        const auto num_parts =
+            (uint32_t)std::max<uint64_t>(1, (uint64_t)n * chunk.size() / m_num_bytes);
+        const auto raw_bins = chunk_into_bins_by_needle(num_parts, chunk.data(), chunk.size(),
+                                                        log_msg::sync_frame_buf_hdr,
+                                                        sizeof(log_msg::sync_frame_buf_hdr));
+        for (const auto p : raw_bins) {
+            if (!p) {
+                continue;
+            }
+            const auto off = chunk_off + ((const uint8_t *)p - chunk.data());
+            if (next_bin < n && off >= next_bin * m_num_bytes / n) {
+                splits.emplace_back(split{ci, (const uint8_t *)p});
+                next_bin = (uint32_t)(off * n / m_num_bytes) + 1;
+            }
+        }
+        chunk_off += chunk.size();
+    }
+
+    std::vector<log_thread_buf> bins;
+    split start{0, m_chunks.front().data()};
+    const auto add_bin = [&](const split &stop) {
+        std::vector<chunk_t> chunks;
+        for (auto ci = start.chunk; ci <= stop.chunk && ci < m_chunks.size(); ++ci) {
+            const auto &chunk = m_chunks[ci];
+            const auto a      = ci == start.chunk ? start.ptr : chunk.data();
+            const auto b      = ci == stop.chunk ? stop.ptr : chunk.data() + chunk.size();
+            chunks.emplace_back(a, b - a);
+        }
+        const auto &sync = *(const log_msg *)start.ptr;
+        assert(sync.is_sync_frame());
+        const auto first_inst = sync.sync_num_inst();
+        const auto end_inst   = stop.chunk < m_chunks.size()
+                                    ? ((const log_msg *)stop.ptr)->sync_num_inst()
+                                    : front().sync_num_inst() + m_num_inst;
+        auto &bin = bins.emplace_back(std::move(chunks), m_owner,
+                                      end_inst - std::min(first_inst, end_inst));
+        bin.m_mid_stream = m_mid_stream || bins.size() > 1;
+        start            = stop;
+    };
+    for (const auto &stop : splits) {
+        add_bin(stop);
+    }
+    add_bin(split{m_chunks.size(), nullptr});
+    chunk_sp.end();
+    return bins;
+}
+
 std::vector<bb_t> extract_bbs_from_pc_trace(const std::span<const uint64_t> &pcs) {
     std::vector<bb_t> bbs;
 
     // TODO: vectorize: vector if pcs - last_pcs != {4, 8, 12, 16} then scalar code else next
-    uint64_t bb_start = pcs[0];
-    uint64_t last_pc  = pcs[0] - 4;
     for (const auto pc : pcs) {
-        if (last_pc + 4 != pc) {
-            bbs.emplace_back(bb_t{.pc = bb_start, .sz = (uint32_t)(last_pc + 4 - bb_start)});
-            bb_start = pc;
+        if (!bbs.empty() && bbs.back().pc + bbs.back().sz == pc) {
+            bbs.back().sz += 4;
+        } else {
+            bbs.emplace_back(bb_t{.pc = pc, .sz = 4});
         }
-        last_pc = pc;
-    }
-    if (bb_start != last_pc) {
-        bbs.emplace_back(bb_t{.pc = bb_start, .sz = (uint32_t)(last_pc + 4 - bb_start)});
     }
     return bbs;
 }
 
-std::vector<bb_t> extract_bbs_from_trace(const log_thread_buf &thread_buf) {
-    std::vector<bb_t> bbs;
-    (void)thread_buf;
-    assert(!"not implemented");
+std::vector<bb_t> extract_bbs_from_trace(const log_thread_buf &thread_buf, uint32_t num_bins) {
+    Signpost decode_sp("extract_bbs", "decode");
+    decode_sp.start();
+    auto bin_bbs = map_log_bins(thread_buf, decode_bbs, num_bins);
+    decode_sp.end();
+    if (bin_bbs.empty()) {
+        return {};
+    }
+    // a BB cut by a bin boundary continues in the first one of the next non-empty bin
+    std::vector<size_t> skip(bin_bbs.size());
+    bb_t *last = nullptr;
+    for (size_t i = 0; i < bin_bbs.size(); ++i) {
+        auto &bbs = bin_bbs[i];
+        if (last && !bbs.empty() && last->pc + last->sz == bbs.front().pc) {
+            last->sz += bbs.front().sz;
+            skip[i] = 1;
+        }
+        if (bbs.size() > skip[i]) {
+            last = &bbs.back();
+        }
+    }
+    return stitch_bins(bin_bbs, skip);
 }
 
-std::vector<uint64_t> extract_pcs_from_trace(const log_thread_buf &thread_buf) {
-    std::vector<uint64_t> pcs;
-    pcs.reserve(thread_buf.num_inst());
-    for (auto i = thread_buf.pcs_begin(), e = thread_buf.pcs_end(); i != e; ++i) {
-        pcs.emplace_back(i.pc());
+std::vector<uint64_t> extract_pcs_from_trace(const log_thread_buf &thread_buf, uint32_t num_bins) {
+    auto bin_pcs = map_log_bins(thread_buf, decode_pcs, num_bins);
+    if (bin_pcs.empty()) {
+        return {};
     }
-    return pcs;
+    return stitch_bins(bin_pcs);
+}
+
+void coalesce_pc_ranges(std::vector<pc_range> &ranges) {
+    if (ranges.empty()) {
+        return;
+    }
+    std::sort(ranges.begin(), ranges.end(), [](const auto &a, const auto &b) {
+        return a.start < b.start;
+    });
+    size_t out = 0;
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        if (ranges[i].start <= ranges[out].end) {
+            ranges[out].end = std::max(ranges[out].end, ranges[i].end);
+        } else {
+            ranges[++out] = ranges[i];
+        }
+    }
+    ranges.resize(out + 1);
+}
+
+std::vector<pc_range>
+extract_pc_ranges_from_traces(const std::vector<const log_thread_buf *> &thread_bufs) {
+    Signpost decode_sp("extract_pc_ranges", "decode");
+    decode_sp.start();
+    // the order of the PCs doesn't matter here, every thread's bins decode at once
+    std::vector<log_thread_buf> bins;
+    for (const auto *thread_buf : thread_bufs) {
+        if (thread_buf->num_bytes()) {
+            auto thread_bins = thread_buf->chunk_into_bins(thread_buf->num_decode_bins());
+            std::move(thread_bins.begin(), thread_bins.end(), std::back_inserter(bins));
+        }
+    }
+    // a bin's PCs are sorted, deduped and coalesced in its own task, only the ranges outlive it
+    // so only the bins being decoded hold their PCs
+    std::vector<std::vector<pc_range>> bin_ranges(bins.size());
+    xnutrace_pool.wait_on_n_tasks(bins.size(), [&](const auto i) {
+        auto pcs = decode_pcs(bins[i]);
+        std::sort(pcs.begin(), pcs.end());
+        auto &ranges = bin_ranges[i];
+        for (const auto pc : pcs) {
+            if (!ranges.empty() && pc <= ranges.back().end) {
+                ranges.back().end = std::max(ranges.back().end, pc + 4);
+            } else {
+                ranges.emplace_back(pc_range{.start = pc, .end = pc + 4});
+            }
+        }
+    });
+    bins.clear();
+    decode_sp.end();
+
+    Signpost merge_sp("extract_pc_ranges", "merge");
+    merge_sp.start();
+    size_t num_ranges = 0;
+    for (const auto &ranges : bin_ranges) {
+        num_ranges += ranges.size();
+    }
+    std::vector<pc_range> res;
+    res.reserve(num_ranges);
+    for (const auto &ranges : bin_ranges) {
+        res.insert(res.end(), ranges.begin(), ranges.end());
+    }
+    coalesce_pc_ranges(res);
+    merge_sp.end();
+    return res;
 }
 
-TraceLog::TraceLog(const std::string &log_dir_path, int compression_level, bool stream)
-    : m_log_dir_path{log_dir_path}, m_compression_level{compression_level}, m_stream{stream} {
+TraceLog::TraceLog(const std::string &log_dir_path, int compression_level, bool stream,
+                   const trace_log_opts &opts)
+    : m_log_dir_path{log_dir_path}, m_compression_level{compression_level}, m_stream{stream},
+      m_opts{opts} {
     fs::create_directory(m_log_dir_path);
     for (const auto &dirent : std::filesystem::directory_iterator{m_log_dir_path}) {
         if (!dirent.path().filename().string().starts_with("macho-region-")) {
             fs::remove(dirent.path());
         }
     }
+    if (!m_opts.region_store.empty()) {
+        m_region_store = std::make_unique<RegionStore>(m_opts.region_store);
+    }
+    if (m_opts.dict && m_compression_level) {
+        m_opts.dict->write(m_log_dir_path / CompressionDict::sidecar_name);
+    } else {
+        m_opts.dict.reset();
+    }
+    if (m_stream && m_opts.async) {
+        assert(is_pow2(m_opts.async_ring_sz) && m_opts.async_ring_sz >= log_msg::size_full_ctx);
+        // the rings hand the writer arbitrary byte ranges, columns need whole records
+        assert(m_opts.format != record_format::columnar);
+        m_async_writer = std::make_unique<AsyncTraceWriter>();
+    }
+    if (!m_stream && m_opts.mem_budget) {
+        m_spill_writer = std::make_unique<SpillWriter>(m_mem_bytes, m_opts.format);
+    }
 }
 
-TraceLog::TraceLog(const std::string &log_dir_path) : m_log_dir_path{log_dir_path} {
+TraceLog::TraceLog(const std::string &log_dir_path, bool pcs_only, bool read_threads)
+    : m_log_dir_path{log_dir_path}, m_pcs_only{pcs_only} {
+    m_opts.dict = CompressionDict::read_sidecar(m_log_dir_path);
+
     Signpost meta_sp("TraceLog", "meta.bin read");
     meta_sp.start();
     CompressedFile<log_meta_hdr> meta_fh{m_log_dir_path / "meta.bin", true};
@@ -65,6 +311,7 @@ TraceLog::TraceLog(const std::string &log_dir_path) : m_log_dir_path{log_dir_pat
 
     Signpost regions_sp("TraceLog", "regions read");
     regions_sp.start();
+    const auto regions_buf = meta_buf.data() + meta_hdr.region_store_path_len;
     std::vector<fs::path> regions_paths;
     regions_paths.reserve(meta_hdr.num_regions);
     for (const auto &dirent : std::filesystem::directory_iterator{log_dir_path}) {
@@ -73,6 +320,21 @@ TraceLog::TraceLog(const std::string &log_dir_path) : m_log_dir_path{log_dir_pat
         }
         regions_paths.emplace_back(dirent.path());
     }
+    // with a store only the JIT regions are in the bundle
+    if (meta_hdr.region_store_path_len) {
+        const RegionStore store{std::string{(const char *)meta_buf.data(),
+                                            meta_hdr.region_store_path_len}};
+        auto region_ptr = (const log_region *)regions_buf;
+        for (uint64_t i = 0; i < meta_hdr.num_regions; ++i) {
+            if (!region_ptr->is_jit) {
+                sha256_t digest;
+                memcpy(digest.data(), region_ptr->digest_sha256, digest.size());
+                regions_paths.emplace_back(store.object_path(digest));
+            }
+            region_ptr = (const log_region *)((const uint8_t *)region_ptr + sizeof(*region_ptr) +
+                                              region_ptr->path_len);
+        }
+    }
     assert(regions_paths.size() == meta_hdr.num_regions);
 
     std::vector<std::pair<sha256_t, std::vector<uint8_t>>> regions_bytes_vec(meta_hdr.num_regions);
@@ -92,7 +354,7 @@ TraceLog::TraceLog(const std::string &log_dir_path) : m_log_dir_path{log_dir_pat
         regions_bytes.emplace(digest, std::move(bytes));
     }
 
-    auto region_ptr = (log_region *)meta_buf.data();
+    auto region_ptr = (log_region *)regions_buf;
     m_macho_regions =
         std::make_unique<MachORegions>(region_ptr, meta_hdr.num_regions, regions_bytes);
     for (uint64_t i = 0; i < meta_hdr.num_regions; ++i) {
@@ -114,32 +376,91 @@ TraceLog::TraceLog(const std::string &log_dir_path) : m_log_dir_path{log_dir_pat
     Signpost threads_sp("TraceLog", "threads read & parse");
     threads_sp.start();
 
-    std::vector<fs::path> thread_paths;
     for (const auto &dirent : std::filesystem::directory_iterator{log_dir_path}) {
         const auto fn = dirent.path().filename();
-        if (fn == "meta.bin" || fn.string().starts_with("macho-region-")) {
+        if (fn == "meta.bin" || fn == CompressionDict::sidecar_name ||
+            fn.string().starts_with("macho-region-") || is_log_column_path(fn) ||
+            is_seek_index_path(fn) || is_gpr_checkpoints_path(fn)) {
             continue;
         }
         assert(fn.string().starts_with("thread-"));
-        thread_paths.emplace_back(dirent.path());
+        m_thread_paths.emplace_back(dirent.path());
+    }
+    if (!read_threads) {
+        threads_sp.end();
+        return;
     }
 
-    std::vector<std::pair<uint32_t, log_thread_buf>> parsed_logs_vec(thread_paths.size());
-    xnutrace_pool.wait_on_n_tasks(thread_paths.size(), [&](const auto i) {
-        const auto path = thread_paths[i];
+    // uncompressed files are mapped instead of copied out, v1 records are then used in place.
+    // Files with a header that leaves them unaligned are copied like compressed ones.
+    const auto read_body =
+        [](jev::xnutrace::detail::CompressedFile &fh) -> std::pair<std::shared_ptr<const void>,
+                                                                   std::span<const uint8_t>> {
+        if (!fh.is_compressed()) {
+            auto mapping     = fh.map();
+            const auto bytes = mapping->data();
+            if (!((uintptr_t)bytes.data() % 16)) {
+                return {std::move(mapping), bytes};
+            }
+        }
+        auto buf = std::make_shared<const std::vector<uint8_t>>(fh.read());
+        const std::span<const uint8_t> bytes{*buf};
+        return {std::move(buf), bytes};
+    };
+
+    std::vector<std::pair<uint32_t, log_thread_buf>> parsed_logs_vec(m_thread_paths.size());
+    xnutrace_pool.wait_on_n_tasks(m_thread_paths.size(), [&](const auto i) {
+        const auto path = m_thread_paths[i];
         Signpost thread_read_sp("TraceLogThreads",
                                 fmt::format("{:s} read", path.filename().string()));
         thread_read_sp.start();
-        CompressedFile<log_thread_hdr> thread_fh{path, true};
-        auto thread_buf       = thread_fh.read();
-        const auto thread_hdr = thread_fh.header();
+        CompressedFile<log_thread_hdr> thread_fh{path, true, nullptr, 0, false, m_opts.dict.get()};
+        const auto [thread_owner, thread_bytes] = read_body(thread_fh);
+        const auto thread_hdr                   = thread_fh.header();
         thread_read_sp.end();
 
         Signpost thread_parse_sp("TraceLogThreads",
                                  fmt::format("{:s} parse", path.filename().string()));
         thread_parse_sp.start();
-        parsed_logs_vec[i] = std::make_pair(
-            thread_hdr.thread_id, log_thread_buf(std::move(thread_buf), thread_hdr.num_inst));
+        if (thread_hdr.record_format == (uint8_t)record_format::v1) {
+            parsed_logs_vec[i] = std::make_pair(
+                thread_hdr.thread_id,
+                log_thread_buf({thread_bytes}, thread_owner, thread_hdr.num_inst));
+            thread_parse_sp.end();
+            return;
+        }
+        std::vector<uint8_t> v1_buf;
+        if (thread_hdr.record_format == (uint8_t)record_format::v2) {
+            v1_buf.reserve(LogMsgV2Decoder::decoded_size(thread_bytes));
+            LogMsgV2Decoder{}.decode(thread_bytes, v1_buf);
+        } else if (thread_hdr.record_format == (uint8_t)record_format::columnar) {
+            const auto read_column = [&](log_column column) {
+                CompressedFile<log_thread_hdr> column_fh{
+                    log_column_path(path, column), true, nullptr, 0, false, m_opts.dict.get()};
+                return read_body(column_fh);
+            };
+            if (pcs_only) {
+                const auto [pcs_owner, pcs] = read_column(log_column::pc);
+                v1_buf.reserve(thread_bytes.size() + pcs.size());
+                const auto pcs_taken = join_pc_log_msgs(thread_bytes, pcs, v1_buf);
+                assert(pcs_taken == pcs.size());
+            } else {
+                std::array<std::shared_ptr<const void>, log_column_num> column_owners;
+                log_column_spans_t column_spans;
+                size_t sz = thread_bytes.size();
+                for (size_t j = 0; j < log_column_num; ++j) {
+                    std::tie(column_owners[j], column_spans[j]) = read_column((log_column)j);
+                    sz += column_spans[j].size();
+                }
+                v1_buf.reserve(sz);
+                const auto taken = join_log_msgs(thread_bytes, column_spans, v1_buf);
+                for (size_t j = 0; j < log_column_num; ++j) {
+                    assert(taken[j] == column_spans[j].size());
+                }
+            }
+        }
+        parsed_logs_vec[i] = std::make_pair(thread_hdr.thread_id,
+                                            log_thread_buf(std::move(v1_buf), thread_hdr.num_inst));
         thread_parse_sp.end();
     });
 
@@ -151,18 +472,26 @@ TraceLog::TraceLog(const std::string &log_dir_path) : m_log_dir_path{log_dir_pat
 }
 
 uint64_t TraceLog::num_inst() const {
-    return m_num_inst;
+    uint64_t num = m_num_inst;
+    m_thread_ctxs.for_each([&](auto, const auto &ctx) {
+        num += ctx.num_inst;
+    });
+    return num;
+}
+
+uint64_t TraceLog::num_dropped() const {
+    uint64_t num = 0;
+    m_thread_ctxs.for_each([&](auto, const auto &ctx) {
+        num += ctx.num_dropped;
+    });
+    return num;
 }
 
 size_t TraceLog::num_bytes() const {
     size_t sz = 0;
-    for (const auto &[tid, ctx] : m_thread_ctxs) {
-        if (!m_stream) {
-            sz += ctx.log_buf.size();
-        } else {
-            sz += ctx.log_stream->decompressed_size();
-        }
-    }
+    m_thread_ctxs.for_each([&](auto, const auto &ctx) {
+        sz += ctx.num_bytes;
+    });
     return sz;
 }
 
@@ -180,6 +509,60 @@ const std::map<uint32_t, log_thread_buf> &TraceLog::parsed_logs() const {
     return m_parsed_logs;
 }
 
+std::vector<std::unique_ptr<LogThreadStream>> TraceLog::thread_streams(size_t window_sz) const {
+    std::vector<std::unique_ptr<LogThreadStream>> streams;
+    for (const auto &path : m_thread_paths) {
+        streams.emplace_back(std::make_unique<LogThreadStream>(
+            path, m_pcs_only, m_opts.dict,
+            window_sz ? window_sz : LogThreadStream::default_window_sz));
+    }
+    std::sort(streams.begin(), streams.end(), [](const auto &a, const auto &b) {
+        return a->thread_id() < b->thread_id();
+    });
+    return streams;
+}
+
+std::optional<log_arm64_cpu_context> TraceLog::context_at(uint32_t tid, uint64_t inst_idx,
+                                                          bool gprs_only) const {
+    const auto log = m_parsed_logs.find(tid);
+    // pcs_only columnar logs have no registers to replay
+    if (m_pcs_only || log == m_parsed_logs.end()) {
+        return std::nullopt;
+    }
+    const ThreadContextIndex *index;
+    {
+        std::lock_guard lock{m_ctx_indexes_lock};
+        auto &thread_index = m_ctx_indexes[tid];
+        if (!thread_index) {
+            thread_index = std::make_unique<ThreadContextIndex>(log->second);
+            thread_index->read_gpr_checkpoints(
+                gpr_checkpoints_path(m_log_dir_path / fmt::format("thread-{:d}.bin", tid)));
+        }
+        index = thread_index.get();
+    }
+    return gprs_only ? index->gpr_context_at(inst_idx) : index->context_at(inst_idx);
+}
+
+void TraceLog::write_gpr_checkpoints(uint64_t interval) {
+    assert(!m_pcs_only && "GPR checkpoints need the registers pcs_only leaves out");
+    std::vector<std::pair<uint32_t, const log_thread_buf *>> logs;
+    for (const auto &[tid, log] : m_parsed_logs) {
+        logs.emplace_back(tid, &log);
+    }
+    std::vector<std::unique_ptr<ThreadContextIndex>> indexes(logs.size());
+    xnutrace_pool.wait_on_n_tasks(logs.size(), [&](const auto i) {
+        const auto [tid, log] = logs[i];
+        indexes[i]            = std::make_unique<ThreadContextIndex>(*log);
+        indexes[i]->build_gpr_checkpoints(interval);
+        indexes[i]->write_gpr_checkpoints(
+            gpr_checkpoints_path(m_log_dir_path / fmt::format("thread-{:d}.bin", tid)));
+    });
+    std::lock_guard lock{m_ctx_indexes_lock};
+    for (size_t i = 0; i < logs.size(); ++i) {
+        m_ctx_indexes[logs[i].first] = std::move(indexes[i]);
+    }
+}
+
 static uint64x2_t interleave_uint64x2_with_zeros_16bit(uint64x2_t input) {
     uint64x2_t word = input;
     word            = (word ^ (word << 8)) & 0x00ff'00ff;
@@ -189,17 +572,98 @@ static uint64x2_t interleave_uint64x2_with_zeros_16bit(uint64x2_t input) {
     return word;
 }
 
+// Appends the branch target and/or new SP after a record header, as varint deltas when enabled
+// and every delta fits. Returns the vec_changed flags describing the encoding.
+static XNUTRACE_INLINE uint32_t encode_pc_sp(uint8_t *&buf_ptr, bool delta, bool pc_branched,
+                                             uint64_t pc, uint64_t last_pc, bool sp_changed,
+                                             uint64_t sp, uint64_t last_sp) {
+    if (delta && (!pc_branched || pc_sp_delta_fits(pc, last_pc)) &&
+        (!sp_changed || pc_sp_delta_fits(sp, last_sp))) {
+        if (pc_branched) {
+            buf_ptr += varint_encode(buf_ptr, zigzag_encode((int64_t)(pc - last_pc)));
+        }
+        if (sp_changed) {
+            buf_ptr += varint_encode(buf_ptr, zigzag_encode((int64_t)(sp - last_sp)));
+        }
+        return rpc_set_pc_sp_delta(0);
+    }
+    if (pc_branched) {
+        memcpy(buf_ptr, &pc, sizeof(pc));
+        buf_ptr += sizeof(pc);
+    }
+    if (sp_changed) {
+        memcpy(buf_ptr, &sp, sizeof(sp));
+        buf_ptr += sizeof(sp);
+    }
+    return 0;
+}
+
+// Appends the memory access section after the vectors. Addresses are varint deltas from the
+// previous access unless one doesn't fit, values are read from the live process.
+static uint8_t *encode_mem_accesses(uint8_t *buf_ptr, const mem_accesses_t &accesses,
+                                    uint64_t &last_addr, bool values) {
+    uint32_t mem_changed = mpc_set_num_mem_accesses(0, accesses.size());
+    bool delta           = true;
+    auto prev_addr       = last_addr;
+    for (uint32_t i = 0; i < accesses.size(); ++i) {
+        const auto &access = accesses[i];
+        mem_changed        = mpc_set_mem_access_sz(mem_changed, i, access.size);
+        if (access.read) {
+            mem_changed = mpc_set_read(mem_changed, i);
+        }
+        if (access.write) {
+            mem_changed = mpc_set_write(mem_changed, i);
+        }
+        delta &= pc_sp_delta_fits(access.addr, prev_addr);
+        prev_addr = access.addr;
+    }
+    if (delta) {
+        mem_changed = mpc_set_addr_delta(mem_changed);
+    }
+    // Read before the instruction runs, so an access that is about to fault (guard pages,
+    // runtimes relying on SIGSEGV) must not fault here. Then the record keeps no values.
+    uint8_t values_buf[mpc_num_changed_max * log_msg::mem_access_sz_max];
+    size_t values_sz = 0;
+    for (uint32_t i = 0; values && i < accesses.size(); ++i) {
+        values = try_read_target(mach_task_self(), accesses[i].addr, &values_buf[values_sz],
+                                 accesses[i].size);
+        values_sz += accesses[i].size;
+    }
+    if (values) {
+        mem_changed = mpc_set_values(mem_changed);
+    }
+    memcpy(buf_ptr, &mem_changed, sizeof(mem_changed));
+    buf_ptr += sizeof(mem_changed);
+    for (const auto &access : accesses) {
+        if (delta) {
+            buf_ptr += varint_encode(buf_ptr, zigzag_encode((int64_t)(access.addr - last_addr)));
+        } else {
+            memcpy(buf_ptr, &access.addr, sizeof(access.addr));
+            buf_ptr += sizeof(access.addr);
+        }
+        last_addr = access.addr;
+    }
+    if (values) {
+        memcpy(buf_ptr, values_buf, values_sz);
+        buf_ptr += values_sz;
+    }
+    return buf_ptr;
+}
+
 // XNUTRACE_NOINLINE
-void TraceLog::thread_ctx::write_log_msg(const log_arm64_cpu_context *ctx, cs_insn *insn) {
+void TraceLog::thread_ctx::write_log_msg(const log_arm64_cpu_context *ctx,
+                                         const arm64_mem_insn *mem_insn) {
     // MCA_BEGIN("write_log_msg");
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wvla-extension"
     uint8_t __attribute__((uninitialized, aligned(16))) msg_buf[log_msg::size_full_ctx];
 #pragma clang diagnostic pop
 
-    (void)insn;
+    if (XNUTRACE_UNLIKELY(run_len)) {
+        flush_bb_run();
+    }
 
-    if (sz_since_last_sync >= sync_every) {
+    if (sync.due(sz_since_last_sync, inst_since_last_sync) || XNUTRACE_UNLIKELY(need_sync)) {
         write_sync();
     }
 
@@ -213,17 +677,17 @@ void TraceLog::thread_ctx::write_log_msg(const log_arm64_cpu_context *ctx, cs_in
     const auto last_pc_sp = *(uint64x2_t *)&last_cpu_ctx.pc;
     const auto pc_sp      = *(uint64x2_t *)&ctx->pc;
 #pragma clang diagnostic pop
-    const auto pc_sp_diff = pc_sp - last_pc_sp;
-    if (pc_sp_diff[0] != 4) {
-        gpr_changed          = rpc_set_pc_branched(gpr_changed);
-        *(uint64_t *)buf_ptr = pc_sp[0];
-        buf_ptr += sizeof(uint64_t);
+    const auto pc_sp_diff  = pc_sp - last_pc_sp;
+    const bool pc_branched = pc_sp_diff[0] != 4;
+    const bool sp_changed  = pc_sp_diff[1] != 0;
+    if (pc_branched) {
+        gpr_changed = rpc_set_pc_branched(gpr_changed);
     }
-    if (pc_sp_diff[1] != 0) {
-        gpr_changed          = rpc_set_sp_changed(gpr_changed);
-        *(uint64_t *)buf_ptr = pc_sp[1];
-        buf_ptr += sizeof(uint64_t);
+    if (sp_changed) {
+        gpr_changed = rpc_set_sp_changed(gpr_changed);
     }
+    vec_changed = encode_pc_sp(buf_ptr, delta_pc_sp, pc_branched, pc_sp[0], last_pc_sp[0],
+                               sp_changed, pc_sp[1], last_pc_sp[1]);
 
     const auto last_x2  = (uint64x2_t *)&last_cpu_ctx.x[0];
     const auto x2       = (uint64x2_t *)&ctx->x[0];
@@ -253,7 +717,8 @@ void TraceLog::thread_ctx::write_log_msg(const log_arm64_cpu_context *ctx, cs_in
     const auto *gpr_ptr = (uint64_t *)&ctx->x[0];
     for (int i = 0; i < 31; ++i) {
         if ((x_diff >> i) & 1) {
-            *(uint64_t *)buf_ptr = gpr_ptr[i];
+            // varint deltas in front leave buf_ptr unaligned
+            memcpy(buf_ptr, &gpr_ptr[i], sizeof(uint64_t));
             buf_ptr += sizeof(uint64_t);
             gpr_changed = rpc_set_reg_idx(gpr_changed, gpr_idx++, i);
         }
@@ -265,150 +730,387 @@ void TraceLog::thread_ctx::write_log_msg(const log_arm64_cpu_context *ctx, cs_in
     uint8_t vec_idx = 0;
     for (int i = 0; i < 32; ++i) {
         if ((v_diff >> i) & 1) {
-            *(uint128_t *)buf_ptr = *(uint128_t *)&ctx->v[i];
+            memcpy(buf_ptr, &ctx->v[i], sizeof(uint128_t));
             buf_ptr += sizeof(uint128_t);
             vec_changed = rpc_set_reg_idx(vec_changed, vec_idx++, i);
         }
     }
 
+    // addresses are computed from the registers before the instruction executes, i.e. ctx
+    if (XNUTRACE_UNLIKELY(mem_accesses) && mem_insn) {
+        if (const auto accesses = mem_insn->accesses(*ctx); !accesses.empty()) {
+            vec_changed = rpc_set_mem(vec_changed);
+            buf_ptr     = encode_mem_accesses(buf_ptr, accesses, last_mem_addr, mem_values);
+        }
+    }
+
     msg_hdr->gpr_changed = gpr_changed;
     msg_hdr->vec_changed = vec_changed;
 
     const auto msg_sz = buf_ptr - msg_buf;
-    if (!log_stream) {
-        std::copy(msg_buf, buf_ptr, std::back_inserter(log_buf));
+    if (XNUTRACE_LIKELY(!ring_dropped) && XNUTRACE_LIKELY(emit(msg_buf, msg_sz))) {
+        sz_since_last_sync += msg_sz;
     } else {
-        log_stream->write(msg_buf, msg_sz);
+        ++num_dropped;
+        ring_dropped = true;
+        need_sync    = true;
     }
-    sz_since_last_sync += msg_sz;
 
     memcpy(&last_cpu_ctx, ctx, sizeof(last_cpu_ctx));
     ++num_inst;
+    ++inst_since_last_sync;
     // MCA_END();
 }
 
 void TraceLog::thread_ctx::write_log_msg(uint64_t pc) {
+    if (bb_runs) {
+        write_bb_run_pc(pc);
+        return;
+    }
+
     uint8_t __attribute__((uninitialized, aligned(16))) msg_buf[sizeof(log_msg) + sizeof(uint64_t)];
-    auto *msg_hdr        = (log_msg *)msg_buf;
-    uint8_t *buf_ptr     = msg_buf + sizeof(log_msg);
-    uint32_t gpr_changed = 0;
 
-    if (last_cpu_ctx.pc + 4 != pc) {
-        gpr_changed          = rpc_set_pc_branched(gpr_changed);
-        *(uint64_t *)buf_ptr = pc;
-        buf_ptr += sizeof(uint64_t);
+    if (sync.due(sz_since_last_sync, inst_since_last_sync) || XNUTRACE_UNLIKELY(need_sync)) {
+        write_sync();
     }
-    msg_hdr->gpr_changed = gpr_changed;
-    msg_hdr->vec_changed = 0;
+
+    auto *msg_hdr          = (log_msg *)msg_buf;
+    uint8_t *buf_ptr       = msg_buf + sizeof(log_msg);
+    const bool pc_branched = last_cpu_ctx.pc + 4 != pc;
+    msg_hdr->gpr_changed   = pc_branched ? rpc_set_pc_branched(0) : 0;
+    msg_hdr->vec_changed =
+        encode_pc_sp(buf_ptr, delta_pc_sp, pc_branched, pc, last_cpu_ctx.pc, false, 0, 0);
     const auto msg_sz    = buf_ptr - (uint8_t *)msg_hdr;
-    if (!log_stream) {
-        std::copy(msg_buf, buf_ptr, std::back_inserter(log_buf));
+    if (XNUTRACE_LIKELY(!ring_dropped) && XNUTRACE_LIKELY(emit(msg_buf, msg_sz))) {
+        sz_since_last_sync += msg_sz;
     } else {
-        log_stream->write(msg_buf, msg_sz);
+        ++num_dropped;
+        ring_dropped = true;
+        need_sync    = true;
     }
     last_cpu_ctx.pc = pc;
     ++num_inst;
+    ++inst_since_last_sync;
 }
 
-void TraceLog::thread_ctx::write_sync() {
-    if (!log_stream) {
-        std::copy((uint8_t *)&log_msg::sync_frame_buf_hdr,
-                  (uint8_t *)&log_msg::sync_frame_buf_hdr + sizeof(log_msg::sync_frame_buf_hdr),
-                  std::back_inserter(log_buf));
-        std::copy((uint8_t *)&num_inst, (uint8_t *)&num_inst + sizeof(num_inst),
-                  std::back_inserter(log_buf));
-        std::copy((uint8_t *)&last_cpu_ctx, (uint8_t *)&last_cpu_ctx + sizeof(last_cpu_ctx),
-                  std::back_inserter(log_buf));
-    } else {
-        log_stream->write((uint8_t *)&log_msg::sync_frame_buf_hdr,
-                          sizeof(log_msg::sync_frame_buf_hdr));
-        log_stream->write((uint8_t *)&num_inst, sizeof(num_inst));
-        log_stream->write((uint8_t *)&last_cpu_ctx, sizeof(last_cpu_ctx));
-    }
-    sz_since_last_sync = 0;
-}
-
-void TraceLog::log(thread_t thread, const log_arm64_cpu_context *context, cs_insn *insn) {
-    thread_ctx *tctx;
-    if (!m_thread_ctxs.contains(thread)) {
-        std::unique_ptr<CompressedFile<log_thread_hdr>> log_stream;
-        if (m_stream) {
-            log_thread_hdr thread_hdr{.thread_id = thread};
-            log_stream = std::make_unique<CompressedFile<log_thread_hdr>>(
-                m_log_dir_path / fmt::format("thread-{:d}.bin", thread), false, &thread_hdr,
-                m_compression_level);
-        }
-        auto [new_thread_ctx, added] =
-            m_thread_ctxs.try_emplace(thread, thread_ctx{.log_stream = std::move(log_stream)});
-        assert(added);
-        memcpy(&new_thread_ctx.last_cpu_ctx, context, sizeof(new_thread_ctx.last_cpu_ctx));
-        tctx = &new_thread_ctx;
+void TraceLog::thread_ctx::write_bb_run_pc(uint64_t pc) {
+    if (sync.due(sz_since_last_sync, inst_since_last_sync) || XNUTRACE_UNLIKELY(need_sync)) {
+        flush_bb_run();
+        write_sync();
+    }
+    if (XNUTRACE_LIKELY(run_len) && last_cpu_ctx.pc + 4 == pc &&
+        XNUTRACE_LIKELY(run_len != rpc_bb_run_len_max)) {
+        ++run_len;
     } else {
-        tctx = &m_thread_ctxs[thread];
+        flush_bb_run();
+        run_branched = last_cpu_ctx.pc + 4 != pc;
+        run_prev_pc  = last_cpu_ctx.pc;
+        run_len      = 1;
     }
-    tctx->write_log_msg(context, insn);
-    ++m_num_inst;
+    last_cpu_ctx.pc = pc;
+    ++num_inst;
+    ++inst_since_last_sync;
 }
 
-void TraceLog::log(thread_t thread, uint64_t pc) {
-    thread_ctx *tctx;
-    if (!m_thread_ctxs.contains(thread)) {
-        std::unique_ptr<CompressedFile<log_thread_hdr>> log_stream;
-        if (m_stream) {
-            log_thread_hdr thread_hdr{.thread_id = thread};
-            log_stream = std::make_unique<CompressedFile<log_thread_hdr>>(
-                m_log_dir_path / fmt::format("thread-{:d}.bin", thread), false, &thread_hdr,
-                m_compression_level);
-        }
-        auto [new_thread_ctx, added] =
-            m_thread_ctxs.try_emplace(thread, thread_ctx{.log_stream = std::move(log_stream)});
-        assert(added);
-        const auto context = log_arm64_cpu_context{.pc = pc};
-        memcpy(&new_thread_ctx.last_cpu_ctx, &context, sizeof(new_thread_ctx.last_cpu_ctx));
-        tctx = &new_thread_ctx;
+void TraceLog::thread_ctx::flush_bb_run() {
+    if (!run_len) {
+        return;
+    }
+    uint8_t __attribute__((uninitialized, aligned(16))) msg_buf[sizeof(log_msg) + sizeof(uint64_t)];
+    auto *msg_hdr    = (log_msg *)msg_buf;
+    uint8_t *buf_ptr = msg_buf + sizeof(log_msg);
+    // single instruction runs are plain records
+    uint32_t gpr_changed = run_len > 1 ? rpc_set_bb_run(0) : 0;
+    if (run_branched) {
+        gpr_changed = rpc_set_pc_branched(gpr_changed);
+    }
+    // last_cpu_ctx.pc is the last instruction of the run
+    const auto vec_changed = encode_pc_sp(buf_ptr, delta_pc_sp, run_branched,
+                                          last_cpu_ctx.pc - (run_len - 1) * 4, run_prev_pc, false,
+                                          0, 0);
+    msg_hdr->gpr_changed   = gpr_changed;
+    msg_hdr->vec_changed   = vec_changed | (run_len > 1 ? run_len : 0);
+    const auto msg_sz    = buf_ptr - msg_buf;
+    if (XNUTRACE_LIKELY(!ring_dropped) && XNUTRACE_LIKELY(emit(msg_buf, msg_sz))) {
+        sz_since_last_sync += msg_sz;
     } else {
-        tctx = &m_thread_ctxs[thread];
+        num_dropped += run_len;
+        ring_dropped = true;
+        need_sync    = true;
     }
-    tctx->write_log_msg(pc);
-    ++m_num_inst;
+    run_len = 0;
 }
 
-void TraceLog::write(const MachORegions &macho_regions, const Symbols *symbols) {
-    absl::flat_hash_map<uint32_t, log_thread_buf> thread_bufs;
-    if (!m_stream) {
-        for (auto &[tid, ctx] : m_thread_ctxs) {
-            const auto tbuf = log_thread_buf(std::move(ctx.log_buf), ctx.num_inst);
-            thread_bufs.try_emplace(tid, tbuf);
+void TraceLog::thread_ctx::write_log_msgs(std::span<const uint64_t> pcs) {
+    if (bb_runs || (log_ring && drop_on_full)) {
+        // bb runs span calls and records may be dropped individually, use the per-record path
+        for (const auto pc : pcs) {
+            write_log_msg(pc);
         }
+        return;
     }
 
-    interval_tree_t<uint64_t> pc_intervals;
-    if (!m_stream) {
-        absl::flat_hash_set<uint64_t> pcs;
-        for (auto &[tid, tbuf] : thread_bufs) {
-            for (const auto pc : extract_pcs_from_trace(tbuf)) {
-                pcs.emplace(pc);
+    // encode runs of records back to back and emit them in bulk, flushing before each sync frame
+    // so the byte stream matches the one write_log_msg(pc) produces
+    constexpr size_t max_msg_sz = sizeof(log_msg) + sizeof(uint64_t);
+    uint8_t __attribute__((uninitialized, aligned(16))) batch_buf[4096];
+    size_t batch_sz = 0;
+    for (const auto pc : pcs) {
+        if (XNUTRACE_UNLIKELY(sync.due(sz_since_last_sync, inst_since_last_sync) || need_sync)) {
+            if (batch_sz) {
+                emit(batch_buf, batch_sz);
+                batch_sz = 0;
             }
+            write_sync();
         }
-        for (const auto pc : pcs) {
-            pc_intervals.insert_overlap({pc, pc + 4});
+        auto *msg_hdr          = (log_msg *)&batch_buf[batch_sz];
+        uint8_t *buf_ptr       = &batch_buf[batch_sz] + sizeof(log_msg);
+        const bool pc_branched = last_cpu_ctx.pc + 4 != pc;
+        msg_hdr->gpr_changed   = pc_branched ? rpc_set_pc_branched(0) : 0;
+        msg_hdr->vec_changed =
+            encode_pc_sp(buf_ptr, delta_pc_sp, pc_branched, pc, last_cpu_ctx.pc, false, 0, 0);
+        const auto msg_sz    = buf_ptr - (uint8_t *)msg_hdr;
+        batch_sz += msg_sz;
+        sz_since_last_sync += msg_sz;
+        last_cpu_ctx.pc = pc;
+        ++num_inst;
+        ++inst_since_last_sync;
+        if (XNUTRACE_UNLIKELY(batch_sz > sizeof(batch_buf) - max_msg_sz)) {
+            emit(batch_buf, batch_sz);
+            batch_sz = 0;
         }
-    } else {
-        // FIXME: streams just add all symbols
-        for (const auto &region : macho_regions.regions()) {
-            pc_intervals.insert_overlap({region.base, region.base + region.size});
+    }
+    if (batch_sz) {
+        emit(batch_buf, batch_sz);
+    }
+}
+
+bool TraceLog::thread_ctx::emit(const void *buf, size_t sz) {
+    const auto v1_sz = sz;
+    if (v2_encoder) {
+        v2_buf.clear();
+        v2_encoder->encode({(const uint8_t *)buf, sz}, v2_buf);
+        buf = v2_buf.data();
+        sz  = v2_buf.size();
+    }
+    if (!log_stream) {
+        log_buf.append(buf, sz);
+    } else if (!log_ring) {
+        if (log_columns) {
+            log_columns->write(*log_stream, {(const uint8_t *)buf, sz});
+        } else {
+            log_stream->write(buf, sz);
         }
+    } else if (!drop_on_full) {
+        log_ring->push(buf, sz);
+    } else if (XNUTRACE_UNLIKELY(!log_ring->try_push(buf, sz))) {
+        return false;
+    }
+    num_bytes += v1_sz;
+    file_bytes += sz;
+    if (XNUTRACE_UNLIKELY(num_bytes >= spill_check_at)) {
+        owner->account_mem(*this);
     }
+    return true;
+}
 
-    std::vector<sym_info> syms;
-    if (symbols) {
-        const auto all_syms = symbols->syms();
-        syms                = get_symbols_in_intervals(all_syms, pc_intervals);
+void TraceLog::thread_ctx::write_sync() {
+    if (XNUTRACE_UNLIKELY(spill_pending)) {
+        // the new in-memory segment starts with the sync frame below
+        owner->spill(*this);
+    }
+    if (XNUTRACE_UNLIKELY(num_bytes >= checkpoint_at)) {
+        // a recovered file ends right before the sync frame below
+        log_stream->header().num_inst = num_inst;
+        log_stream->checkpoint();
+        checkpoint_at = num_bytes + owner->m_opts.checkpoint_bytes;
+    }
+    // emitted in one piece so a full ring drops the whole frame, never a prefix of it
+    uint8_t __attribute__((uninitialized, aligned(16))) sync_buf[log_msg::size_full_ctx];
+    memcpy(sync_buf, log_msg::sync_frame_buf_hdr, sizeof(log_msg::sync_frame_buf_hdr));
+    const uint64_t sync_num_inst = num_inst;
+    memcpy(sync_buf + sizeof(log_msg::sync_frame_buf_hdr), &sync_num_inst, sizeof(sync_num_inst));
+    memcpy(sync_buf + log_msg::sync_frame_sz, &last_cpu_ctx, sizeof(last_cpu_ctx));
+    const auto sync_off = file_bytes - segment_start;
+    need_sync           = !emit(sync_buf, sizeof(sync_buf));
+    ring_dropped        = need_sync;
+    if (XNUTRACE_LIKELY(!need_sync) && owner->m_opts.format != record_format::columnar) {
+        sync_points.emplace_back(seek_point{.key = sync_num_inst, .decomp_off = sync_off});
+    }
+    sz_since_last_sync   = 0;
+    inst_since_last_sync = 0;
+    last_mem_addr        = 0;
+}
+
+std::unique_ptr<TraceLog::thread_ctx>
+TraceLog::new_thread_ctx(thread_t thread, const log_arm64_cpu_context &context) {
+    std::unique_ptr<CompressedFile<log_thread_hdr>> log_stream;
+    std::unique_ptr<LogColumnWriter> log_columns;
+    std::unique_ptr<SPSCRing> log_ring;
+    if (m_stream) {
+        log_stream = open_thread_file(thread, log_columns);
+        if (m_async_writer) {
+            log_ring = std::make_unique<SPSCRing>(m_opts.async_ring_sz);
+            m_async_writer->add(log_ring.get(), log_stream.get());
+        }
+    }
+    auto tctx = std::make_unique<thread_ctx>(
+        thread_ctx{.log_stream   = std::move(log_stream),
+                   .log_columns  = std::move(log_columns),
+                   .log_ring     = std::move(log_ring),
+                   .sync         = m_opts.sync,
+                   .bb_runs      = m_opts.bb_runs,
+                   .delta_pc_sp  = m_opts.delta_pc_sp,
+                   .mem_accesses = m_opts.mem_accesses,
+                   .mem_values   = m_opts.mem_values,
+                   .drop_on_full = m_opts.backpressure == backpressure_policy::drop});
+    memcpy(&tctx->last_cpu_ctx, &context, sizeof(tctx->last_cpu_ctx));
+    if (m_stream && m_opts.format == record_format::v2) {
+        tctx->v2_encoder = std::make_unique<LogMsgV2Encoder>();
+    }
+    tctx->owner     = this;
+    tctx->thread_id = thread;
+    if (m_spill_writer) {
+        tctx->spill_check_at = spill_check_every;
+    }
+    if (m_stream && !m_async_writer && m_opts.format != record_format::columnar &&
+        m_opts.checkpoint_bytes) {
+        tctx->checkpoint_at = m_opts.checkpoint_bytes;
+    }
+    return tctx;
+}
+
+void TraceLog::account_mem(thread_ctx &ctx) {
+    const auto total = m_mem_bytes.fetch_add(ctx.num_bytes - ctx.mem_accounted) +
+                       (ctx.num_bytes - ctx.mem_accounted);
+    ctx.mem_accounted  = ctx.num_bytes;
+    ctx.spill_check_at = ctx.num_bytes + spill_check_every;
+    if (total > m_opts.mem_budget) {
+        // spill at the next sync frame so every spilled segment starts with one
+        ctx.spill_pending = true;
+        ctx.need_sync     = true;
+    }
+}
+
+void TraceLog::spill(thread_ctx &ctx) {
+    ctx.spill_pending = false;
+    if (!ctx.log_buf.size()) {
+        return;
+    }
+    if (!ctx.spill_file) {
+        ctx.spill_file = open_thread_file(ctx.thread_id, ctx.log_columns);
+    }
+    m_mem_bytes.fetch_add(ctx.num_bytes - ctx.mem_accounted);
+    ctx.mem_accounted = ctx.num_bytes;
+    m_spill_writer->submit(ctx.spill_file.get(), ctx.log_columns.get(), &ctx.spilled_ranges,
+                           std::move(ctx.log_buf), std::move(ctx.sync_points));
+    ctx.log_buf       = ChunkedArena{};
+    ctx.sync_points   = {};
+    ctx.segment_start = ctx.file_bytes;
+}
+
+std::unique_ptr<CompressedFile<log_thread_hdr>>
+TraceLog::open_thread_file(uint32_t thread, std::unique_ptr<LogColumnWriter> &columns) const {
+    const log_thread_hdr thread_hdr{.thread_id     = thread,
+                                    .sync_interval = m_opts.sync.interval,
+                                    .sync_mode     = (uint8_t)m_opts.sync.mode,
+                                    .record_format = (uint8_t)m_opts.format};
+    const auto path = m_log_dir_path / fmt::format("thread-{:d}.bin", thread);
+    if (m_opts.format == record_format::columnar) {
+        columns = std::make_unique<LogColumnWriter>(path, thread_hdr, m_compression_level,
+                                                    m_opts.dict.get());
     }
+    return std::make_unique<CompressedFile<log_thread_hdr>>(
+        path, false, &thread_hdr, m_compression_level, false /* verbose */, m_opts.dict.get());
+}
 
-    const log_meta_hdr meta_hdr_buf{.num_regions = macho_regions.regions().size(),
-                                    .num_syms    = syms.size()};
+void TraceLog::log(thread_t thread, const log_arm64_cpu_context *context,
+                   const arm64_mem_insn *mem_insn) {
+    auto &tctx = m_thread_ctxs.get_or_create(thread, [&] {
+        return new_thread_ctx(thread, *context);
+    });
+    tctx.write_log_msg(context, mem_insn);
+}
+
+void TraceLog::log(thread_t thread, uint64_t pc) {
+    auto &tctx = m_thread_ctxs.get_or_create(thread, [&] {
+        return new_thread_ctx(thread, log_arm64_cpu_context{.pc = pc});
+    });
+    tctx.write_log_msg(pc);
+}
+
+void TraceLog::log_batch(thread_t thread, std::span<const uint64_t> pcs) {
+    if (pcs.empty()) {
+        return;
+    }
+    auto &tctx = m_thread_ctxs.get_or_create(thread, [&] {
+        return new_thread_ctx(thread, log_arm64_cpu_context{.pc = pcs.front()});
+    });
+    tctx.write_log_msgs(pcs);
+}
+
+void TraceLog::log_batch(thread_t thread, std::span<const log_arm64_cpu_context> contexts) {
+    if (contexts.empty()) {
+        return;
+    }
+    auto &tctx = m_thread_ctxs.get_or_create(thread, [&] {
+        return new_thread_ctx(thread, contexts.front());
+    });
+    for (const auto &ctx : contexts) {
+        tctx.write_log_msg(&ctx, nullptr);
+    }
+}
+
+namespace {
+
+// FIXME: streams just add all symbols
+std::vector<sym_info> get_symbols_in_regions(const MachORegions &macho_regions,
+                                             const Symbols *symbols) {
+    if (!symbols) {
+        return {};
+    }
+    interval_tree_t<uint64_t> intervals;
+    for (const auto &region : macho_regions.regions()) {
+        intervals.insert_overlap({region.base, region.base + region.size});
+    }
+    const auto all_syms = symbols->syms();
+    return get_symbols_in_intervals(all_syms, intervals);
+}
+
+} // namespace
+
+void TraceLog::write_stream_meta(const MachORegions &macho_regions, const Symbols *symbols) {
+    if (!m_stream) {
+        return;
+    }
+    std::vector<std::function<void()>> file_jobs;
+    write_meta(macho_regions, get_symbols_in_regions(macho_regions, symbols), file_jobs);
+    xnutrace_pool.wait_on_n_tasks_limited(file_jobs.size(), m_opts.write_concurrency,
+                                          [&](const auto i) {
+                                              file_jobs[i]();
+                                          });
+}
+
+void TraceLog::write_meta(const MachORegions &macho_regions, const std::vector<sym_info> &syms,
+                          std::vector<std::function<void()>> &file_jobs) {
+    std::map<sha256_t, const image_info *> store_regions;
+    if (m_region_store) {
+        std::vector<sha256_t> digests;
+        for (const auto &region : macho_regions.regions()) {
+            if (!region.is_jit && store_regions.emplace(region.digest, &region).second) {
+                digests.emplace_back(region.digest);
+            }
+        }
+        // before meta.bin is opened, a young ref keeps gc() away from the half written bundle
+        m_region_store->set_ref(m_log_dir_path, digests);
+    }
+    const auto store_path = m_region_store ? m_region_store->path().string() : std::string{};
+
+    const log_meta_hdr meta_hdr_buf{.num_regions           = macho_regions.regions().size(),
+                                    .num_syms              = syms.size(),
+                                    .region_store_path_len = store_path.size()};
     CompressedFile<log_meta_hdr> meta_fh{m_log_dir_path / "meta.bin", false, &meta_hdr_buf, 0};
+    meta_fh.write(store_path.c_str(), store_path.size());
 
     for (const auto &region : macho_regions.regions()) {
         log_region region_buf{.base     = region.base,
@@ -432,9 +1134,12 @@ void TraceLog::write(const MachORegions &macho_regions, const Symbols *symbols)
         meta_fh.write(sym.path.c_str(), sym.path.string().size());
     }
 
-    // find macho-region-*.bin that are unchanged
+    // find macho-region-*.bin that are unchanged, regions in the store don't keep theirs
     std::set<fs::path> reused_macho_regions;
     for (const auto &region : macho_regions.regions()) {
+        if (m_region_store && !region.is_jit) {
+            continue;
+        }
         const auto old_region = m_log_dir_path / region.log_path();
         if (!fs::exists(old_region)) {
             continue;
@@ -454,27 +1159,112 @@ void TraceLog::write(const MachORegions &macho_regions, const Symbols *symbols)
         }
     }
 
+    if (m_region_store) {
+        // the ref set above keeps every object found here from being collected
+        for (const auto &[digest, region] : store_regions) {
+            if (m_region_store->contains(digest)) {
+                continue;
+            }
+            file_jobs.emplace_back([&store = *m_region_store, region] {
+                store.put(region->digest, region->bytes);
+            });
+        }
+    }
     for (const auto &region : macho_regions.regions()) {
+        if (m_region_store && !region.is_jit) {
+            continue;
+        }
         const auto region_path = m_log_dir_path / region.log_path();
         if (reused_macho_regions.contains(region_path)) {
             continue;
         }
-        log_macho_region_hdr macho_region_hdr_buf{};
-        memcpy(macho_region_hdr_buf.digest_sha256, region.digest.data(), region.digest.size());
-        CompressedFile<log_macho_region_hdr> macho_region_fh{region_path, false,
-                                                             &macho_region_hdr_buf, 1};
-        macho_region_fh.write(region.bytes);
+        file_jobs.emplace_back([&region, region_path] {
+            log_macho_region_hdr macho_region_hdr_buf{};
+            memcpy(macho_region_hdr_buf.digest_sha256, region.digest.data(),
+                   region.digest.size());
+            CompressedFile<log_macho_region_hdr> macho_region_fh{region_path, false,
+                                                                 &macho_region_hdr_buf, 1};
+            macho_region_fh.write(region.bytes);
+        });
+    }
+}
+
+void TraceLog::write(const MachORegions &macho_regions, const Symbols *symbols) {
+    m_thread_ctxs.for_each([](auto, auto &ctx) {
+        ctx.flush_bb_run();
+    });
+    if (m_spill_writer) {
+        m_spill_writer->stop();
+    }
+
+    absl::flat_hash_map<uint32_t, log_thread_buf> thread_bufs;
+    if (!m_stream) {
+        m_thread_ctxs.for_each([&](const auto tid, auto &ctx) {
+            thread_bufs.try_emplace(tid, log_thread_buf(std::move(ctx.log_buf), ctx.num_inst));
+        });
     }
 
-    for (const auto &[tid, ctx] : m_thread_ctxs) {
+    std::vector<sym_info> syms;
+    if (!m_stream) {
+        interval_tree_t<uint64_t> pc_intervals;
+        std::vector<const log_thread_buf *> tbufs;
+        for (const auto &[tid, tbuf] : thread_bufs) {
+            tbufs.emplace_back(&tbuf);
+        }
+        auto ranges = extract_pc_ranges_from_traces(tbufs);
+        m_thread_ctxs.for_each([&](auto, const auto &ctx) {
+            ranges.insert(ranges.end(), ctx.spilled_ranges.begin(), ctx.spilled_ranges.end());
+        });
+        coalesce_pc_ranges(ranges);
+        // ranges are disjoint so plain inserts are enough
+        for (const auto &range : ranges) {
+            pc_intervals.insert({range.start, range.end});
+        }
+        if (symbols) {
+            const auto all_syms = symbols->syms();
+            syms                = get_symbols_in_intervals(all_syms, pc_intervals);
+        }
+    } else {
+        syms = get_symbols_in_regions(macho_regions, symbols);
+    }
+
+    // every new macho-region and, outside of stream mode, every thread file is its own task.
+    // Their frames all go through the shared compression scheduler so the files overlap their
+    // staging, waiting and disk writes instead of finishing one after the other.
+    std::vector<std::function<void()>> file_jobs;
+    write_meta(macho_regions, syms, file_jobs);
+
+    if (m_async_writer) {
+        m_async_writer->stop();
+    }
+
+    m_thread_ctxs.for_each([&](const auto tid, auto &ctx) {
         if (!m_stream) {
-            const log_thread_hdr thread_hdr{.thread_id = tid, .num_inst = ctx.num_inst};
-            CompressedFile<log_thread_hdr> thread_fh{
-                m_log_dir_path / fmt::format("thread-{:d}.bin", tid), false, /* read */
-                &thread_hdr, m_compression_level, true /* verbose */};
-            thread_fh.write(ctx.log_buf);
+            file_jobs.emplace_back([this, tid, &ctx, &tbuf = thread_bufs.at(tid)] {
+                // appends to the file if records were spilled to it already
+                auto thread_fh = ctx.spill_file ? std::move(ctx.spill_file)
+                                                : open_thread_file(tid, ctx.log_columns);
+                thread_fh->header().num_inst    = ctx.num_inst;
+                thread_fh->header().num_dropped = ctx.num_dropped;
+                write_log_msg_chunks(*thread_fh, tbuf.chunks(), m_opts.format,
+                                     ctx.log_columns.get(), ctx.sync_points);
+                // finish the column files inside the task as well
+                ctx.log_columns.reset();
+            });
         } else {
-            ctx.log_stream->header().num_inst = ctx.num_inst;
+            if (ctx.log_columns) {
+                ctx.log_columns->flush();
+            }
+            ctx.log_stream->header().num_inst    = ctx.num_inst;
+            ctx.log_stream->header().num_dropped = ctx.num_dropped;
+            for (const auto &point : ctx.sync_points) {
+                ctx.log_stream->add_seek_point(point.key, point.decomp_off);
+            }
         }
-    }
+    });
+
+    xnutrace_pool.wait_on_n_tasks_limited(file_jobs.size(), m_opts.write_concurrency,
+                                          [&](const auto i) {
+                                              file_jobs[i]();
+                                          });
 }
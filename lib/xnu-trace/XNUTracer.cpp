@@ -32,13 +32,13 @@ XNUTracer *g_tracer;
 
 XNUTracer::XNUTracer(task_t target_task, const opts &options)
     : m_target_task(target_task),
-      m_log{options.trace_path, options.compression_level, options.stream} {
+      m_log{options.trace_path, options.compression_level, options.stream, options.log_opts} {
     suspend();
     common_ctor(false, false, options.symbolicate);
 }
 
 XNUTracer::XNUTracer(pid_t target_pid, const opts &options)
-    : m_log{options.trace_path, options.compression_level, options.stream} {
+    : m_log{options.trace_path, options.compression_level, options.stream, options.log_opts} {
     const auto kr = task_for_pid(mach_task_self(), target_pid, &m_target_task);
     mach_check(kr, fmt::format("task_for_pid({:d}", target_pid));
     suspend();
@@ -46,7 +46,7 @@ XNUTracer::XNUTracer(pid_t target_pid, const opts &options)
 }
 
 XNUTracer::XNUTracer(std::string target_name, const opts &options)
-    : m_log{options.trace_path, options.compression_level, options.stream} {
+    : m_log{options.trace_path, options.compression_level, options.stream, options.log_opts} {
     const auto target_pid = pid_for_name(target_name);
     const auto kr         = task_for_pid(mach_task_self(), target_pid, &m_target_task);
     mach_check(kr, fmt::format("task_for_pid({:d}", target_pid));
@@ -56,7 +56,7 @@ XNUTracer::XNUTracer(std::string target_name, const opts &options)
 
 XNUTracer::XNUTracer(std::vector<std::string> spawn_args, bool pipe_ctrl, bool disable_aslr,
                      const opts &options)
-    : m_log{options.trace_path, options.compression_level, options.stream} {
+    : m_log{options.trace_path, options.compression_level, options.stream, options.log_opts} {
     const auto target_pid = spawn_with_args(spawn_args, pipe_ctrl, disable_aslr);
     const auto kr         = task_for_pid(mach_task_self(), target_pid, &m_target_task);
     mach_check(kr, fmt::format("task_for_pid({:d}", target_pid));
@@ -88,6 +88,11 @@ XNUTracer::~XNUTracer() {
         ninst, elapsed, ninst_per_sec, ncsw_target, ncsw_self, ncsw_total, ncsw_per_sec_target,
         ncsw_per_sec_self, ncsw_per_sec_total, nbytes, (double)nbytes / ninst, nbytes / elapsed);
     fmt::print("{}\n", s);
+    if (const auto ndropped = logger().num_dropped()) {
+        fmt::print("{:s}\n", fmt::format(std::locale("en_US.UTF-8"),
+                                         "XNUTracer dropped {:Ld} instructions to backpressure",
+                                         ndropped));
+    }
     logger().write(*m_macho_regions, m_symbols.get());
     resume();
 }
@@ -279,6 +284,7 @@ void XNUTracer::set_single_step(const bool do_single_step) {
         if (m_symbols) {
             m_symbols->reset();
         }
+        logger().write_stream_meta(*m_macho_regions, m_symbols.get());
         install_breakpoint_exception_handler();
         set_single_step_task(m_target_task, true);
     } else {
@@ -7,10 +7,12 @@ void log_arm64_cpu_context::update(const log_msg &msg) {
         return;
     }
     if (msg.pc_branched()) {
-        pc = msg.pc();
+        pc = msg.pc(pc) + (msg.bb_run_len() - 1) * 4;
+    } else {
+        pc += msg.bb_run_len() * 4;
     }
     if (msg.sp_changed()) {
-        sp = msg.sp();
+        sp = msg.sp(sp);
     }
     auto gpr_ptr = &x[0];
     for (uint32_t i = 0; i < msg.num_gpr(); ++i) {
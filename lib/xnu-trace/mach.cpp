@@ -33,6 +33,13 @@ std::vector<uint8_t> read_target(task_t target_task, uint64_t target_addr, uint6
     return res;
 }
 
+bool try_read_target(task_t target_task, uint64_t target_addr, void *buf, uint64_t sz) {
+    vm_size_t vm_sz = sz;
+    const auto kr   = vm_read_overwrite(target_task, (vm_address_t)target_addr, sz,
+                                        (vm_address_t)buf, &vm_sz);
+    return kr == KERN_SUCCESS && vm_sz == sz;
+}
+
 std::string read_cstr_target(task_t target_task, uint64_t target_addr) {
     std::vector<uint8_t> buf;
     do {
@@ -11,8 +11,9 @@ from xnutrace.compressedfile import CompressedFile
 # struct log_meta_hdr {
 #     uint64_t num_regions;
 #     uint64_t num_syms;
+#     uint64_t region_store_path_len;
 # }
-log_meta_hdr_t = struct.Struct("=QQ")
+log_meta_hdr_t = struct.Struct("=QQQ")
 log_meta_hdr_magic = 0x8D3A_DFB8_4154_454D
 
 # struct log_region {
@@ -157,10 +158,10 @@ class TraceLog:
         meta_fh = CompressedFile(trace_dir / "meta.bin", log_meta_hdr_magic, log_meta_hdr_t.size)
         meta_buf = bytes(meta_fh)
 
-        num_regions, num_syms = log_meta_hdr_t.unpack(meta_fh.header())
+        num_regions, num_syms, region_store_path_len = log_meta_hdr_t.unpack(meta_fh.header())
 
         macho_regions = []
-        region_buf_off = 0
+        region_buf_off = region_store_path_len
         for i in range(num_regions):
             region_unpacked = log_region_t.unpack_from(meta_buf, offset=region_buf_off)
             base = region_unpacked[0]
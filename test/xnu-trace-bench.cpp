@@ -10,8 +10,10 @@
 
 #include <mach/mach_time.h>
 
+#include <absl/container/flat_hash_set.h>
 #include <benchmark/benchmark.h>
 #include <fmt/format.h>
+#include <interval-tree/interval_tree.hpp>
 #define XXH_INLINE_ALL
 // #define XXH_NAMESPACE xnu_trace_bench_
 #include <xxhash-xnu-trace/xxhash.h>
@@ -89,6 +91,93 @@ static void BM_histogram_add(benchmark::State &state) {
 
 // BENCHMARK(BM_histogram_add);
 
+static std::vector<uint64_t> synthetic_pcs(size_t n) {
+    std::vector<uint64_t> pcs(n);
+    uint64_t pc    = 0x1'0000'4000;
+    uint64_t state = 0x9E37'79B9'7F4A'7C15;
+    for (size_t i = 0; i < n; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        // branch roughly every 16 instructions
+        pc     = (state & 0xF) == 0 ? 0x1'0000'4000 + ((state >> 32) & 0xF'FFFF) * 4 : pc + 4;
+        pcs[i] = pc;
+    }
+    return pcs;
+}
+
+static void BM_trace_log_pc(benchmark::State &state) {
+    const auto pcs = synthetic_pcs(1024 * 1024);
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto log = std::make_unique<TraceLog>("bench-log.bundle", 0, false);
+        state.ResumeTiming();
+        for (const auto pc : pcs) {
+            log->log(1, pc);
+        }
+        state.PauseTiming();
+        log.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * pcs.size());
+}
+
+BENCHMARK(BM_trace_log_pc);
+
+static void BM_trace_log_batch_pc(benchmark::State &state) {
+    const auto pcs = synthetic_pcs(1024 * 1024);
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto log = std::make_unique<TraceLog>("bench-log.bundle", 0, false);
+        state.ResumeTiming();
+        log->log_batch(1, pcs);
+        state.PauseTiming();
+        log.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * pcs.size());
+}
+
+BENCHMARK(BM_trace_log_batch_pc);
+
+static void BM_pc_intervals_hash_set(benchmark::State &state) {
+    const auto trace = TraceLog("harness.bundle");
+    for (auto _ : state) {
+        absl::flat_hash_set<uint64_t> pcs;
+        for (const auto &[tid, tbuf] : trace.parsed_logs()) {
+            for (const auto pc : extract_pcs_from_trace(tbuf)) {
+                pcs.emplace(pc);
+            }
+        }
+        lib_interval_tree::interval_tree_t<uint64_t> pc_intervals;
+        for (const auto pc : pcs) {
+            pc_intervals.insert_overlap({pc, pc + 4});
+        }
+        benchmark::DoNotOptimize(pc_intervals);
+    }
+    state.SetItemsProcessed(state.iterations() * trace.num_inst());
+}
+
+BENCHMARK(BM_pc_intervals_hash_set)->Unit(benchmark::kMillisecond);
+
+static void BM_pc_intervals_sorted_ranges(benchmark::State &state) {
+    const auto trace = TraceLog("harness.bundle");
+    std::vector<const log_thread_buf *> tbufs;
+    for (const auto &[tid, tbuf] : trace.parsed_logs()) {
+        tbufs.emplace_back(&tbuf);
+    }
+    for (auto _ : state) {
+        lib_interval_tree::interval_tree_t<uint64_t> pc_intervals;
+        for (const auto &range : extract_pc_ranges_from_traces(tbufs)) {
+            pc_intervals.insert({range.start, range.end});
+        }
+        benchmark::DoNotOptimize(pc_intervals);
+    }
+    state.SetItemsProcessed(state.iterations() * trace.num_inst());
+}
+
+BENCHMARK(BM_pc_intervals_sorted_ranges)->Unit(benchmark::kMillisecond);
+
 static void BM_xxhash64(benchmark::State &state) {
     uint64_t i = 0;
     for (auto _ : state) {
@@ -1,23 +1,64 @@
 #include "xnu-trace/xnu-trace.h"
 
 #undef NDEBUG
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <filesystem>
+#include <future>
 
 #include <argparse/argparse.hpp>
 #include <fmt/format.h>
 
 namespace fs = std::filesystem;
 
+namespace {
+
+// CompressedFile cuts its body into frame_size() frames that compress independently, a single
+// frame over the whole body is what one zstd stream costs
+void print_frame_ratio(std::vector<uint8_t> &&body, int level, const CompressionDict *dict) {
+    const auto frame_sz = xnutrace_compression_scheduler.frame_size();
+    std::vector<std::future<compressed_frame>> frames;
+    for (size_t off = 0; off < body.size(); off += frame_sz) {
+        const auto end = body.begin() + std::min(off + frame_sz, body.size());
+        frames.emplace_back(xnutrace_compression_scheduler.submit(
+            std::vector<uint8_t>{body.begin() + off, end}, level, dict));
+    }
+    const auto body_sz = body.size();
+    auto whole         = xnutrace_compression_scheduler.submit(std::move(body), level, dict);
+    size_t frames_sz   = 0;
+    for (auto &frame : frames) {
+        frames_sz += frame.get().compressed.size();
+    }
+    const auto whole_sz = whole.get().compressed.size();
+    fmt::print("{:d} bytes at level {:d}\n", body_sz, level);
+    fmt::print("one stream: {:d} bytes, ratio {:0.3f}%\n", whole_sz,
+               (double)whole_sz / body_sz * 100);
+    fmt::print("{:d} KiB frames: {:d} bytes, ratio {:0.3f}%, {:+0.3f}% over one stream\n",
+               frame_sz / 1024, frames_sz, (double)frames_sz / body_sz * 100,
+               ((double)frames_sz / whole_sz - 1) * 100);
+}
+
+} // namespace
+
 int main(int argc, const char **argv) {
     argparse::ArgumentParser parser(getprogname());
     parser.add_argument("-i", "--input").required().help("input CompressedFile path");
-    parser.add_argument("-o", "--output").required().help("output path");
+    parser.add_argument("-o", "--output").help("output path");
     parser.add_argument("-H", "--header")
         .default_value(false)
         .implicit_value(true)
         .help("output header instead of body");
+    parser.add_argument("-D", "--dict").help("zstd dictionary the input was compressed with");
+    parser.add_argument("-r", "--ratio")
+        .default_value(false)
+        .implicit_value(true)
+        .help("compare the body compressed in independent frames with one zstd stream instead of "
+              "writing it out");
+    parser.add_argument("-c", "--compression-level")
+        .scan<'i', int>()
+        .default_value(3)
+        .help("zstd compression level for --ratio");
 
     try {
         parser.parse_args(argc, argv);
@@ -27,16 +68,28 @@ int main(int argc, const char **argv) {
     }
 
     const fs::path in_path{parser.get("--input")};
-    const auto out_path{parser.get("--output")};
+    const auto out_path{parser.present("--output")};
     const bool output_header{parser["--header"] == true};
+    const bool ratio{parser["--ratio"] == true};
+    if (!ratio && !out_path) {
+        fmt::print(stderr, "--output is required unless --ratio is given\n");
+        return -1;
+    }
+
+    std::unique_ptr<CompressionDict> dict;
+    if (const auto path = parser.present("--dict")) {
+        dict = CompressionDict::read(*path);
+    }
 
-    CompressedFileRawRead cf{in_path};
+    CompressedFileRawRead cf{in_path, dict.get()};
 
-    if (output_header) {
-        write_file(out_path, cf.header_buf().data(), cf.header_buf().size());
+    if (ratio) {
+        print_frame_ratio(cf.read(), parser.get<int>("--compression-level"), dict.get());
+    } else if (output_header) {
+        write_file(*out_path, cf.header_buf().data(), cf.header_buf().size());
     } else {
         const auto buf = cf.read();
-        write_file(out_path, buf.data(), buf.size());
+        write_file(*out_path, buf.data(), buf.size());
     }
 
     return 0;
@@ -1,10 +1,12 @@
 #include "xnu-trace/xnu-trace.h"
 
 #undef NDEBUG
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <filesystem>
 #include <locale>
+#include <optional>
 #include <set>
 
 #include <argparse/argparse.hpp>
@@ -12,15 +14,80 @@
 
 namespace fs = std::filesystem;
 
-void dump_stats(const TraceLog &trace) {
-    for (const auto &[tid, log] : trace.parsed_logs()) {
-        const auto bytes_per_inst = (double)log.num_bytes() / log.num_inst();
+// calls f(tid, log) for every thread, log is a log_thread_buf or, when streaming, a
+// LogThreadStream that decompresses its thread file a window at a time
+template <typename F> void for_each_thread(const TraceLog &trace, bool stream, const F &f) {
+    if (!stream) {
+        for (const auto &[tid, log] : trace.parsed_logs()) {
+            f(tid, log);
+        }
+        return;
+    }
+    for (const auto &log : trace.thread_streams()) {
+        f(log->thread_id(), *log);
+    }
+}
+
+uint64_t num_bytes(const log_thread_buf &log) {
+    return log.num_bytes();
+}
+
+// a stream only knows its size once it has been read through
+uint64_t num_bytes(LogThreadStream &log) {
+    for (auto it = log.begin(), e = log.end(); it != e; ++it) {}
+    return log.num_bytes();
+}
+
+// extract_bbs_from_pc_trace(extract_pcs_from_trace(log)) without holding the PCs
+template <typename Log, typename F> void for_each_bb(Log &log, const F &f) {
+    std::optional<bb_t> bb;
+    for (auto it = log.pcs_begin(), e = log.pcs_end(); it != e; ++it) {
+        const auto pc = it.pc();
+        if (bb && bb->pc + bb->sz == pc) {
+            bb->sz += 4;
+            continue;
+        }
+        if (bb) {
+            f(*bb);
+        }
+        bb = bb_t{.pc = pc, .sz = 4};
+    }
+    if (bb) {
+        f(*bb);
+    }
+}
+
+// in memory logs decode their bins in parallel
+std::vector<bb_t> thread_bbs(const log_thread_buf &log) {
+    return extract_bbs_from_trace(log);
+}
+
+std::vector<bb_t> thread_bbs(LogThreadStream &log) {
+    std::vector<bb_t> bbs;
+    for_each_bb(log, [&](const bb_t &bb) {
+        bbs.emplace_back(bb);
+    });
+    return bbs;
+}
+
+std::vector<std::vector<bb_t>> extract_thread_bbs(const TraceLog &trace, bool stream) {
+    std::vector<std::vector<bb_t>> tbbs;
+    for_each_thread(trace, stream, [&](auto, auto &log) {
+        tbbs.emplace_back(thread_bbs(log));
+    });
+    return tbbs;
+}
+
+void dump_stats(const TraceLog &trace, bool stream) {
+    for_each_thread(trace, stream, [](uint32_t tid, auto &log) {
+        const auto log_bytes      = num_bytes(log);
+        const auto bytes_per_inst = (double)log_bytes / log.num_inst();
         fmt::print("{:s}\n", fmt::format(std::locale("en_US.UTF-8"),
                                          "tid: {:d} # inst: {:Ld} # bytes: {:Ld} bytes / inst: "
                                          "{:0.2f} ctx bytes / inst: {:0.2f}\n",
-                                         tid, log.num_inst(), log.num_bytes(), bytes_per_inst,
+                                         tid, log.num_inst(), log_bytes, bytes_per_inst,
                                          bytes_per_inst - 8));
-    }
+    });
 }
 
 void dump_log(const TraceLog &trace, bool symbolicate = false) {
@@ -34,23 +101,81 @@ void dump_log(const TraceLog &trace, bool symbolicate = false) {
     }
 }
 
-void dump_bb(const TraceLog &trace) {
-    for (const auto &[tid, log] : trace.parsed_logs()) {
+void dump_bb(const TraceLog &trace, bool stream) {
+    for_each_thread(trace, stream, [](uint32_t tid, auto &log) {
         fmt::print("{:s}\n", fmt::format(std::locale("en_US.UTF-8"),
                                          "tid: {:d} # inst: {:Ld} # bytes {:Ld}\n", tid,
-                                         log.num_inst(), log.num_bytes()));
-        const auto bbs = extract_bbs_from_pc_trace(extract_pcs_from_trace(log));
-        for (const auto &bb : bbs) {
+                                         log.num_inst(), num_bytes(log)));
+        for_each_bb(log, [](const bb_t &bb) {
             fmt::print("BB: {:#018x} [{:d}]\n", bb.pc, bb.sz);
+        });
+    });
+}
+
+void dump_mem(const TraceLog &trace, bool stream) {
+    for_each_thread(trace, stream, [](uint32_t tid, auto &log) {
+        uint64_t num_accesses = 0;
+        std::set<uint64_t> lines;
+        for (auto it = log.ctx_begin(), e = log.ctx_end(); it != e; ++it) {
+            for (const auto &access : it.mem_accesses()) {
+                const auto rw = access.read && access.write ? "RW" : access.read ? "R " : " W";
+                if (access.value) {
+                    fmt::print("tid: {:d} pc: {:#018x} {:s} {:#018x} [{:d}] {:02x}\n", tid,
+                               it.ctx().pc, rw, access.addr, access.size,
+                               fmt::join(access.value, access.value + access.size, ""));
+                } else {
+                    fmt::print("tid: {:d} pc: {:#018x} {:s} {:#018x} [{:d}]\n", tid, it.ctx().pc,
+                               rw, access.addr, access.size);
+                }
+                ++num_accesses;
+                for (auto line = access.addr / 64; line <= (access.addr + access.size - 1) / 64;
+                     ++line) {
+                    lines.emplace(line);
+                }
+            }
         }
+        fmt::print("{:s}\n", fmt::format(std::locale("en_US.UTF-8"),
+                                         "tid: {:d} # accesses: {:Ld} # 64 byte lines: {:Ld}\n",
+                                         tid, num_accesses, lines.size()));
+    });
+}
+
+// spec is <tid>:<instruction index>
+void dump_context(const TraceLog &trace, const std::string &spec) {
+    const auto colon = spec.find(':');
+    if (colon == std::string::npos) {
+        fmt::print(stderr, "--context-at wants <tid>:<instruction index>, got '{:s}'\n", spec);
+        return;
+    }
+    const auto tid  = (uint32_t)std::stoul(spec.substr(0, colon));
+    const auto inst = std::stoull(spec.substr(colon + 1));
+    const auto ctx  = trace.context_at(tid, inst);
+    if (!ctx) {
+        fmt::print(stderr, "tid: {:d} has no context for instruction {:d}\n", tid, inst);
+        return;
+    }
+    fmt::print("tid: {:d} inst: {:d} pc: {:#018x} sp: {:#018x} nzcv: {:#010x}\n", tid, inst,
+               ctx->pc, ctx->sp, ctx->nzcv);
+    for (size_t i = 0; i < std::size(ctx->x); ++i) {
+        fmt::print("x{:d}: {:#018x}\n", i, ctx->x[i]);
+    }
+    fmt::print("fp: {:#018x}\nlr: {:#018x}\n", ctx->fp, ctx->lr);
+    for (size_t i = 0; i < std::size(ctx->v); ++i) {
+        fmt::print("v{:d}: {:#018x}{:016x}\n", i, (uint64_t)(ctx->v[i] >> 64),
+                   (uint64_t)ctx->v[i]);
     }
 }
 
-void dump_histogram(const TraceLog &trace, int max_num) {
+void dump_histogram(const TraceLog &trace, int max_num, bool stream) {
+    // PCs are looked up in blocks so a stream never holds all of them
+    constexpr size_t block_sz = 16 * 1024 * 1024;
     ARM64InstrHistogram hist(true);
     const auto &regions = trace.macho_regions();
-    for (const auto &[tid, log] : trace.parsed_logs()) {
-        const auto pcs = extract_pcs_from_trace(log);
+    std::vector<uint64_t> pcs;
+    const auto add_pcs = [&] {
+        if (pcs.empty()) {
+            return;
+        }
         BS::multi_future<ARM64InstrHistogram> mf =
             xnutrace_pool.parallelize_loop(pcs.size(), [&](const size_t a, const size_t b) {
                 ARM64InstrHistogram block_hist;
@@ -63,15 +188,23 @@ void dump_histogram(const TraceLog &trace, int max_num) {
         for (const auto &h : block_hists) {
             hist += h;
         }
-    }
+        pcs.clear();
+    };
+    for_each_thread(trace, stream, [&](auto, auto &log) {
+        pcs.reserve(std::min<uint64_t>(log.num_inst(), block_sz));
+        for (auto it = log.pcs_begin(), e = log.pcs_end(); it != e; ++it) {
+            pcs.emplace_back(it.pc());
+            if (pcs.size() == block_sz) {
+                add_pcs();
+            }
+        }
+        add_pcs();
+    });
     hist.print(max_num);
 }
 
-void dump_calls_from(const TraceLog &trace, const std::string &calling_image) {
-    std::vector<std::vector<bb_t>> tbbs;
-    for (const auto &ttp : trace.parsed_logs()) {
-        tbbs.emplace_back(extract_bbs_from_pc_trace(extract_pcs_from_trace(ttp.second)));
-    }
+void dump_calls_from(const TraceLog &trace, const std::string &calling_image, bool stream) {
+    const auto tbbs = extract_thread_bbs(trace, stream);
     const auto &macho_regions       = trace.macho_regions();
     const auto syms                 = trace.symbols();
     const auto &target_img_info     = macho_regions.lookup(calling_image);
@@ -105,11 +238,9 @@ void dump_calls_from(const TraceLog &trace, const std::string &calling_image) {
     }
 }
 
-void write_lighthouse_coverage(std::string path, const TraceLog &trace, bool symbolicate = false) {
-    std::vector<std::vector<bb_t>> tbbs;
-    for (const auto &ttp : trace.parsed_logs()) {
-        tbbs.emplace_back(extract_bbs_from_pc_trace(extract_pcs_from_trace(ttp.second)));
-    }
+void write_lighthouse_coverage(std::string path, const TraceLog &trace, bool stream,
+                               bool symbolicate = false) {
+    const auto tbbs = extract_thread_bbs(trace, stream);
 
     const auto fh = fopen(path.c_str(), "w");
     assert(fh);
@@ -138,13 +269,10 @@ void write_lighthouse_coverage(std::string path, const TraceLog &trace, bool sym
     assert(!fclose(fh));
 }
 
-void write_drcov_coverage(std::string path, const TraceLog &trace) {
+void write_drcov_coverage(std::string path, const TraceLog &trace, bool stream) {
     const auto regions = trace.macho_regions().regions();
 
-    std::vector<std::vector<bb_t>> tbbs;
-    for (const auto &ttp : trace.parsed_logs()) {
-        tbbs.emplace_back(extract_bbs_from_pc_trace(extract_pcs_from_trace(ttp.second)));
-    }
+    const auto tbbs = extract_thread_bbs(trace, stream);
 
     const auto fh = fopen(path.c_str(), "w");
     assert(fh);
@@ -187,7 +315,7 @@ Columns: id, base, end, entry, checksum, timestamp, path
 
 int main(int argc, const char **argv) {
     argparse::ArgumentParser parser(getprogname());
-    parser.add_argument("-t", "--trace-file").required().help("input trace file path");
+    parser.add_argument("-t", "--trace-file").help("input trace file path");
     parser.add_argument("-d", "--drcov-file").help("output drcov coverage file path");
     parser.add_argument("-l", "--lighthouse-file").help("output lighthouse coverage file path");
     parser.add_argument("-c", "--calls-from").help("find calls from given image");
@@ -203,6 +331,10 @@ int main(int argc, const char **argv) {
         .default_value(false)
         .implicit_value(true)
         .help("dump basic blocks to console");
+    parser.add_argument("-m", "--dump-mem")
+        .default_value(false)
+        .implicit_value(true)
+        .help("dump memory accesses and working set size to console");
     parser.add_argument("-H", "--histogram")
         .default_value(false)
         .implicit_value(true)
@@ -211,10 +343,29 @@ int main(int argc, const char **argv) {
         .scan<'i', int>()
         .default_value(-1)
         .help("print top N most frequent instructions");
+    parser.add_argument("--train-dict")
+        .help("train a zstd dictionary on the trace's thread files and write it to this path");
     parser.add_argument("-s", "--stats")
         .default_value(false)
         .implicit_value(true)
         .help("dump trace log stats to console");
+    parser.add_argument("--stdio-io")
+        .default_value(false)
+        .implicit_value(true)
+        .help("read trace files with blocking stdio instead of the threaded I/O backend");
+    parser.add_argument("--stream")
+        .default_value(false)
+        .implicit_value(true)
+        .help("decompress thread files a window at a time instead of reading them whole, for "
+              "traces larger than memory");
+    parser.add_argument("--context-at")
+        .help("dump the registers after the given instruction, as <tid>:<instruction index>");
+    parser.add_argument("--gpr-checkpoints")
+        .scan<'i', int>()
+        .help("write GPR checkpoints every N instructions next to each thread file, they bound "
+              "the replay of later register lookups");
+    parser.add_argument("--gc-region-store")
+        .help("remove region store objects no existing trace references, needs no trace file");
 
     try {
         parser.parse_args(argc, argv);
@@ -223,20 +374,69 @@ int main(int argc, const char **argv) {
         return -1;
     }
 
+    if (const auto path = parser.present("--gc-region-store")) {
+        const auto stats = RegionStore{*path}.gc();
+        fmt::print("dropped {:d} refs, removed {:d} objects, freed {:d} bytes\n",
+                   stats.num_refs_dropped, stats.num_objects_removed, stats.bytes_freed);
+        if (!parser.present("--trace-file")) {
+            return 0;
+        }
+    }
+    if (!parser.present("--trace-file")) {
+        fmt::print(stderr, "Error parsing arguments: --trace-file is required\n");
+        return -1;
+    }
+
     const auto symbolicate = parser["--symbolicate"] == true;
+    if (parser["--stdio-io"] == true) {
+        FileIO::set_default_backend(file_io_backend::stdio);
+    }
 
-    const auto trace = TraceLog(parser.get("--trace-file"));
+    if (const auto path = parser.present("--train-dict")) {
+        const auto dict = CompressionDict::train_from_bundles({parser.get("--trace-file")});
+        if (!dict) {
+            return -1;
+        }
+        dict->write(*path);
+        fmt::print("wrote {:d} byte dictionary {:#010x} to '{:s}'\n", dict->data().size(),
+                   dict->id(), *path);
+    }
+
+    // everything but the memory dump, the byte counts and the register lookups works off the
+    // PCs alone, columnar traces then skip decompressing the register columns
+    const auto ctx_lookups = parser.present("--context-at") || parser.present("--gpr-checkpoints");
+    const auto pcs_only =
+        parser["--dump-mem"] == false && parser["--stats"] == false && !ctx_lookups;
+    const auto stream = parser["--stream"] == true;
+    if (ctx_lookups && stream) {
+        fmt::print(stderr, "Error parsing arguments: --context-at and --gpr-checkpoints don't "
+                           "work with --stream\n");
+        return -1;
+    }
+    auto trace = TraceLog(parser.get("--trace-file"), pcs_only, !stream);
+
+    if (const auto interval = parser.present<int>("--gpr-checkpoints")) {
+        if (*interval <= 0) {
+            fmt::print(stderr, "Error parsing arguments: --gpr-checkpoints must be positive\n");
+            return -1;
+        }
+        trace.write_gpr_checkpoints(*interval);
+    }
+
+    if (const auto spec = parser.present("--context-at")) {
+        dump_context(trace, *spec);
+    }
 
     if (const auto path = parser.present("--drcov-file")) {
-        write_drcov_coverage(*path, trace);
+        write_drcov_coverage(*path, trace, stream);
     }
 
     if (const auto path = parser.present("--lighthouse-file")) {
-        write_lighthouse_coverage(*path, trace, symbolicate);
+        write_lighthouse_coverage(*path, trace, stream, symbolicate);
     }
 
     if (parser.get<bool>("--stats")) {
-        dump_stats(trace);
+        dump_stats(trace, stream);
     }
 
     if (parser.get<bool>("--dump")) {
@@ -244,15 +444,19 @@ int main(int argc, const char **argv) {
     }
 
     if (parser.get<bool>("--dump-bb")) {
-        dump_bb(trace);
+        dump_bb(trace, stream);
+    }
+
+    if (parser.get<bool>("--dump-mem")) {
+        dump_mem(trace, stream);
     }
 
     if (parser.get<bool>("--histogram")) {
-        dump_histogram(trace, parser.get<int>("--max-histogram-insts"));
+        dump_histogram(trace, parser.get<int>("--max-histogram-insts"), stream);
     }
 
     if (const auto calling_image = parser.present("--calls-from")) {
-        dump_calls_from(trace, *calling_image);
+        dump_calls_from(trace, *calling_image, stream);
     }
 
     return 0;
@@ -43,10 +43,79 @@ int main(int argc, const char **argv) {
         .scan<'i', int>()
         .default_value(10)
         .help("zstd compression level");
+    parser.add_argument("--compression-threads")
+        .scan<'i', int>()
+        .default_value(0)
+        .help("total zstd worker threads shared by all trace files (0 = number of cores)");
+    parser.add_argument("--stdio-io")
+        .default_value(false)
+        .implicit_value(true)
+        .help("write trace files with blocking stdio instead of the threaded I/O backend");
+    parser.add_argument("--io-blocks-in-flight")
+        .scan<'i', int>()
+        .default_value((int)FileIO::default_max_blocks_in_flight)
+        .help("1 MiB blocks queued per trace file with the threaded I/O backend");
     parser.add_argument("-S", "--stream")
         .default_value(false)
         .implicit_value(true)
         .help("stream to disk");
+    parser.add_argument("--async")
+        .default_value(false)
+        .implicit_value(true)
+        .help("compress and write streams on a background thread");
+    parser.add_argument("--async-drop")
+        .default_value(false)
+        .implicit_value(true)
+        .help("drop instructions instead of blocking when the async ring is full");
+    parser.add_argument("--async-ring-mb")
+        .scan<'i', int>()
+        .default_value(16)
+        .help("per-thread async ring size in MiB (power of 2)");
+    parser.add_argument("--checkpoint-mb")
+        .scan<'i', int>()
+        .default_value(16)
+        .help("stream mode: make thread files readable up to here every N MiB of records in case "
+              "the tracer dies (0 = off)");
+    parser.add_argument("--bb-runs")
+        .default_value(false)
+        .implicit_value(true)
+        .help("record one entry per basic block instead of per instruction (PC-only traces)");
+    parser.add_argument("--delta-pc-sp")
+        .default_value(false)
+        .implicit_value(true)
+        .help("store branch targets and SP changes as varint deltas");
+    parser.add_argument("--compact-records")
+        .default_value(false)
+        .implicit_value(true)
+        .help("write thread files with one byte record headers (v2 records)");
+    parser.add_argument("--columnar")
+        .default_value(false)
+        .implicit_value(true)
+        .help("write record headers, PCs, SPs, GPRs and vectors to separate thread files");
+    parser.add_argument("--sync-bytes")
+        .scan<'i', int>()
+        .help("write a sync frame every N record bytes (default 1 MiB)");
+    parser.add_argument("--sync-insts")
+        .scan<'i', int>()
+        .help("write a sync frame every N instructions");
+    parser.add_argument("--sync-auto")
+        .default_value(false)
+        .implicit_value(true)
+        .help("pick the sync frame interval balancing size overhead against decode parallelism");
+    parser.add_argument("--mem-budget-mb")
+        .scan<'i', int>()
+        .default_value(0)
+        .help("spill in-memory traces to disk above this many MiB (0 = unlimited, non-stream)");
+    parser.add_argument("--write-jobs")
+        .scan<'i', int>()
+        .default_value(0)
+        .help("thread and region files compressed at once when writing the trace (0 = number "
+              "of cores, non-stream)");
+    parser.add_argument("--region-store")
+        .help("keep macho-region files in this store shared between traces (see "
+              "xnu-trace-log-util --gc-region-store)");
+    parser.add_argument("--dict").help(
+        "compress thread files with this zstd dictionary (see xnu-trace-log-util --train-dict)");
     parser.add_argument("spawn-args").remaining().help("spawn executable path and arguments");
 
     try {
@@ -63,6 +132,38 @@ int main(int argc, const char **argv) {
     XNUTracer::opts opts{.symbolicate       = parser["--symbolicate"] == true,
                          .compression_level = parser.get<int>("--compression-level"),
                          .stream            = parser["--stream"] == true};
+    opts.log_opts = {.async         = parser["--async"] == true,
+                     .backpressure  = parser["--async-drop"] == true ? backpressure_policy::drop
+                                                                     : backpressure_policy::block,
+                     .async_ring_sz = (size_t)parser.get<int>("--async-ring-mb") * 1024 * 1024};
+    opts.log_opts.bb_runs           = parser["--bb-runs"] == true;
+    opts.log_opts.delta_pc_sp       = parser["--delta-pc-sp"] == true;
+    opts.log_opts.mem_budget        = (size_t)parser.get<int>("--mem-budget-mb") * 1024 * 1024;
+    opts.log_opts.write_concurrency = parser.get<int>("--write-jobs");
+    opts.log_opts.checkpoint_bytes  = (uint64_t)parser.get<int>("--checkpoint-mb") * 1024 * 1024;
+    if (parser["--compact-records"] == true) {
+        opts.log_opts.format = record_format::v2;
+    } else if (parser["--columnar"] == true) {
+        opts.log_opts.format = record_format::columnar;
+    }
+    if (const auto n = parser.present<int>("--sync-bytes")) {
+        opts.log_opts.sync = sync_policy::fixed_bytes(*n);
+    } else if (const auto n = parser.present<int>("--sync-insts")) {
+        opts.log_opts.sync = sync_policy::fixed_instructions(*n);
+    } else if (parser["--sync-auto"] == true) {
+        opts.log_opts.sync = sync_policy::automatic();
+    }
+    if (const auto path = parser.present("--dict")) {
+        opts.log_opts.dict = CompressionDict::read(*path);
+    }
+    if (const auto path = parser.present("--region-store")) {
+        opts.log_opts.region_store = *path;
+    }
+    xnutrace_compression_scheduler.set_num_workers(parser.get<int>("--compression-threads"));
+    if (parser["--stdio-io"] == true) {
+        FileIO::set_default_backend(file_io_backend::stdio);
+    }
+    FileIO::set_max_blocks_in_flight(parser.get<int>("--io-blocks-in-flight"));
     if (const auto arg = parser.present("--trace-file")) {
         opts.trace_path = *arg;
     }
@@ -2,5 +2,60 @@
 
 #include <catch2/catch_test_macros.hpp>
 #include <fmt/format.h>
+#include <frida-gum.h>
 
 #define TS "[ARM64Disassembler]"
+
+namespace {
+using accesses_t = std::vector<std::tuple<uint64_t, uint32_t, bool, bool>>;
+
+std::optional<arm64_mem_insn> decode(uint32_t instr) {
+    csh handle;
+    REQUIRE(cs_open(CS_ARCH_ARM64, CS_MODE_LITTLE_ENDIAN, &handle) == CS_ERR_OK);
+    cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON);
+    cs_insn *insn;
+    REQUIRE(cs_disasm(handle, (const uint8_t *)&instr, sizeof(instr), 0x1000, 1, &insn) == 1);
+    const auto res = arm64_mem_insn::decode(insn);
+    cs_free(insn, 1);
+    cs_close(&handle);
+    return res;
+}
+
+accesses_t accesses(uint32_t instr) {
+    log_arm64_cpu_context ctx{.sp = 0x8000};
+    for (int i = 0; i < 29; ++i) {
+        ctx.x[i] = 0x1000 * (i + 1);
+    }
+    ctx.x[5] = -2; // negative 32-bit index
+    accesses_t res;
+    const auto mem_insn = decode(instr);
+    REQUIRE(mem_insn);
+    for (const auto &access : mem_insn->accesses(ctx)) {
+        res.emplace_back(access.addr, access.size, access.read, access.write);
+    }
+    return res;
+}
+} // namespace
+
+TEST_CASE("mem-insn-decode", TS) {
+    // ldr x0, [x1, #8]
+    REQUIRE(accesses(0xf9400420) == accesses_t{{0x2008, 8, true, false}});
+    // stp x29, x30, [sp, #-16]!
+    REQUIRE(accesses(0xa9bf7bfd) == accesses_t{{0x7ff0, 16, false, true}});
+    // ldrb w0, [x1, x2]
+    REQUIRE(accesses(0x38626820) == accesses_t{{0x5000, 1, true, false}});
+    // ldr x0, [x1], #8
+    REQUIRE(accesses(0xf8408420) == accesses_t{{0x2000, 8, true, false}});
+    // ldr w3, [x4, w5, sxtw #2]
+    REQUIRE(accesses(0xb865d883) == accesses_t{{0x5000 - 8, 4, true, false}});
+    // ldaddal x0, x1, [x2]
+    REQUIRE(accesses(0xf8e00041) == accesses_t{{0x3000, 8, true, true}});
+    // ld3 {v0.16b, v1.16b, v2.16b}, [x0]
+    REQUIRE(accesses(0x4c404000) == accesses_t{{0x1000, 16, true, false},
+                                               {0x1010, 16, true, false},
+                                               {0x1020, 16, true, false}});
+    // stxr w1, x2, [x3]
+    REQUIRE(accesses(0xc8017c62) == accesses_t{{0x4000, 8, false, true}});
+    // add x0, x1, x2
+    REQUIRE(!decode(0x8b020020));
+}
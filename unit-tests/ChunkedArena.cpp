@@ -0,0 +1,49 @@
+#include "xnu-trace/xnu-trace.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/format.h>
+
+#define TS "[ChunkedArena]"
+
+TEST_CASE("records-never-straddle", TS) {
+    ChunkedArena arena(PAGE_SZ);
+    std::vector<uint8_t> rec(24);
+    for (size_t i = 0; i < 1000; ++i) {
+        std::fill(rec.begin(), rec.end(), (uint8_t)i);
+        arena.append(rec.data(), rec.size());
+    }
+    REQUIRE(arena.size() == 1000 * rec.size());
+    const auto chunks = arena.chunks();
+    REQUIRE(chunks.size() > 1);
+    size_t i = 0;
+    for (const auto &chunk : chunks) {
+        REQUIRE(chunk.size() % rec.size() == 0);
+        for (size_t off = 0; off < chunk.size(); off += rec.size(), ++i) {
+            REQUIRE(chunk[off] == (uint8_t)i);
+            REQUIRE(chunk[off + rec.size() - 1] == (uint8_t)i);
+        }
+    }
+    REQUIRE(i == 1000);
+}
+
+TEST_CASE("oversized-append", TS) {
+    ChunkedArena arena(PAGE_SZ);
+    std::vector<uint8_t> big(3 * PAGE_SZ, 0x5a);
+    arena.append(big.data(), 8);
+    arena.append(big.data(), big.size());
+    const auto chunks = arena.chunks();
+    REQUIRE(chunks.size() == 2);
+    REQUIRE(chunks[1].size() == big.size());
+    REQUIRE(arena.size() == big.size() + 8);
+}
+
+TEST_CASE("move", TS) {
+    ChunkedArena a(PAGE_SZ);
+    const uint64_t v = 0xdeadbeef;
+    a.append(&v, sizeof(v));
+    ChunkedArena b{std::move(a)};
+    REQUIRE(a.size() == 0);
+    REQUIRE(b.size() == sizeof(v));
+    b.append(&v, sizeof(v));
+    REQUIRE(b.chunks().size() == 1);
+}
@@ -0,0 +1,290 @@
+#include "xnu-trace/xnu-trace.h"
+
+#include "fixtures.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/format.h>
+
+#include <unistd.h>
+
+#define TS "[CompressedFile]"
+
+namespace {
+struct test_hdr {
+    uint64_t id;
+    static constexpr uint64_t magic = 0x5453'4554'4643'5841; // 'AXCFTEST'
+};
+// test_hdr with a field appended
+struct test_hdr_v2 {
+    uint64_t id;
+    uint64_t extra;
+    static constexpr uint64_t magic = test_hdr::magic;
+};
+} // namespace
+
+TEST_CASE("staged-roundtrip", TS) {
+    const auto path =
+        std::filesystem::temp_directory_path() / fmt::format("cf-test-{:d}.bin", getpid());
+    std::vector<uint8_t> expected;
+    uint64_t num_writes;
+    uint64_t num_zstd_ops;
+    {
+        const test_hdr hdr{.id = 243};
+        CompressedFile<test_hdr> fh{path, false, &hdr, 3};
+        for (size_t i = 0; i < 100'000; ++i) {
+            const uint64_t v = i * 0x9E37'79B9'7F4A'7C15ull;
+            fh.write(v);
+            expected.insert(expected.end(), (uint8_t *)&v, (uint8_t *)&v + sizeof(v));
+            if (i == 50'000) {
+                fh.flush();
+            }
+        }
+        // larger than the staging buffer, bypasses it
+        std::vector<uint8_t> big(4 * 1024 * 1024);
+        for (size_t i = 0; i < big.size(); ++i) {
+            big[i] = (uint8_t)(i * 7);
+        }
+        fh.write(big);
+        expected.insert(expected.end(), big.begin(), big.end());
+        num_writes   = fh.num_writes();
+        num_zstd_ops = fh.num_zstd_ops();
+    }
+    REQUIRE(num_writes == 100'001);
+    REQUIRE(num_zstd_ops < num_writes / 8);
+
+    {
+        CompressedFile<test_hdr> fh{path, true};
+        REQUIRE(fh.header().id == 243);
+        REQUIRE(fh.decompressed_size() == expected.size());
+        REQUIRE(fh.read() == expected);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("multi-frame-partial-reads", TS) {
+    const auto path =
+        std::filesystem::temp_directory_path() / fmt::format("cf-test-frames-{:d}.bin", getpid());
+    const frame_size_scope frame_sz{4096};
+    std::vector<uint32_t> expected(100'000);
+    for (size_t i = 0; i < expected.size(); ++i) {
+        expected[i] = (uint32_t)(i * 2654435761u);
+    }
+    {
+        const test_hdr hdr{.id = 1};
+        CompressedFile<test_hdr> fh{path, false, &hdr, 1};
+        for (const auto v : expected) {
+            fh.write(v);
+        }
+        REQUIRE(fh.num_zstd_ops() >= expected.size() * sizeof(uint32_t) / 4096);
+    }
+
+    CompressedFile<test_hdr> fh{path, true};
+    for (size_t i = 0; i < expected.size(); ++i) {
+        REQUIRE(fh.read<uint32_t>() == expected[i]);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("dict-roundtrip", TS) {
+    const auto dir = std::filesystem::temp_directory_path() / fmt::format("cf-dict-{:d}", getpid());
+    std::filesystem::create_directories(dir);
+    // 4 KiB samples drawn from a shared vocabulary of 256 byte snippets, like records of the
+    // same code running on different threads
+    std::vector<std::vector<uint8_t>> snippets(64, std::vector<uint8_t>(256));
+    uint64_t rng = 1;
+    const auto next = [&] {
+        rng = rng * 6364136223846793005ull + 1442695040888963407ull;
+        return rng >> 33;
+    };
+    for (auto &snippet : snippets) {
+        for (auto &b : snippet) {
+            b = (uint8_t)next();
+        }
+    }
+    const auto make_sample = [&] {
+        std::vector<uint8_t> res;
+        for (int i = 0; i < 16; ++i) {
+            const auto &snippet = snippets[next() % snippets.size()];
+            res.insert(res.end(), snippet.begin(), snippet.end());
+        }
+        return res;
+    };
+    std::vector<std::vector<uint8_t>> sample_bufs(256);
+    std::vector<std::span<const uint8_t>> samples;
+    for (auto &buf : sample_bufs) {
+        buf = make_sample();
+        samples.emplace_back(buf);
+    }
+    const auto dict = CompressionDict::train(samples, 32 * 1024);
+    REQUIRE(dict);
+    dict->write(dir / CompressionDict::sidecar_name);
+    const auto read_dict = CompressionDict::read_sidecar(dir);
+    REQUIRE(read_dict);
+    REQUIRE(read_dict->id() == dict->id());
+    REQUIRE(!CompressionDict::read_sidecar(std::filesystem::temp_directory_path() / "no-such-dir"));
+
+    const frame_size_scope frame_sz{4096};
+    std::vector<uint8_t> expected;
+    for (int i = 0; i < 16; ++i) {
+        const auto sample = make_sample();
+        expected.insert(expected.end(), sample.begin(), sample.end());
+    }
+    const test_hdr hdr{.id = 7};
+    {
+        CompressedFile<test_hdr> plain_fh{dir / "plain.bin", false, &hdr, 3};
+        CompressedFile<test_hdr> dict_fh{dir / "dict.bin", false, &hdr, 3, false, dict.get()};
+        plain_fh.write(expected);
+        dict_fh.write(expected);
+    }
+    // small independent frames are where the dictionary pays off
+    REQUIRE(std::filesystem::file_size(dir / "dict.bin") * 2 <
+            std::filesystem::file_size(dir / "plain.bin"));
+
+    CompressedFile<test_hdr> fh{dir / "dict.bin", true, nullptr, 0, false, read_dict.get()};
+    REQUIRE(fh.read() == expected);
+    std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("io-backends", TS) {
+    const auto path =
+        std::filesystem::temp_directory_path() / fmt::format("cf-test-io-{:d}.bin", getpid());
+    const auto orig_backend = FileIO::default_backend();
+    // several blocks, the last one partial
+    std::vector<uint8_t> expected(3 * FileIO::block_sz + 12345);
+    uint64_t rng = 1;
+    for (auto &b : expected) {
+        rng = rng * 6364136223846793005ull + 1442695040888963407ull;
+        b   = (uint8_t)(rng >> 60);
+    }
+    const test_hdr hdr{.id = 42};
+    for (const auto level : {0, 3}) {
+        for (const auto write_backend : {file_io_backend::stdio, file_io_backend::threaded}) {
+            const auto read_backend = write_backend == file_io_backend::stdio
+                                          ? file_io_backend::threaded
+                                          : file_io_backend::stdio;
+            FileIO::set_default_backend(write_backend);
+            {
+                CompressedFile<test_hdr> fh{path, false, &hdr, level};
+                fh.write(std::span{expected}.first(1000));
+                fh.write(std::span{expected}.subspan(1000));
+            }
+            FileIO::set_default_backend(read_backend);
+            CompressedFile<test_hdr> fh{path, true};
+            REQUIRE(fh.header().id == 42);
+            REQUIRE(fh.decompressed_size() == expected.size());
+            REQUIRE(fh.read(1000) == std::vector(expected.begin(), expected.begin() + 1000));
+            REQUIRE(fh.read(expected.size() - 1000) ==
+                    std::vector(expected.begin() + 1000, expected.end()));
+        }
+    }
+    FileIO::set_default_backend(orig_backend);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("checkpoint-recovery", TS) {
+    const auto path =
+        std::filesystem::temp_directory_path() / fmt::format("cf-test-ckpt-{:d}.bin", getpid());
+    const auto crashed_path = std::filesystem::path{path}.concat(".crashed");
+    const frame_size_scope frame_sz{4096};
+    std::vector<uint64_t> expected(64 * 1024);
+    for (size_t i = 0; i < expected.size(); ++i) {
+        expected[i] = i * 0x9E37'79B9'7F4A'7C15ull;
+    }
+    const std::span<const uint64_t> first{expected.data(), expected.size() / 2};
+    // level 0 checkpoints patch the header in place
+    for (const int level : {0, 3}) {
+        {
+            const test_hdr hdr{.id = 1};
+            CompressedFile<test_hdr> fh{path, false, &hdr, level};
+            fh.write(std::as_bytes(first).data(), first.size_bytes());
+            fh.header().id = 2;
+            fh.checkpoint();
+            fh.header().id = 3;
+            for (size_t i = first.size(); i < expected.size(); ++i) {
+                fh.write(expected[i]);
+            }
+            // the tracer dies with the last frame half written
+            fh.flush();
+            std::filesystem::copy_file(path, crashed_path,
+                                       std::filesystem::copy_options::overwrite_existing);
+            std::filesystem::resize_file(crashed_path,
+                                         std::filesystem::file_size(crashed_path) - 5);
+        }
+
+        {
+            CompressedFile<test_hdr> fh{crashed_path, true};
+            REQUIRE(fh.header().id == 2);
+            REQUIRE(fh.decompressed_size() == first.size_bytes());
+            const auto buf = fh.read();
+            REQUIRE(!memcmp(buf.data(), first.data(), first.size_bytes()));
+        }
+        // closed files read in full, footers included
+        {
+            CompressedFile<test_hdr> fh{path, true};
+            REQUIRE(fh.header().id == 3);
+            const auto buf = fh.read();
+            REQUIRE(buf.size() == expected.size() * sizeof(uint64_t));
+            REQUIRE(!memcmp(buf.data(), expected.data(), buf.size()));
+        }
+    }
+    std::filesystem::remove(path);
+    std::filesystem::remove(crashed_path);
+}
+
+TEST_CASE("map-uncompressed", TS) {
+    const auto path =
+        std::filesystem::temp_directory_path() / fmt::format("cf-test-map-{:d}.bin", getpid());
+    // spans more than a page, the body doesn't start on one
+    std::vector<uint8_t> expected(3 * getpagesize() + 123);
+    for (size_t i = 0; i < expected.size(); ++i) {
+        expected[i] = (uint8_t)(i * 7);
+    }
+    const test_hdr hdr{.id = 7};
+    {
+        CompressedFile<test_hdr> fh{path, false, &hdr, 0};
+        REQUIRE(!fh.is_compressed());
+        fh.write(expected);
+    }
+    std::shared_ptr<const MappedFile> mapping;
+    {
+        CompressedFile<test_hdr> fh{path, true};
+        REQUIRE(!fh.is_compressed());
+        REQUIRE(fh.header().id == 7);
+        mapping = fh.map();
+        // reads are unaffected by the mapping
+        REQUIRE(fh.read() == expected);
+    }
+    const auto bytes = mapping->data();
+    REQUIRE(std::vector(bytes.begin(), bytes.end()) == expected);
+
+    {
+        CompressedFile<test_hdr> fh{path, false, &hdr, 0};
+    }
+    REQUIRE(CompressedFile<test_hdr>{path, true}.map()->data().empty());
+
+    {
+        CompressedFile<test_hdr> comp_fh{path, false, &hdr, 3};
+        REQUIRE(comp_fh.is_compressed());
+        comp_fh.write(expected);
+    }
+    REQUIRE(CompressedFile<test_hdr>{path, true}.is_compressed());
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("header-appended-fields", TS) {
+    const auto path =
+        std::filesystem::temp_directory_path() / fmt::format("cf-test-hdr-{:d}.bin", getpid());
+    const std::vector<uint8_t> data{1, 2, 3, 4, 5};
+    for (const int level : {0, 3}) {
+        {
+            const test_hdr hdr{.id = 7};
+            CompressedFile<test_hdr> fh{path, false, &hdr, level};
+            fh.write(data);
+        }
+        CompressedFile<test_hdr_v2> fh{path, true};
+        REQUIRE(fh.header().id == 7);
+        REQUIRE(fh.header().extra == 0);
+        REQUIRE(fh.read() == data);
+    }
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,126 @@
+#include "xnu-trace/xnu-trace.h"
+
+#include "fixtures.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/format.h>
+
+#define TS "[LogColumns]"
+
+TEST_CASE("column-paths", TS) {
+    const std::filesystem::path thread_path{"trace/thread-7.bin"};
+    REQUIRE(log_column_path(thread_path, log_column::sp) == "trace/thread-7.sp.bin");
+    REQUIRE(log_column_path(thread_path, log_column::vec) == "trace/thread-7.vec.bin");
+    REQUIRE(is_log_column_path(log_column_path(thread_path, log_column::gpr)));
+    REQUIRE(!is_log_column_path(thread_path));
+    REQUIRE(!is_log_column_path("trace/macho-region-libfoo.dylib.bin"));
+}
+
+TEST_CASE("columns-round-trip", TS) {
+    log_builder b;
+    b.sync({.pc = 0x1000, .sp = 0x8000}, 0);
+    b.record(0, 0, {});                                            // seq
+    b.record(rpc_set_pc_branched(0), 0, {0x2000});                 // abs pc
+    b.record(rpc_set_pc_branched(rpc_set_sp_changed(0)), 0, {0x3000, 0x7ff0});
+    b.record(rpc_set_num_changed(rpc_set_reg_idx(rpc_set_reg_idx(0, 0, 3), 1, 30), 2), 0,
+             {0x1234, 0x5678});                                    // gprs
+    b.record(0, rpc_set_num_changed(rpc_set_reg_idx(0, 0, 4), 1), {}, {42}); // vec
+    b.delta(rpc_set_pc_branched(rpc_set_sp_changed(rpc_set_num_changed(0, 1))), 0, {-64, 16},
+            {0x99});                                               // delta pc/sp + gpr
+    b.record(rpc_set_pc_branched(rpc_set_bb_run(0)), 7, {0x4000}); // run
+    // single 8 byte read at an absolute address, with its value
+    b.record(0, rpc_set_mem(0), {});
+    const uint32_t mpc = mpc_set_values(
+        mpc_set_read(mpc_set_mem_access_sz(mpc_set_num_mem_accesses(0, 1), 0, 8), 0));
+    const uint64_t addr = 0x1'0000'0000;
+    const uint64_t val  = 0xdead'beef;
+    b.append(&mpc, sizeof(mpc));
+    b.append(&addr, sizeof(addr));
+    b.append(&val, sizeof(val));
+    b.sync({.pc = 0x5000, .sp = 0x9000}, 20);
+    b.record(0, 0, {});
+
+    std::vector<uint8_t> hdrs;
+    log_column_bufs_t columns;
+    // any record boundary is a valid split point
+    const auto first_sz = log_msg::size_full_ctx + 2 * sizeof(log_msg) + sizeof(uint64_t);
+    split_log_msgs({b.buf.data(), first_sz}, hdrs, columns);
+    split_log_msgs({b.buf.data() + first_sz, b.buf.size() - first_sz}, hdrs, columns);
+    REQUIRE(hdrs.size() == 2 * log_msg::size_full_ctx + 9 * sizeof(log_msg));
+    REQUIRE(columns[(size_t)log_column::pc].size() == 3 * sizeof(uint64_t) + 1);
+    REQUIRE(columns[(size_t)log_column::sp].size() == sizeof(uint64_t) + 1);
+    REQUIRE(columns[(size_t)log_column::gpr].size() == 3 * sizeof(uint64_t));
+    REQUIRE(columns[(size_t)log_column::vec].size() ==
+            sizeof(uint128_t) + sizeof(mpc) + sizeof(addr) + sizeof(val));
+
+    log_column_spans_t column_spans;
+    for (size_t i = 0; i < log_column_num; ++i) {
+        column_spans[i] = columns[i];
+    }
+    std::vector<uint8_t> joined;
+    const auto taken = join_log_msgs(hdrs, column_spans, joined);
+    REQUIRE(joined == b.buf);
+    for (size_t i = 0; i < log_column_num; ++i) {
+        REQUIRE(taken[i] == columns[i].size());
+    }
+
+    // PC-only records yield the same PCs without the other columns
+    std::vector<uint8_t> pc_only;
+    REQUIRE(join_pc_log_msgs(hdrs, columns[(size_t)log_column::pc], pc_only) ==
+            columns[(size_t)log_column::pc].size());
+    REQUIRE(pc_only.size() < joined.size());
+    const log_thread_buf full_buf{std::move(joined), 0};
+    const log_thread_buf pc_buf{std::move(pc_only), 0};
+    const auto pcs = extract_pcs_from_trace(full_buf);
+    REQUIRE(pcs.size() == 16);
+    REQUIRE(extract_pcs_from_trace(pc_buf) == pcs);
+}
+
+TEST_CASE("columnar-bundle-round-trip", TS) {
+    const auto dir =
+        std::filesystem::temp_directory_path() / fmt::format("log-columns-{:d}", getpid());
+    std::filesystem::create_directories(dir);
+    std::vector<log_arm64_cpu_context> contexts;
+    uint64_t pc = 0x1'0000'0000;
+    for (uint64_t i = 0; i < 64 * 1024; ++i) {
+        pc = i % 5 == 4 ? pc + 0x100 : pc + 4;
+        auto &ctx = contexts.emplace_back(log_arm64_cpu_context{.pc = pc, .sp = 0x8000 - i / 16});
+        ctx.x[i % 29] = i;
+        if (!(i % 9)) {
+            ctx.v[i % 32] = i;
+        }
+    }
+    // many more records than LogColumnWriter stages at once, from every writer of the files
+    const trace_log_opts opts{.sync   = sync_policy::fixed_instructions(1000),
+                              .format = record_format::columnar};
+    const auto regions = fake_macho_regions();
+    for (const bool stream : {false, true}) {
+        {
+            TraceLog trace{dir, 3, stream, opts};
+            for (const auto &ctx : contexts) {
+                trace.log(1, &ctx, nullptr);
+            }
+            trace.write(regions);
+        }
+        const TraceLog trace{dir};
+        const auto &log = trace.parsed_logs().at(1);
+        REQUIRE(log.num_inst() == contexts.size());
+        // the first sync frame's context comes ahead of the first record's
+        auto it = log.ctx_begin();
+        ++it;
+        size_t i = 0;
+        for (const auto e = log.ctx_end(); it != e; ++it, ++i) {
+            REQUIRE(i < contexts.size());
+            REQUIRE(!memcmp(&it.ctx(), &contexts[i], sizeof(contexts[i])));
+        }
+        REQUIRE(i == contexts.size());
+        const auto ctx = trace.context_at(1, 100);
+        REQUIRE(ctx);
+        REQUIRE(!memcmp(&*ctx, &contexts[100], sizeof(*ctx)));
+        // the register columns are never read, there is nothing to replay
+        const TraceLog pcs_trace{dir, true};
+        REQUIRE(pcs_trace.parsed_logs().at(1).num_inst() == contexts.size());
+        REQUIRE(!pcs_trace.context_at(1, 100));
+    }
+    std::filesystem::remove_all(dir);
+}
@@ -0,0 +1,71 @@
+#include "xnu-trace/xnu-trace.h"
+
+#include "fixtures.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+#define TS "[LogMsgV2]"
+
+namespace {
+std::vector<log_arm64_cpu_context> contexts(std::vector<uint8_t> buf) {
+    const log_thread_buf tbuf{std::move(buf), 0};
+    std::vector<log_arm64_cpu_context> res;
+    for (auto i = tbuf.ctx_begin(), e = tbuf.ctx_end(); i != e; ++i) {
+        res.emplace_back(i.ctx());
+    }
+    return res;
+}
+} // namespace
+
+TEST_CASE("v2-size-table", TS) {
+    REQUIRE(log_msg_v2_sizes[log_msg_v2::prefix(log_msg_v2::pc_seq, log_msg_v2::sp_same, 0)] ==
+            1);
+    REQUIRE(log_msg_v2_sizes[log_msg_v2::prefix(log_msg_v2::pc_rel8, log_msg_v2::sp_rel8, 1)] ==
+            1 + 1 + 1 + 9);
+    REQUIRE(log_msg_v2_sizes[log_msg_v2::prefix(log_msg_v2::pc_abs64, log_msg_v2::sp_abs64, 5)] ==
+            log_msg_v2::size_max);
+    REQUIRE(log_msg_v2_sizes[log_msg_v2::prefix(log_msg_v2::pc_rel16, log_msg_v2::sp_same,
+                                                log_msg_v2::n_bb_run)] == 1 + 2 + 4);
+    REQUIRE(log_msg_v2_sizes[log_msg_v2::prefix(log_msg_v2::pc_seq, log_msg_v2::sp_rel8,
+                                                log_msg_v2::n_bb_run)] == 0);
+    REQUIRE(log_msg_v2_sizes[log_msg_v2::prefix(5, log_msg_v2::sp_same, 0)] == 0);
+}
+
+TEST_CASE("v2-round-trip", TS) {
+    log_builder b;
+    b.sync({.pc = 0x1000, .sp = 0x8000}, 0);
+    b.record(0, 0, {});                                                  // seq
+    b.record(rpc_set_pc_branched(0), 0, {0x1010});                       // rel8
+    b.record(rpc_set_pc_branched(0), 0, {0x9000});                       // rel16
+    b.record(rpc_set_pc_branched(0), 0, {0x1'0000'0000});                // rel32
+    b.record(rpc_set_pc_branched(0), 0, {0xFFFF'8000'0000'0000});        // abs64
+    b.record(rpc_set_sp_changed(0), 0, {0x7ff0});                        // sp rel8
+    b.record(rpc_set_sp_changed(0), 0, {0x1'0000});                      // sp rel32
+    b.record(rpc_set_num_changed(rpc_set_reg_idx(rpc_set_reg_idx(0, 0, 3), 1, 30), 2), 0,
+             {0x1234, 0x5678});                                          // gprs
+    b.record(rpc_set_pc_branched(rpc_set_bb_run(0)), 7, {0x2000});       // run
+    b.record(0, rpc_set_num_changed(rpc_set_reg_idx(0, 0, 4), 1), {}, {42}); // escaped vec
+    b.sync({.pc = 0x3000, .sp = 0x9000}, 13);
+    b.delta(rpc_set_pc_branched(0), 0, {8});
+
+    std::vector<uint8_t> v2;
+    LogMsgV2Encoder encoder;
+    // any record boundary is a valid split point
+    const auto first_sz = log_msg::size_full_ctx + sizeof(log_msg);
+    encoder.encode({b.buf.data(), first_sz}, v2);
+    encoder.encode({b.buf.data() + first_sz, b.buf.size() - first_sz}, v2);
+    REQUIRE(v2.size() < b.buf.size());
+    REQUIRE(v2[0] == log_msg_v2::escape);
+    REQUIRE(v2[1 + log_msg::size_full_ctx] == 0);
+
+    std::vector<uint8_t> v1;
+    LogMsgV2Decoder{}.decode(v2, v1);
+    REQUIRE(LogMsgV2Decoder::decoded_size(v2) == v1.size());
+    const auto expected = contexts(b.buf);
+    const auto decoded  = contexts(v1);
+    REQUIRE(decoded.size() == expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        REQUIRE(!memcmp(&decoded[i], &expected[i], sizeof(expected[i])));
+    }
+    REQUIRE(decoded.back().pc == 0x3008);
+}
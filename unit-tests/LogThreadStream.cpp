@@ -0,0 +1,221 @@
+#include "xnu-trace/xnu-trace.h"
+
+#include "fixtures.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/format.h>
+
+#include <unistd.h>
+
+#define TS "[LogThreadStream]"
+
+namespace {
+// every kind of record a full context trace holds, sync frames in between. Each record is one
+// instruction so the records before a sync frame are its instruction count.
+log_builder build_log(size_t num_records) {
+    log_builder b;
+    uint64_t rng = 1;
+    uint64_t pc  = 0x1'0000'0000;
+    b.sync(pc, 0, 0x8000);
+    for (size_t i = 0; i < num_records; ++i) {
+        rng = rng * 6364136223846793005ull + 1442695040888963407ull;
+        switch ((rng >> 33) % 6) {
+        case 0:
+            b.record(0, 0, {});
+            pc += 4;
+            break;
+        case 1:
+            pc += (rng >> 40) & 0xffc;
+            b.record(rpc_set_pc_branched(rpc_set_sp_changed(0)), 0, {pc, rng >> 20});
+            break;
+        case 2:
+            b.record(rpc_set_num_changed(rpc_set_reg_idx(rpc_set_reg_idx(0, 0, 3), 1, 30), 2),
+                     0, {rng, ~rng});
+            pc += 4;
+            break;
+        case 3:
+            b.record(0, rpc_set_num_changed(rpc_set_reg_idx(0, 0, 4), 1), {}, {rng});
+            pc += 4;
+            break;
+        case 4: {
+            // one 8 byte read at an absolute address, with its value
+            b.record(0, rpc_set_mem(0), {});
+            const uint32_t mpc = mpc_set_values(
+                mpc_set_read(mpc_set_mem_access_sz(mpc_set_num_mem_accesses(0, 1), 0, 8), 0));
+            b.append(&mpc, sizeof(mpc));
+            b.append(&rng, sizeof(rng));
+            b.append(&pc, sizeof(pc));
+            pc += 4;
+            break;
+        }
+        case 5:
+            // never two sync frames in a row
+            pc += 0x40;
+            b.sync(pc, b.record_offs.size(), rng >> 24);
+            b.record(0, 0, {});
+            pc += 4;
+            break;
+        }
+    }
+    return b;
+}
+
+struct inst_state {
+    log_arm64_cpu_context ctx;
+    std::vector<std::pair<uint64_t, uint64_t>> mem;
+    bool operator==(const inst_state &o) const {
+        return !memcmp(&ctx, &o.ctx, sizeof(ctx)) && mem == o.mem;
+    }
+};
+
+template <typename It> std::vector<inst_state> ctx_states(It it, const It &e) {
+    std::vector<inst_state> res;
+    for (; it != e; ++it) {
+        auto &state = res.emplace_back();
+        memcpy(&state.ctx, &it.ctx(), sizeof(state.ctx));
+        for (const auto &access : it.mem_accesses()) {
+            uint64_t val;
+            memcpy(&val, access.value, sizeof(val));
+            state.mem.emplace_back(access.addr, val);
+        }
+    }
+    return res;
+}
+
+template <typename Log> std::vector<inst_state> ctx_states(Log &log) {
+    return ctx_states(log.ctx_begin(), log.ctx_end());
+}
+
+template <typename It> std::vector<uint64_t> pcs(It it, const It &e) {
+    std::vector<uint64_t> res;
+    for (; it != e; ++it) {
+        res.emplace_back(it.pc());
+    }
+    return res;
+}
+
+template <typename Log> std::vector<uint64_t> pcs(Log &log) {
+    return pcs(log.pcs_begin(), log.pcs_end());
+}
+} // namespace
+
+TEST_CASE("windows-match-whole-file", TS) {
+    const auto dir =
+        std::filesystem::temp_directory_path() / fmt::format("log-stream-{:d}", getpid());
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    const auto path = dir / "thread-5.bin";
+
+    const auto b = build_log(20000);
+    const log_thread_buf whole{std::vector<uint8_t>{b.buf}, b.record_offs.size()};
+    const auto expected_states = ctx_states(whole);
+    const auto expected_pcs    = pcs(whole);
+    REQUIRE(expected_pcs.size() == expected_states.size());
+
+    for (const auto format : {record_format::v1, record_format::v2, record_format::columnar}) {
+        const log_thread_hdr hdr{
+            .thread_id = 5, .num_inst = b.record_offs.size(), .record_format = (uint8_t)format};
+        {
+            CompressedFile<log_thread_hdr> fh{path, false, &hdr, 3};
+            std::unique_ptr<LogColumnWriter> columns;
+            if (format == record_format::columnar) {
+                columns = std::make_unique<LogColumnWriter>(path, hdr, 3);
+            }
+            write_log_msg_chunks(fh, {b.buf}, format, columns.get());
+        }
+        // down to the smallest window allowed, a couple of sync frames
+        for (const size_t window_sz :
+             {2 * (log_msg::size_full_ctx + 1), (size_t)4099, LogThreadStream::default_window_sz}) {
+            LogThreadStream stream{path, false, nullptr, window_sz};
+            REQUIRE(stream.thread_id() == 5);
+            REQUIRE(stream.num_inst() == b.record_offs.size());
+            REQUIRE(ctx_states(stream) == expected_states);
+            REQUIRE(stream.num_bytes() == b.buf.size());
+            // begin() rewinds
+            REQUIRE(pcs(stream) == expected_pcs);
+            if (format == record_format::columnar) {
+                LogThreadStream pcs_stream{path, true, nullptr, window_sz};
+                REQUIRE(pcs(pcs_stream) == expected_pcs);
+            }
+        }
+    }
+
+    // a thread that never logged anything
+    const log_thread_hdr hdr{.thread_id = 6};
+    {
+        CompressedFile<log_thread_hdr> fh{path, false, &hdr, 3};
+    }
+    LogThreadStream stream{path};
+    REQUIRE(stream.begin() == stream.end());
+    REQUIRE(pcs(stream).empty());
+    std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("seek-index", TS) {
+    const auto dir =
+        std::filesystem::temp_directory_path() / fmt::format("log-stream-seek-{:d}", getpid());
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    const auto path = dir / "thread-5.bin";
+
+    const auto b = build_log(20000);
+    const log_thread_buf whole{std::vector<uint8_t>{b.buf}, b.record_offs.size()};
+    const auto expected_states = ctx_states(whole);
+    const auto expected_pcs    = pcs(whole);
+    REQUIRE(b.syncs.size() > 100);
+
+    for (const auto format : {record_format::v1, record_format::v2}) {
+        for (const int level : {0, 3}) {
+            // small frames so most sync frames aren't in the first one
+            const frame_size_scope frame_sz{64 * 1024};
+            const log_thread_hdr hdr{
+                .thread_id = 5, .num_inst = b.record_offs.size(), .record_format = (uint8_t)format};
+            {
+                CompressedFile<log_thread_hdr> fh{path, false, &hdr, level};
+                // split right behind a sync frame
+                const std::span<const uint8_t> buf{b.buf};
+                const auto half = b.syncs[b.syncs.size() / 2].decomp_off + log_msg::size_full_ctx;
+                write_log_msg_chunks(fh, {buf.first(half), buf.subspan(half)}, format, nullptr,
+                                     b.syncs);
+            }
+            REQUIRE(std::filesystem::exists(seek_index_path(path)));
+            const SeekIndex index{path};
+            REQUIRE(index.entries().size() == b.syncs.size());
+            REQUIRE(index.find(0) == &index.entries()[0]);
+            REQUIRE(index.find(b.record_offs.size())->key == b.syncs.back().key);
+
+            LogThreadStream stream{path, false, nullptr, 4099};
+            for (size_t i = 0; i < b.syncs.size(); i += 37) {
+                const auto inst = b.syncs[i].key + 1;
+                auto it         = stream.seek(inst);
+                REQUIRE(it->is_sync_frame());
+                const auto first = it->sync_num_inst();
+                REQUIRE(first <= inst);
+                REQUIRE(first == index.find(inst)->key);
+                const auto seek_pcs = pcs(stream.pcs_seek(inst), stream.pcs_end());
+                // the pass picks up where the whole one is after first instructions. build_log()
+                // jumps at sync frames, the whole pass only sees that from the next record on.
+                REQUIRE(expected_pcs.size() - seek_pcs.size() == first);
+                REQUIRE(std::equal(seek_pcs.begin() + 1, seek_pcs.end(),
+                                   expected_pcs.begin() + first + 1));
+                const auto seek_states = ctx_states(stream.ctx_seek(inst), stream.ctx_end());
+                REQUIRE(expected_states.size() - seek_states.size() == first);
+                REQUIRE(std::equal(seek_states.begin() + 1, seek_states.end(),
+                                   expected_states.begin() + first + 1));
+            }
+            // begin() still starts at the front
+            REQUIRE(ctx_states(stream) == expected_states);
+        }
+    }
+
+    // rewriting the file drops the stale index, the stream falls back to the beginning
+    const log_thread_hdr hdr{.thread_id = 5, .num_inst = b.record_offs.size()};
+    {
+        CompressedFile<log_thread_hdr> fh{path, false, &hdr, 3};
+        write_log_msg_chunks(fh, {b.buf}, record_format::v1);
+    }
+    REQUIRE(!std::filesystem::exists(seek_index_path(path)));
+    LogThreadStream stream{path};
+    REQUIRE(stream.seek(b.record_offs.size() / 2)->sync_num_inst() == 0);
+    std::filesystem::remove_all(dir);
+}
@@ -0,0 +1,96 @@
+#include "xnu-trace/xnu-trace.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/format.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#define TS "[RegionStore]"
+
+namespace {
+void write_meta(const std::filesystem::path &bundle_dir, const std::string &store_path) {
+    std::filesystem::create_directories(bundle_dir);
+    const log_meta_hdr hdr{.region_store_path_len = store_path.size()};
+    CompressedFile<log_meta_hdr> fh{bundle_dir / "meta.bin", false, &hdr, 0};
+    fh.write(store_path.c_str(), store_path.size());
+}
+} // namespace
+
+TEST_CASE("put-gc", TS) {
+    const auto dir =
+        std::filesystem::temp_directory_path() / fmt::format("region-store-{:d}", getpid());
+    std::filesystem::remove_all(dir);
+    const RegionStore store{dir / "store"};
+
+    std::vector<uint8_t> text_a(16 * 1024, 0xa5);
+    std::vector<uint8_t> text_b(16 * 1024, 0x5a);
+    const auto digest_a = get_sha256(text_a);
+    const auto digest_b = get_sha256(text_b);
+    REQUIRE(!store.contains(digest_a));
+    store.put(digest_a, text_a);
+    store.put(digest_b, text_b);
+    REQUIRE(store.contains(digest_a));
+    {
+        CompressedFile<log_macho_region_hdr> fh{store.object_path(digest_a), true};
+        REQUIRE(!memcmp(fh.header().digest_sha256, digest_a.data(), digest_a.size()));
+        REQUIRE(fh.read() == text_a);
+    }
+
+    // bundle 1 uses both regions, bundle 2 only a
+    const auto bundle_1 = dir / "bundle-1";
+    const auto bundle_2 = dir / "bundle-2";
+    write_meta(bundle_1, store.path().string());
+    write_meta(bundle_2, store.path().string());
+    REQUIRE(RegionStore::bundle_store(bundle_1) == store.path());
+    store.set_ref(bundle_1, std::vector{digest_a, digest_b});
+    store.set_ref(bundle_2, std::vector{digest_a});
+
+    // young refs are kept whatever their bundle says
+    std::filesystem::remove_all(bundle_1);
+    REQUIRE(store.gc().num_refs_dropped == 0);
+    REQUIRE(store.contains(digest_b));
+
+    const auto stats = store.gc(std::chrono::seconds{0});
+    REQUIRE(stats.num_refs_dropped == 1);
+    REQUIRE(stats.num_objects_removed == 1);
+    REQUIRE(stats.bytes_freed > 0);
+    REQUIRE(store.contains(digest_a));
+    REQUIRE(!store.contains(digest_b));
+
+    // rewritten without the store, nothing is referenced anymore
+    write_meta(bundle_2, "");
+    REQUIRE(!RegionStore::bundle_store(bundle_2));
+    REQUIRE(store.gc(std::chrono::seconds{0}).num_objects_removed == 1);
+    REQUIRE(!store.contains(digest_a));
+    std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("set-ref-waits-for-gc", TS) {
+    const auto dir =
+        std::filesystem::temp_directory_path() / fmt::format("region-store-lock-{:d}", getpid());
+    std::filesystem::remove_all(dir);
+    const RegionStore store{dir / "store"};
+    std::filesystem::create_directories(store.path());
+
+    // stands in for a gc() between reading the refs and removing objects
+    const auto fd = open((store.path() / "lock").c_str(), O_RDONLY | O_CREAT, 0644);
+    REQUIRE(fd >= 0);
+    REQUIRE(!flock(fd, LOCK_EX));
+    std::atomic<bool> ref_set{};
+    std::thread writer([&] {
+        store.set_ref(dir / "bundle", std::vector<sha256_t>{});
+        ref_set = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(!ref_set);
+    close(fd);
+    writer.join();
+    REQUIRE(ref_set);
+    std::filesystem::remove_all(dir);
+}
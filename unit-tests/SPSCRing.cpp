@@ -0,0 +1,56 @@
+#include "xnu-trace/xnu-trace.h"
+
+#include <thread>
+
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/format.h>
+
+#define TS "[SPSCRing]"
+
+TEST_CASE("push-peek-release", TS) {
+    SPSCRing ring(16);
+    const uint8_t a[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+    REQUIRE(ring.try_push(a, sizeof(a)));
+    REQUIRE(!ring.try_push(a, sizeof(a)));
+    auto [first, second] = ring.peek();
+    REQUIRE(first.size() == sizeof(a));
+    REQUIRE(second.empty());
+    ring.release(first.size());
+    REQUIRE(ring.empty());
+
+    // wraps around the end of the buffer
+    REQUIRE(ring.try_push(a, sizeof(a)));
+    std::tie(first, second) = ring.peek();
+    REQUIRE(first.size() == 4);
+    REQUIRE(second.size() == 8);
+    REQUIRE(!memcmp(first.data(), a, 4));
+    REQUIRE(!memcmp(second.data(), a + 4, 8));
+}
+
+TEST_CASE("threaded", TS) {
+    constexpr uint64_t num = 1'000'000;
+    SPSCRing ring(4096);
+    std::thread producer([&] {
+        for (uint64_t i = 0; i < num; ++i) {
+            ring.push(&i, sizeof(i));
+        }
+    });
+    uint64_t expected = 0;
+    std::vector<uint8_t> pending;
+    while (expected < num) {
+        const auto [first, second] = ring.peek();
+        pending.insert(pending.end(), first.begin(), first.end());
+        pending.insert(pending.end(), second.begin(), second.end());
+        ring.release(first.size() + second.size());
+        size_t off = 0;
+        for (; off + sizeof(uint64_t) <= pending.size(); off += sizeof(uint64_t)) {
+            uint64_t v;
+            memcpy(&v, &pending[off], sizeof(v));
+            REQUIRE(v == expected);
+            ++expected;
+        }
+        pending.erase(pending.begin(), pending.begin() + off);
+    }
+    producer.join();
+    REQUIRE(ring.empty());
+}
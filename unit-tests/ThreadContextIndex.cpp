@@ -0,0 +1,153 @@
+#include "xnu-trace/xnu-trace.h"
+
+#include "fixtures.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/format.h>
+
+#include <unistd.h>
+
+#define TS "[ThreadContextIndex]"
+
+namespace {
+// full context records along with the context after every instruction
+struct ctx_log_builder : log_builder {
+    log_arm64_cpu_context ctx{.pc = 0x1'0000'0000, .sp = 0x8000};
+    // by instruction, dropped ones are nullopt
+    std::vector<std::optional<log_arm64_cpu_context>> expected;
+
+    void sync() {
+        log_builder::sync(ctx, expected.size());
+    }
+    void executed() {
+        expected.emplace_back(ctx);
+    }
+    void dropped(size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            ctx.pc += 4;
+            ctx.x[0] += i;
+            expected.emplace_back(std::nullopt);
+        }
+    }
+};
+
+ctx_log_builder build_log(size_t num_records) {
+    ctx_log_builder b;
+    uint64_t rng = 1;
+    b.sync();
+    for (size_t i = 0; i < num_records; ++i) {
+        rng = rng * 6364136223846793005ull + 1442695040888963407ull;
+        if (i % 50 == 49) {
+            if (i % 150 == 149) {
+                b.dropped(5);
+            }
+            b.sync();
+        }
+        switch ((rng >> 33) % 5) {
+        case 0: {
+            const auto reg = (uint32_t)(rng >> 20) % 31;
+            b.ctx.pc += 4;
+            (&b.ctx.x[0])[reg] = rng;
+            b.record(rpc_set_num_changed(rpc_set_reg_idx(0, 0, reg), 1), 0, {rng});
+            b.executed();
+            break;
+        }
+        case 1:
+            b.ctx.pc += (rng >> 40) & 0xffc;
+            b.record(rpc_set_pc_branched(0), 0, {b.ctx.pc});
+            b.executed();
+            break;
+        case 2: {
+            const auto reg = (uint32_t)(rng >> 20) % 32;
+            b.ctx.pc += 4;
+            b.ctx.v[reg] = rng;
+            b.record(0, rpc_set_num_changed(rpc_set_reg_idx(0, 0, reg), 1), {}, {rng});
+            b.executed();
+            break;
+        }
+        case 3:
+            b.record(rpc_set_bb_run(0), 3, {});
+            for (int j = 0; j < 3; ++j) {
+                b.ctx.pc += 4;
+                b.executed();
+            }
+            break;
+        case 4:
+            b.ctx.pc += 4;
+            b.ctx.sp = rng >> 24;
+            b.record(rpc_set_sp_changed(0), 0, {b.ctx.sp});
+            b.executed();
+            break;
+        }
+    }
+    return b;
+}
+
+bool same_ctx(const std::optional<log_arm64_cpu_context> &a,
+              const std::optional<log_arm64_cpu_context> &b) {
+    return a.has_value() == b.has_value() && (!a || !memcmp(&*a, &*b, sizeof(*a)));
+}
+
+std::optional<log_arm64_cpu_context> without_vecs(std::optional<log_arm64_cpu_context> ctx) {
+    if (ctx) {
+        memset(&ctx->v, 0, sizeof(ctx->v));
+    }
+    return ctx;
+}
+} // namespace
+
+TEST_CASE("context-at", TS) {
+    const auto b = build_log(3000);
+    // chunks cut at a record and at a sync frame
+    const auto cut_a = b.record_offs[b.record_offs.size() / 3];
+    const auto cut_b = b.syncs[b.syncs.size() * 2 / 3].decomp_off;
+    REQUIRE(cut_a < cut_b);
+    const auto owner = std::make_shared<std::vector<uint8_t>>(b.buf);
+    const auto *buf  = owner->data();
+    const log_thread_buf log{{{buf, cut_a},
+                              {buf + cut_a, cut_b - cut_a},
+                              {buf + cut_b, owner->size() - cut_b}},
+                             owner,
+                             b.expected.size()};
+
+    ThreadContextIndex index{log};
+    REQUIRE(!index.has_gpr_checkpoints());
+    const auto num_inst = b.expected.size();
+    for (uint64_t i = 0; i < num_inst; ++i) {
+        REQUIRE(same_ctx(index.context_at(i), b.expected[i]));
+        REQUIRE(same_ctx(index.gpr_context_at(i), without_vecs(b.expected[i])));
+    }
+    REQUIRE(!index.context_at(num_inst));
+    REQUIRE(!index.gpr_context_at(num_inst + 100));
+
+    index.build_gpr_checkpoints(16);
+    REQUIRE(index.has_gpr_checkpoints());
+    for (uint64_t i = 0; i < num_inst; ++i) {
+        REQUIRE(same_ctx(index.gpr_context_at(i), without_vecs(b.expected[i])));
+    }
+
+    const auto dir =
+        std::filesystem::temp_directory_path() / fmt::format("ctx-index-{:d}", getpid());
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    const auto path = gpr_checkpoints_path(dir / "thread-5.bin");
+    REQUIRE(path.filename() == "thread-5.gprs.bin");
+    REQUIRE(is_gpr_checkpoints_path(path));
+    index.write_gpr_checkpoints(path);
+
+    ThreadContextIndex read_index{log};
+    REQUIRE(read_index.read_gpr_checkpoints(path));
+    REQUIRE(read_index.has_gpr_checkpoints());
+    for (uint64_t i = 0; i < num_inst; i += 7) {
+        REQUIRE(same_ctx(read_index.gpr_context_at(i), without_vecs(b.expected[i])));
+    }
+
+    // checkpoints of another log are stale
+    const auto other_b = build_log(1000);
+    const log_thread_buf other_log{std::vector<uint8_t>{other_b.buf}, other_b.expected.size()};
+    ThreadContextIndex other_index{other_log};
+    REQUIRE(!other_index.read_gpr_checkpoints(path));
+    REQUIRE(!other_index.has_gpr_checkpoints());
+    REQUIRE(!other_index.read_gpr_checkpoints(dir / "missing.gprs.bin"));
+    std::filesystem::remove_all(dir);
+}
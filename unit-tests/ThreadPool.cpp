@@ -0,0 +1,43 @@
+#include "xnu-trace/xnu-trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <catch2/catch_test_macros.hpp>
+
+#define TS "[ThreadPool]"
+
+namespace {
+// runs wait_on_n_tasks_limited with blocks long enough to overlap, returns the most that ran at
+// once and checks every index ran exactly once
+size_t max_concurrent_blocks(size_t n, size_t max_concurrent) {
+    std::atomic<size_t> running{0};
+    std::atomic<size_t> max_running{0};
+    std::vector<std::atomic<uint32_t>> runs(n);
+    xnutrace_pool.wait_on_n_tasks_limited(n, max_concurrent, [&](const auto i) {
+        const auto now = ++running;
+        auto prev      = max_running.load();
+        while (prev < now && !max_running.compare_exchange_weak(prev, now)) {}
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        ++runs[i];
+        --running;
+    });
+    REQUIRE(std::all_of(runs.begin(), runs.end(), [](const auto &r) {
+        return r == 1;
+    }));
+    return max_running;
+}
+} // namespace
+
+TEST_CASE("wait-on-n-tasks-limited", TS) {
+    for (const size_t limit : {1, 2, 3}) {
+        REQUIRE(max_concurrent_blocks(100, limit) <= limit);
+    }
+    // fewer indexes than the limit
+    REQUIRE(max_concurrent_blocks(3, 8) <= 3);
+    // 0 = the pool's thread count
+    REQUIRE(max_concurrent_blocks(100, 0) <= xnutrace_pool.get_thread_count());
+    REQUIRE(max_concurrent_blocks(0, 2) == 0);
+}
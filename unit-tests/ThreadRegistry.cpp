@@ -0,0 +1,70 @@
+#include "xnu-trace/xnu-trace.h"
+
+#include <thread>
+
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/format.h>
+
+#define TS "[ThreadRegistry]"
+
+TEST_CASE("grow-keeps-values", TS) {
+    ThreadRegistry<uint64_t> reg;
+    std::vector<uint64_t *> ptrs;
+    for (uint32_t i = 1; i <= 1000; ++i) {
+        ptrs.emplace_back(&reg.get_or_create(i, [&] {
+            return std::make_unique<uint64_t>(i * 10);
+        }));
+    }
+    REQUIRE(reg.size() == 1000);
+    for (uint32_t i = 1; i <= 1000; ++i) {
+        REQUIRE(reg.find(i) == ptrs[i - 1]);
+        REQUIRE(*reg.find(i) == i * 10);
+    }
+    REQUIRE(reg.find(1001) == nullptr);
+}
+
+TEST_CASE("separate-registries", TS) {
+    ThreadRegistry<uint64_t> a;
+    ThreadRegistry<uint64_t> b;
+    a.get_or_create(7, [] {
+        return std::make_unique<uint64_t>(1);
+    });
+    REQUIRE(*a.find(7) == 1);
+    // a's cached hit must not leak into b
+    REQUIRE(b.find(7) == nullptr);
+    b.get_or_create(7, [] {
+        return std::make_unique<uint64_t>(2);
+    });
+    REQUIRE(*a.find(7) == 1);
+    REQUIRE(*b.find(7) == 2);
+}
+
+TEST_CASE("concurrent-get-or-create", TS) {
+    ThreadRegistry<std::atomic<uint64_t>> reg;
+    constexpr uint32_t num_threads = 8;
+    constexpr uint32_t num_keys    = 512;
+    std::atomic<uint32_t> num_made{};
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&] {
+            for (uint32_t i = 0; i < num_keys * 4; ++i) {
+                const uint32_t key = 1 + (i % num_keys);
+                auto &cnt          = reg.get_or_create(key, [&] {
+                    ++num_made;
+                    return std::make_unique<std::atomic<uint64_t>>();
+                });
+                ++cnt;
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    REQUIRE(num_made == num_keys);
+    uint64_t total = 0;
+    reg.for_each([&](auto, const auto &cnt) {
+        REQUIRE(cnt == num_threads * 4);
+        total += cnt;
+    });
+    REQUIRE(total == num_threads * num_keys * 4);
+}
@@ -0,0 +1,582 @@
+#include "xnu-trace/xnu-trace.h"
+
+#include "fixtures.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/format.h>
+
+#define TS "[TraceLog]"
+
+TEST_CASE("bb-run-expansion", TS) {
+    log_builder b;
+    b.sync(0x1000, 0);
+    b.pc(0x1000);
+    b.run(3, std::nullopt);
+    b.run(4, 0x2000);
+    b.seq();
+    b.sync(0x2014, 9);
+    b.run(2, 0x3000);
+    const std::vector<uint64_t> expected{0x1000, 0x1000, 0x1004, 0x1008, 0x100c, 0x2000,
+                                         0x2004, 0x2008, 0x200c, 0x2010, 0x3000, 0x3004};
+    const log_thread_buf tbuf{std::move(b.buf), expected.size()};
+    REQUIRE(extract_pcs_from_trace(tbuf) == expected);
+
+    std::vector<uint64_t> ctx_pcs;
+    for (auto i = tbuf.ctx_begin(), e = tbuf.ctx_end(); i != e; ++i) {
+        ctx_pcs.emplace_back(i.ctx().pc);
+    }
+    // one context per record, runs leave the pc at their last instruction
+    REQUIRE(ctx_pcs == std::vector<uint64_t>{0x1000, 0x1000, 0x100c, 0x200c, 0x2010, 0x3004});
+}
+
+TEST_CASE("pc-ranges", TS) {
+    log_builder b;
+    b.sync(0x1000, 0);
+    b.pc(0x1000);
+    b.run(3, std::nullopt);
+    b.run(4, 0x2000);
+    b.seq();
+    b.run(2, 0x3000);
+    b.pc(0x1004);
+    b.pc(0x2014);
+    const log_thread_buf tbuf{std::move(b.buf), 14};
+    const auto ranges = extract_pc_ranges_from_traces({&tbuf, &tbuf});
+    REQUIRE(ranges ==
+            std::vector<pc_range>{{0x1000, 0x1010}, {0x2000, 0x2018}, {0x3000, 0x3008}});
+}
+
+TEST_CASE("coalesce-pc-ranges", TS) {
+    std::vector<pc_range> ranges{
+        {0x30, 0x40}, {0x10, 0x20}, {0x20, 0x24}, {0x14, 0x18}, {0x50, 0x54}};
+    coalesce_pc_ranges(ranges);
+    REQUIRE(ranges == std::vector<pc_range>{{0x10, 0x24}, {0x30, 0x40}, {0x50, 0x54}});
+}
+
+TEST_CASE("bb-run-record-size", TS) {
+    log_builder b;
+    b.run(rpc_bb_run_len_max, 0x4000);
+    const auto &msg = *(const log_msg *)b.buf.data();
+    REQUIRE(msg.is_bb_run());
+    REQUIRE(msg.bb_run_len() == rpc_bb_run_len_max);
+    REQUIRE(msg.num_vec() == 0);
+    REQUIRE(msg.size() == sizeof(log_msg) + sizeof(uint64_t));
+}
+
+TEST_CASE("varint-round-trip", TS) {
+    for (const int64_t val : std::vector<int64_t>{0, 1, -1, 63, -64, 64, 0x1234'5678, INT64_MAX,
+                                                  INT64_MIN}) {
+        uint8_t buf[10];
+        const auto enc = zigzag_encode(val);
+        const auto sz  = varint_encode(buf, enc);
+        REQUIRE(sz == varint_size(enc));
+        size_t dec_sz = 0;
+        REQUIRE(zigzag_decode(varint_decode(buf, &dec_sz)) == val);
+        REQUIRE(dec_sz == sz);
+    }
+    REQUIRE(varint_size(zigzag_encode(-64)) == 1);
+    REQUIRE(varint_size(zigzag_encode(64)) == 2);
+    REQUIRE(pc_sp_delta_fits(0x1'8000'0000, 0x1'0000'0000));
+    REQUIRE(!pc_sp_delta_fits(0x8000'0000'0000'0000, 0));
+}
+
+TEST_CASE("pc-sp-delta-decode", TS) {
+    log_builder b;
+    b.sync(0x1000, 0, 0x8000);
+    b.delta(rpc_set_pc_branched(0), 0, {-0x10});
+    b.seq();
+    b.delta(rpc_set_pc_branched(rpc_set_bb_run(0)), 3, {0x2000 - 0xff4});
+    b.delta(rpc_set_pc_branched(rpc_set_sp_changed(0)), 0, {0x3000 - 0x2008, -0x20});
+    b.delta(rpc_set_sp_changed(0), 0, {0x10});
+    // unaligned sync frame after the varints
+    b.sync(0x3004, 8, 0x7ff0);
+    b.delta(rpc_set_pc_branched(0), 0, {0xfc});
+    const std::vector<uint64_t> expected{0x1000, 0xff0,  0xff4,  0x2000, 0x2004,
+                                         0x2008, 0x3000, 0x3004, 0x3100};
+    const log_thread_buf tbuf{std::move(b.buf), expected.size()};
+    REQUIRE(extract_pcs_from_trace(tbuf) == expected);
+
+    std::vector<std::pair<uint64_t, uint64_t>> pc_sps;
+    for (auto i = tbuf.ctx_begin(), e = tbuf.ctx_end(); i != e; ++i) {
+        pc_sps.emplace_back(i.ctx().pc, i.ctx().sp);
+    }
+    REQUIRE(pc_sps == std::vector<std::pair<uint64_t, uint64_t>>{{0x1000, 0x8000},
+                                                                 {0xff0, 0x8000},
+                                                                 {0xff4, 0x8000},
+                                                                 {0x2008, 0x8000},
+                                                                 {0x3000, 0x7fe0},
+                                                                 {0x3004, 0x7ff0},
+                                                                 {0x3100, 0x7ff0}});
+}
+
+TEST_CASE("mem-access-decode", TS) {
+    const uint8_t val[4] = {1, 2, 3, 4};
+    uint64_t last_addr   = 0;
+    log_builder b;
+    b.sync(0x1000, 0);
+    b.record(0, rpc_set_mem(0));
+    b.mem({{.addr = 0x5000, .size = 8, .read = true}, {.addr = 0x4ff0, .size = 16, .write = true}},
+          true, last_addr);
+    const auto abs_off = b.buf.size();
+    b.record(rpc_set_pc_branched(0), rpc_set_mem(0), {0x2000});
+    b.mem({{.addr = 0xffff'0000'0000'0000, .size = 4, .read = true, .write = true, .value = val}},
+          false, last_addr);
+    const auto abs_sz = b.buf.size() - abs_off;
+    b.seq();
+    // the address base resets at sync frames
+    b.sync(0x3000, 3);
+    last_addr = 0;
+    b.record(0, rpc_set_mem(0));
+    b.mem({{.addr = 0x10, .size = 1, .read = true}}, true, last_addr);
+    REQUIRE(abs_sz == sizeof(log_msg) + 8 + 4 + 8 + sizeof(val));
+    REQUIRE(((const log_msg *)&b.buf[abs_off])->size() == abs_sz);
+
+    const log_thread_buf tbuf{std::move(b.buf), 5};
+    std::vector<std::tuple<uint64_t, uint64_t, uint32_t, bool, bool>> accesses;
+    std::vector<uint64_t> no_mem_pcs;
+    for (auto i = tbuf.ctx_begin(), e = tbuf.ctx_end(); i != e; ++i) {
+        if (i.mem_accesses().empty()) {
+            no_mem_pcs.emplace_back(i.ctx().pc);
+        }
+        for (const auto &access : i.mem_accesses()) {
+            accesses.emplace_back(i.ctx().pc, access.addr, access.size, access.read,
+                                  access.write);
+            if (access.value) {
+                REQUIRE(!memcmp(access.value, val, sizeof(val)));
+            }
+        }
+    }
+    REQUIRE(accesses == std::vector<std::tuple<uint64_t, uint64_t, uint32_t, bool, bool>>{
+                            {0x1004, 0x5000, 8, true, false},
+                            {0x1004, 0x4ff0, 16, false, true},
+                            {0x2000, 0xffff'0000'0000'0000, 4, true, true},
+                            {0x3004, 0x10, 1, true, false}});
+    REQUIRE(no_mem_pcs == std::vector<uint64_t>{0x1000, 0x2004});
+    REQUIRE(extract_pcs_from_trace(tbuf) ==
+            std::vector<uint64_t>{0x1000, 0x1004, 0x2000, 0x2004, 0x3004});
+}
+
+TEST_CASE("parallel-decode", TS) {
+    // BBs run across the sync frames, some are after dropped instructions
+    log_builder b;
+    uint64_t pc = 0x1000, num_inst = 1, last_addr = 0;
+    b.sync(pc, 0, 0x8000);
+    b.pc(pc);
+    for (uint64_t i = 0; i < 400; ++i) {
+        if (i % 7 == 6) {
+            if (!(i % 3)) {
+                num_inst += 5;
+                pc += 0x100;
+            }
+            b.sync(pc, num_inst, 0x8000 + i);
+            last_addr = 0;
+            continue;
+        }
+        switch (i % 4) {
+        case 0:
+            b.seq();
+            pc += 4;
+            ++num_inst;
+            break;
+        case 1:
+            pc += 0x40;
+            b.pc(pc);
+            ++num_inst;
+            break;
+        case 2:
+            b.run(3, std::nullopt);
+            pc += 12;
+            num_inst += 3;
+            break;
+        case 3:
+            b.record(0, rpc_set_mem(0));
+            b.mem({{.addr = 0x5000 + i * 8, .size = 8, .read = true}}, true, last_addr);
+            pc += 4;
+            ++num_inst;
+            break;
+        }
+    }
+    // chunks cut at a record and at a sync frame
+    const auto cut_a = b.record_offs[b.record_offs.size() / 3];
+    const auto cut_b = b.syncs[b.syncs.size() * 2 / 3].decomp_off;
+    REQUIRE(cut_a < cut_b);
+    const auto owner = std::make_shared<std::vector<uint8_t>>(std::move(b.buf));
+    const auto *buf  = owner->data();
+    const log_thread_buf tbuf{{{buf, cut_a}, {buf + cut_a, cut_b - cut_a},
+                               {buf + cut_b, owner->size() - cut_b}},
+                              owner,
+                              num_inst};
+
+    std::vector<uint64_t> pcs;
+    for (auto i = tbuf.pcs_begin(), e = tbuf.pcs_end(); i != e; ++i) {
+        pcs.emplace_back(i.pc());
+    }
+    const auto bb_pairs = [](const std::vector<bb_t> &bbs) {
+        std::vector<std::pair<uint64_t, uint32_t>> res;
+        for (const auto &bb : bbs) {
+            res.emplace_back(bb.pc, bb.sz);
+        }
+        return res;
+    };
+    const auto bbs = bb_pairs(extract_bbs_from_pc_trace(pcs));
+    const auto ctx_states = [](const log_thread_buf &log) {
+        std::vector<std::tuple<uint64_t, uint64_t, uint64_t>> res;
+        for (auto i = log.ctx_begin(), e = log.ctx_end(); i != e; ++i) {
+            const auto &mem = i.mem_accesses();
+            res.emplace_back(i.ctx().pc, i.ctx().sp, mem.empty() ? 0 : mem[0].addr);
+        }
+        return res;
+    };
+    const auto states = ctx_states(tbuf);
+
+    REQUIRE(tbuf.chunk_into_bins(8).size() > 1);
+    for (uint32_t n = 1; n <= 16; ++n) {
+        const auto bins = tbuf.chunk_into_bins(n);
+        REQUIRE(bins.size() <= n);
+        uint64_t bins_num_inst = 0;
+        for (const auto &bin : bins) {
+            REQUIRE(bin.front().is_sync_frame());
+            bins_num_inst += bin.num_inst();
+        }
+        REQUIRE(bins_num_inst == num_inst);
+        REQUIRE(extract_pcs_from_trace(tbuf, n) == pcs);
+        REQUIRE(bb_pairs(extract_bbs_from_trace(tbuf, n)) == bbs);
+        std::vector<std::tuple<uint64_t, uint64_t, uint64_t>> bin_states;
+        for (const auto &s : map_log_bins(tbuf, ctx_states, n)) {
+            bin_states.insert(bin_states.end(), s.begin(), s.end());
+        }
+        REQUIRE(bin_states == states);
+    }
+
+    const log_thread_buf empty;
+    REQUIRE(extract_pcs_from_trace(empty).empty());
+    REQUIRE(extract_bbs_from_trace(empty).empty());
+}
+
+TEST_CASE("block-pc-decode", TS) {
+    // stretches of more than pc_decode_block_sz block records between the log_msg ones
+    log_builder b;
+    uint64_t pc = 0x1'0000'0000, num_inst = 1, last_addr = 0, rng = 1;
+    b.sync(pc, 0, 0x8000);
+    for (uint64_t i = 0; i < 5000; ++i) {
+        rng = rng * 6364136223846793005ull + 1442695040888963407ull;
+        if (i % 700 == 699) {
+            num_inst += 3;
+            pc += 0x80;
+            b.sync(pc, num_inst);
+            last_addr = 0;
+            continue;
+        }
+        const auto r = (rng >> 33) % 100;
+        if (r < 30) {
+            // changed GPRs, vectors and SP after the header
+            const auto ngpr = (uint32_t)(rng >> 20) % 6;
+            const auto nvec = (uint32_t)(rng >> 24) % 6;
+            const bool sp   = rng & (1 << 10);
+            b.record(rpc_set_num_changed(sp ? rpc_set_sp_changed(0) : 0, ngpr),
+                     rpc_set_num_changed(0, nvec));
+            b.buf.resize(b.buf.size() + (sp + ngpr) * sizeof(uint64_t) +
+                         nvec * sizeof(uint128_t));
+            pc += 4;
+            ++num_inst;
+        } else if (r < 55) {
+            pc += (rng >> 40) & 0xffc;
+            b.pc(pc);
+            ++num_inst;
+        } else if (r < 75) {
+            const auto len = 1 + (uint32_t)(rng >> 20) % 40;
+            std::optional<uint64_t> target;
+            if (rng & (1 << 12)) {
+                pc     = 0x2'0000'0000 + ((rng >> 24) & 0xfff'fffc);
+                target = pc;
+            } else {
+                pc += 4;
+            }
+            b.run(len, target);
+            pc += (len - 1) * 4;
+            num_inst += len;
+        } else if (r < 90) {
+            b.seq();
+            pc += 4;
+            ++num_inst;
+        } else if (r < 93) {
+            const auto new_pc = pc - 0x40;
+            b.delta(rpc_set_pc_branched(0), 0, {(int64_t)(new_pc - pc)});
+            pc = new_pc;
+            ++num_inst;
+        } else if (r < 95) {
+            const auto new_pc = pc + 0x1000;
+            b.delta(rpc_set_pc_branched(rpc_set_bb_run(0)), 5, {(int64_t)(new_pc - pc)});
+            pc = new_pc + 4 * 4;
+            num_inst += 5;
+        } else {
+            b.record(0, rpc_set_mem(0));
+            b.mem({{.addr = 0x5000 + i * 8, .size = 8, .read = true}}, true, last_addr);
+            pc += 4;
+            ++num_inst;
+        }
+    }
+    // a chunk cut at a record in the middle of a block
+    const auto cut   = b.record_offs[b.record_offs.size() / 2 + 17];
+    const auto owner = std::make_shared<std::vector<uint8_t>>(std::move(b.buf));
+    const auto *buf  = owner->data();
+    const log_thread_buf tbuf{{{buf, cut}, {buf + cut, owner->size() - cut}}, owner, num_inst};
+
+    const auto iterated = [](const log_thread_buf &log) {
+        std::vector<uint64_t> res;
+        for (auto i = log.pcs_begin(), e = log.pcs_end(); i != e; ++i) {
+            res.emplace_back(i.pc());
+        }
+        return res;
+    };
+    const auto expected = iterated(tbuf);
+    REQUIRE(expected.size() == num_inst - 3 * (5000 / 700));
+    REQUIRE(expected.back() == pc);
+    std::vector<uint64_t> pcs;
+    decode_log_pcs(tbuf, pcs);
+    REQUIRE(pcs == expected);
+
+    // bins start past their sync frame, decoding appends
+    const auto bins = tbuf.chunk_into_bins(4);
+    REQUIRE(bins.size() > 1);
+    std::vector<uint64_t> bin_pcs{0x1234};
+    for (const auto &bin : bins) {
+        REQUIRE(iterated(bin).size() <= bin.num_inst() + 1);
+        decode_log_pcs(bin, bin_pcs);
+    }
+    REQUIRE(bin_pcs.front() == 0x1234);
+    REQUIRE(std::equal(bin_pcs.begin() + 1, bin_pcs.end(), expected.begin(), expected.end()));
+
+    // a log whose num_inst undercounts still decodes whole
+    const log_thread_buf short_buf{{{buf, owner->size()}}, owner, 10};
+    pcs.clear();
+    decode_log_pcs(short_buf, pcs);
+    REQUIRE(pcs == expected);
+}
+
+namespace {
+// the records of a stream mode thread file, its TraceLog has to be destroyed already
+std::vector<uint8_t> thread_file_records(const std::filesystem::path &log_dir, uint32_t tid) {
+    CompressedFile<log_thread_hdr> fh{log_dir / fmt::format("thread-{:d}.bin", tid), true};
+    return fh.read();
+}
+
+// the instruction count of every sync frame in the records
+std::vector<uint64_t> sync_frame_insts(std::span<const uint8_t> records) {
+    std::vector<uint64_t> res;
+    for (const auto *p = records.data(), *end = p + records.size(); p < end;) {
+        const auto &msg = *(const log_msg *)p;
+        if (msg.is_sync_frame()) {
+            uint64_t num_inst;
+            memcpy(&num_inst, p + sizeof(log_msg::sync_frame_buf_hdr), sizeof(num_inst));
+            res.emplace_back(num_inst);
+        }
+        p += msg.size();
+    }
+    return res;
+}
+
+size_t num_sync_frames(const log_thread_buf &log) {
+    size_t res = 0;
+    for (const auto &chunk : log.chunks()) {
+        res += sync_frame_insts(chunk).size();
+    }
+    return res;
+}
+} // namespace
+
+TEST_CASE("log-batch-matches-log", TS) {
+    const auto dir =
+        std::filesystem::temp_directory_path() / fmt::format("log-batch-{:d}", getpid());
+    std::filesystem::create_directories(dir);
+    std::vector<uint64_t> pcs;
+    std::vector<log_arm64_cpu_context> contexts;
+    uint64_t pc = 0x1'0000'0000;
+    for (uint64_t i = 0; i < 3000; ++i) {
+        pc = i % 5 == 4 ? pc + 0x100 : pc + 4;
+        pcs.emplace_back(pc);
+        auto &ctx = contexts.emplace_back(log_arm64_cpu_context{.pc = pc, .sp = 0x8000 - i / 10});
+        ctx.x[i % 29] = i;
+        if (!(i % 7)) {
+            ctx.v[i % 32] = i;
+        }
+    }
+    for (const bool delta_pc_sp : {false, true}) {
+        // sync frames land inside the batches, the second batch starts between two of them
+        const trace_log_opts opts{.sync        = sync_policy::fixed_instructions(100),
+                                  .delta_pc_sp = delta_pc_sp};
+        const auto single_dir = dir / "single";
+        const auto batch_dir  = dir / "batch";
+        {
+            TraceLog single{single_dir, 0, true, opts};
+            TraceLog batch{batch_dir, 0, true, opts};
+            for (const auto p : pcs) {
+                single.log(1, p);
+            }
+            for (const auto &ctx : contexts) {
+                single.log(2, &ctx, nullptr);
+            }
+            batch.log_batch(1, std::span{pcs}.first(1234));
+            batch.log_batch(1, std::span{pcs}.subspan(1234));
+            batch.log_batch(2, std::span{contexts}.first(1234));
+            batch.log_batch(2, std::span{contexts}.subspan(1234));
+            REQUIRE(batch.num_inst() == single.num_inst());
+        }
+        for (const uint32_t tid : {1, 2}) {
+            const auto records = thread_file_records(single_dir, tid);
+            REQUIRE(sync_frame_insts(records).size() == 30);
+            REQUIRE(thread_file_records(batch_dir, tid) == records);
+            // level 0 files are mapped by readers and their records used in place
+            CompressedFile<log_thread_hdr> fh{batch_dir / fmt::format("thread-{:d}.bin", tid),
+                                              true};
+            REQUIRE(!((uintptr_t)fh.map()->data().data() % 16));
+        }
+    }
+    std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("spill-matches-in-memory", TS) {
+    const auto dir =
+        std::filesystem::temp_directory_path() / fmt::format("log-spill-{:d}", getpid());
+    std::filesystem::create_directories(dir);
+    std::vector<uint64_t> pcs;
+    std::vector<log_arm64_cpu_context> contexts;
+    uint64_t pc = 0x1'0000'0000;
+    for (uint64_t i = 0; i < 1024 * 1024; ++i) {
+        pc = i % 5 == 4 ? pc + 0x100 : pc + 4;
+        pcs.emplace_back(pc);
+        if (i < 256 * 1024) {
+            auto &ctx = contexts.emplace_back(log_arm64_cpu_context{.pc = pc, .sp = 0x8000});
+            ctx.x[i % 29] = i;
+            ctx.x[i % 7]  = i * 3;
+        }
+    }
+    // the first sync frame's PC and context come ahead of the first record's
+    auto expected_pcs = pcs;
+    expected_pcs.insert(expected_pcs.begin(), pcs.front());
+    auto expected_contexts = contexts;
+    expected_contexts.insert(expected_contexts.begin(), contexts.front());
+    // a single sync frame unless a spill adds one, the spill checks come every MiB of records
+    // per thread and a 1 byte budget makes each of them spill
+    const auto sync    = sync_policy::fixed_instructions(UINT64_MAX);
+    const auto regions = fake_macho_regions();
+    for (const bool bb_runs : {false, true}) {
+        const auto run_dir = dir / (bb_runs ? "bb-runs" : "records");
+        std::filesystem::create_directories(run_dir);
+        const std::map<std::string, trace_log_opts> runs{
+            {"in-memory", {.sync = sync, .bb_runs = bb_runs}},
+            {"spilled", {.sync = sync, .bb_runs = bb_runs, .mem_budget = 1}}};
+        for (const auto &[name, opts] : runs) {
+            TraceLog trace{run_dir / name, 3, false, opts};
+            for (size_t i = 0; i < pcs.size(); i += 1000) {
+                trace.log_batch(1,
+                                std::span{pcs}.subspan(i, std::min<size_t>(1000, pcs.size() - i)));
+            }
+            trace.log_batch(2, contexts);
+            REQUIRE(std::filesystem::exists(run_dir / name / "thread-1.bin") == !!opts.mem_budget);
+            trace.write(regions);
+        }
+
+        const TraceLog in_memory{run_dir / "in-memory"};
+        const TraceLog spilled{run_dir / "spilled"};
+        REQUIRE(spilled.num_inst() == in_memory.num_inst());
+        REQUIRE(spilled.num_inst() == pcs.size() + contexts.size());
+        for (const uint32_t tid : {1, 2}) {
+            const auto &log = spilled.parsed_logs().at(tid);
+            REQUIRE(num_sync_frames(in_memory.parsed_logs().at(tid)) == 1);
+            // bb runs take a MiB for about 5 times as many instructions
+            REQUIRE(num_sync_frames(log) > (bb_runs && tid == 1 ? 1 : 4));
+            REQUIRE(log.num_inst() == in_memory.parsed_logs().at(tid).num_inst());
+        }
+        for (const auto *trace : {&in_memory, &spilled}) {
+            REQUIRE(extract_pcs_from_trace(trace->parsed_logs().at(1)) == expected_pcs);
+            const auto &log = trace->parsed_logs().at(2);
+            size_t i        = 0;
+            for (auto it = log.ctx_begin(), e = log.ctx_end(); it != e; ++it, ++i) {
+                REQUIRE(i < expected_contexts.size());
+                REQUIRE(!memcmp(&it.ctx(), &expected_contexts[i], sizeof(expected_contexts[i])));
+            }
+            REQUIRE(i == expected_contexts.size());
+        }
+    }
+    std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("sync-policy-frames", TS) {
+    const auto dir =
+        std::filesystem::temp_directory_path() / fmt::format("log-sync-{:d}", getpid());
+    std::filesystem::create_directories(dir);
+    // sequential PCs, every record but the first is a bare 8 byte header
+    constexpr uint64_t rec_sz = sizeof(log_msg);
+    std::vector<uint64_t> pcs(3 * sync_policy::auto_max_bytes / rec_sz);
+    for (size_t i = 0; i < pcs.size(); ++i) {
+        pcs[i] = 0x1'0000'0000 + 4 * i;
+    }
+    // the policy and the instructions between two sync frames past the first
+    const std::vector<std::pair<sync_policy, uint64_t>> cases{
+        {sync_policy::fixed_bytes(4096), 4096 / rec_sz},
+        {sync_policy::fixed_instructions(1000), 1000},
+        // frames no closer than auto_min_bytes, then the target, then auto_max_bytes
+        {sync_policy::automatic(100), sync_policy::auto_min_bytes / rec_sz},
+        {sync_policy::automatic(), sync_policy::default_insts},
+        {sync_policy::automatic(UINT64_MAX), sync_policy::auto_max_bytes / rec_sz},
+    };
+    for (const auto &[sync, expected_insts] : cases) {
+        {
+            TraceLog trace{dir, 0, true, {.sync = sync}};
+            trace.log_batch(1, pcs);
+        }
+        CompressedFile<log_thread_hdr> fh{dir / "thread-1.bin", true};
+        REQUIRE(fh.header().sync_mode == (uint8_t)sync.mode);
+        REQUIRE(fh.header().sync_interval == sync.interval);
+        const auto insts = sync_frame_insts(fh.read());
+        REQUIRE(insts.size() > 2);
+        REQUIRE(insts[0] == 0);
+        for (size_t i = 2; i < insts.size(); ++i) {
+            REQUIRE(insts[i] - insts[i - 1] == expected_insts);
+        }
+    }
+    std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("v2-sync-frames-match-v1", TS) {
+    const auto dir = std::filesystem::temp_directory_path() / fmt::format("log-v2-{:d}", getpid());
+    // branches of several v2 PC sizes so v2 records shrink by varying amounts
+    std::vector<uint64_t> pcs(20000);
+    uint64_t pc = 0x1'0000'0000;
+    for (size_t i = 0; i < pcs.size(); ++i) {
+        pc     = i % 7 == 6 ? pc + (0x40ull << (i % 5 * 6)) : pc + 4;
+        pcs[i] = pc;
+    }
+    const auto regions = fake_macho_regions();
+    std::map<record_format, std::vector<uint8_t>> records;
+    for (const auto format : {record_format::v1, record_format::v2}) {
+        const auto format_dir = dir / fmt::format("{:d}", (int)format);
+        std::filesystem::create_directories(format_dir);
+        {
+            TraceLog trace{format_dir, 0, true,
+                           {.sync = sync_policy::fixed_bytes(4096), .format = format}};
+            trace.log_batch(1, pcs);
+            // adds the seek points
+            trace.write(regions);
+        }
+        const auto path = format_dir / "thread-1.bin";
+        CompressedFile<log_thread_hdr> fh{path, true};
+        const auto body = fh.read();
+        if (format == record_format::v2) {
+            LogMsgV2Decoder{}.decode(body, records[format]);
+            REQUIRE(LogMsgV2Decoder::decoded_size(body) == records[format].size());
+            REQUIRE(body.size() < records[format].size());
+        } else {
+            records[format] = body;
+        }
+        // the seek points are at the sync frames in the file's own format
+        LogThreadStream stream{path};
+        const auto insts = sync_frame_insts(records[format]);
+        REQUIRE(insts.size() > 10);
+        REQUIRE(stream.seek(insts[insts.size() / 2] + 1)->sync_num_inst() ==
+                insts[insts.size() / 2]);
+    }
+    // byte intervals count v1 bytes in either format
+    REQUIRE(records[record_format::v1] == records[record_format::v2]);
+    std::filesystem::remove_all(dir);
+}
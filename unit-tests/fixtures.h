@@ -0,0 +1,127 @@
+#pragma once
+
+#include "xnu-trace/xnu-trace.h"
+
+// Sets the compression scheduler's frame size for the files opened while it lives and restores
+// the previous one, also when a failing REQUIRE throws.
+class frame_size_scope {
+public:
+    explicit frame_size_scope(size_t frame_sz)
+        : m_orig_frame_sz{xnutrace_compression_scheduler.frame_size()} {
+        xnutrace_compression_scheduler.set_frame_size(frame_sz);
+    }
+    ~frame_size_scope() {
+        xnutrace_compression_scheduler.set_frame_size(m_orig_frame_sz);
+    }
+    frame_size_scope(const frame_size_scope &)            = delete;
+    frame_size_scope &operator=(const frame_size_scope &) = delete;
+
+private:
+    const size_t m_orig_frame_sz;
+};
+
+// One zeroed JIT page standing in for the target's images, enough for TraceLog::write() to
+// produce a readable bundle without a target task.
+inline MachORegions fake_macho_regions() {
+    const std::string path{"fake-jit"};
+    const log_region region{
+        .base = 0x1'0000'0000, .size = PAGE_SZ, .is_jit = true, .path_len = path.size()};
+    std::vector<uint8_t> region_buf(sizeof(region) + path.size());
+    memcpy(region_buf.data(), &region, sizeof(region));
+    memcpy(region_buf.data() + sizeof(region), path.data(), path.size());
+    std::map<sha256_t, std::vector<uint8_t>> regions_bytes;
+    regions_bytes[sha256_t{}].resize(PAGE_SZ);
+    return {(const log_region *)region_buf.data(), 1, regions_bytes};
+}
+
+// Hand-built v1 records for the decoder tests. The offsets of the records and sync frames are
+// kept, sync frames keyed by the instruction count they carry.
+struct log_builder {
+    std::vector<uint8_t> buf;
+    std::vector<size_t> record_offs;
+    std::vector<seek_point> syncs;
+
+    void sync(const log_arm64_cpu_context &ctx, uint64_t num_inst) {
+        const auto off = buf.size();
+        syncs.emplace_back(seek_point{.key = num_inst, .decomp_off = off});
+        buf.resize(off + log_msg::size_full_ctx);
+        memcpy(&buf[off], log_msg::sync_frame_buf_hdr, sizeof(log_msg::sync_frame_buf_hdr));
+        memcpy(&buf[off + sizeof(log_msg::sync_frame_buf_hdr)], &num_inst, sizeof(num_inst));
+        memcpy(&buf[off + log_msg::sync_frame_sz], &ctx, sizeof(ctx));
+    }
+    void sync(uint64_t pc, uint64_t num_inst, uint64_t sp = 0) {
+        sync({.pc = pc, .sp = sp}, num_inst);
+    }
+    // vals are the branch target, SP and changed GPRs in record order, vecs the changed vectors
+    void record(uint32_t gpr_changed, uint32_t vec_changed, const std::vector<uint64_t> &vals = {},
+                const std::vector<uint128_t> &vecs = {}) {
+        record_offs.emplace_back(buf.size());
+        const log_msg hdr{.gpr_changed = gpr_changed, .vec_changed = vec_changed};
+        append(&hdr, sizeof(hdr));
+        append(vals.data(), vals.size() * sizeof(uint64_t));
+        append(vecs.data(), vecs.size() * sizeof(uint128_t));
+    }
+    // branch target and SP as zig-zag varint deltas, followed by the changed GPRs
+    void delta(uint32_t gpr_changed, uint32_t vec_changed, const std::vector<int64_t> &deltas,
+               const std::vector<uint64_t> &gprs = {}) {
+        record(gpr_changed, rpc_set_pc_sp_delta(vec_changed));
+        for (const auto d : deltas) {
+            uint8_t vbuf[10];
+            append(vbuf, varint_encode(vbuf, zigzag_encode(d)));
+        }
+        append(gprs.data(), gprs.size() * sizeof(uint64_t));
+    }
+    void pc(uint64_t pc) {
+        record(rpc_set_pc_branched(0), 0, {pc});
+    }
+    void seq() {
+        record(0, 0);
+    }
+    void run(uint32_t len, std::optional<uint64_t> pc) {
+        if (pc) {
+            record(rpc_set_pc_branched(rpc_set_bb_run(0)), len, {*pc});
+        } else {
+            record(rpc_set_bb_run(0), len);
+        }
+    }
+    // memory access section for the record just added, which must have rpc_set_mem
+    void mem(const std::vector<mem_access> &accesses, bool delta, uint64_t &last_addr) {
+        uint32_t mem_changed = mpc_set_num_mem_accesses(0, accesses.size());
+        for (uint32_t i = 0; i < accesses.size(); ++i) {
+            mem_changed = mpc_set_mem_access_sz(mem_changed, i, accesses[i].size);
+            if (accesses[i].read) {
+                mem_changed = mpc_set_read(mem_changed, i);
+            }
+            if (accesses[i].write) {
+                mem_changed = mpc_set_write(mem_changed, i);
+            }
+        }
+        if (delta) {
+            mem_changed = mpc_set_addr_delta(mem_changed);
+        }
+        const bool values = accesses.front().value;
+        if (values) {
+            mem_changed = mpc_set_values(mem_changed);
+        }
+        append(&mem_changed, sizeof(mem_changed));
+        for (const auto &access : accesses) {
+            uint8_t abuf[10];
+            size_t sz = sizeof(access.addr);
+            if (delta) {
+                sz = varint_encode(abuf, zigzag_encode((int64_t)(access.addr - last_addr)));
+            } else {
+                memcpy(abuf, &access.addr, sz);
+            }
+            append(abuf, sz);
+            last_addr = access.addr;
+        }
+        if (values) {
+            for (const auto &access : accesses) {
+                append(access.value, access.size);
+            }
+        }
+    }
+    void append(const void *p, size_t sz) {
+        buf.insert(buf.end(), (const uint8_t *)p, (const uint8_t *)p + sz);
+    }
+};